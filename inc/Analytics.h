@@ -19,8 +19,12 @@
 #ifndef ANALYTICS_H
 #define ANALYTICS_H
 
+#include <qcc/Condition.h>
 #include <qcc/Debug.h>
+#include <qcc/Mutex.h>
 #include <qcc/String.h>
+#include <qcc/Thread.h>
+#include <qcc/atomic.h>
 
 #include <alljoyn/BusAttachment.h>
 #include <alljoyn/DBusStd.h>
@@ -28,14 +32,123 @@
 #include <alljoyn/BusObject.h>
 #include <alljoyn/MsgArg.h>
 #include <alljoyn/version.h>
+
+#include <deque>
 #include <map>
+#include <vector>
+
+#include "AnalyticsDeviceTable.h"
+#include "AnalyticsExecutor.h"
+#include "AnalyticsFilter.h"
+#include "AnalyticsKV.h"
+#include "AnalyticsSchema.h"
+#include "AnalyticsSketch.h"
+#include "AnalyticsStats.h"
 
 #define QCC_MODULE "ALLJOYN_ANALYTICS_SERVICE"
 
+/* service statistics, implemented by the bus object alongside the analytics interface. */
+#define ANALYTICS_STATS_INTERFACE "org.allseen.Analytics.Stats"
+
+/*
+ * Maximum number of SubmitError signals the bus object will emit per
+ * second to one device.  Errors beyond this are counted and reported in
+ * the device's next signal.
+ */
+#ifndef ANALYTICS_ERROR_SIGNALS_PER_SECOND
+#define ANALYTICS_ERROR_SIGNALS_PER_SECOND 10
+#endif
+
+/* maximum number of devices listed by GetStats, those buffering the most first. */
+#ifndef ANALYTICS_STATS_MAX_DEVICES
+#define ANALYTICS_STATS_MAX_DEVICES 32
+#endif
+
+/* maximum number of destroyed device objects an AnalyticsDevicePool keeps. */
+#ifndef ANALYTICS_DEVICE_POOL_SIZE
+#define ANALYTICS_DEVICE_POOL_SIZE 256
+#endif
+
+/*
+ * Load levels reported through the LoadLevel property and the Throttle
+ * signal.  Each level asks clients for everything the lower levels do.
+ */
+enum AnalyticsLoadLevel {
+    ANALYTICS_LOAD_NORMAL = 0,       /* no restrictions */
+    ANALYTICS_LOAD_BATCH = 1,        /* batch events with SubmitEvents or compact events */
+    ANALYTICS_LOAD_SLOW = 2,         /* reduce the event rate */
+    ANALYTICS_LOAD_NO_DELIVERY = 3   /* stop calling RequestDelivery */
+};
+
+/*
+ * About data field, of type u, in which a service may announce its load
+ * level, so that clients choosing between services need not join each.
+ */
+#define ANALYTICS_ABOUT_LOAD_LEVEL "AnalyticsLoadLevel"
+
+/*
+ * About data fields, of types s and u, in which a service running as one
+ * shard of several announces the shard's name and its capacity relative
+ * to the other shards.  See AnalyticsShards.
+ */
+#define ANALYTICS_ABOUT_SHARD "AnalyticsShard"
+#define ANALYTICS_ABOUT_CAPACITY "AnalyticsCapacity"
+
+/*
+ * Limits for the inputs to the load level.  Load is the highest of the
+ * three inputs as a percentage of its limit; levels start at 50%, 75%
+ * and 100%.  A level is left only when load has fallen
+ * ANALYTICS_LOAD_HYSTERESIS points below its start and the level has
+ * been held for ANALYTICS_LOAD_HOLD_MS.
+ */
+#ifndef ANALYTICS_LOAD_MAX_BUFFERED_BYTES
+#define ANALYTICS_LOAD_MAX_BUFFERED_BYTES (64 * 1024 * 1024)
+#endif
+#ifndef ANALYTICS_LOAD_MAX_DELIVERY_BACKLOG
+#define ANALYTICS_LOAD_MAX_DELIVERY_BACKLOG 1000
+#endif
+#ifndef ANALYTICS_LOAD_MAX_LATENCY_MS
+#define ANALYTICS_LOAD_MAX_LATENCY_MS 2000
+#endif
+#ifndef ANALYTICS_LOAD_HYSTERESIS
+#define ANALYTICS_LOAD_HYSTERESIS 15
+#endif
+#ifndef ANALYTICS_LOAD_HOLD_MS
+#define ANALYTICS_LOAD_HOLD_MS 5000
+#endif
+
+/* number of threads tearing down disconnected devices. */
+#ifndef ANALYTICS_DRAIN_THREADS
+#define ANALYTICS_DRAIN_THREADS 4
+#endif
+
+/* time allowed to flush a disconnected device, counted from the disconnect. */
+#ifndef ANALYTICS_DRAIN_TIMEOUT_MS
+#define ANALYTICS_DRAIN_TIMEOUT_MS 10000
+#endif
+
 
-/* Pure virtual interface to be implemented by analytics vendor. */
+/*
+ * Pure virtual interface to be implemented by analytics vendor.
+ *
+ * The kvs arrays passed to these methods are the entries of an a{sv};
+ * AnalyticsKV (AnalyticsKV.h) gives a typed view of each entry.
+ */
 class AnalyticsDeviceObject {
     public:
+        AnalyticsDeviceObject() :
+            lastActive(0),
+            idle(false),
+            footprint(0),
+            buffered(0),
+            errorWindowStart(0),
+            errorsInWindow(0),
+            errorsSuppressed(0),
+            handlers(0),
+            stats(NULL)
+        {
+        }
+
         /* public methods of the analytics interface, to be implemented. */
 
         virtual QStatus SubmitEvent(const char **errMsg, const char *name,
@@ -46,20 +159,142 @@ class AnalyticsDeviceObject {
                 const ajn::MsgArg *) = 0;
         virtual void RequestDelivery() {}
 
+        /*
+         * register the layout of an event: its name, its keys and one
+         * AllJoyn type code per key.  id is set to the schema id used by
+         * SubmitCompactEvent.  Schemas belong to this device object.
+         */
+        virtual QStatus RegisterEventSchema(const char **errMsg, const char *name,
+                size_t count, const char *const *keys, const char *types, uint32_t &id)
+        {
+            return schemas.Register(errMsg, name, count, keys, types, id);
+        }
+
+        /*
+         * log an event using a registered schema.  values are the entries
+         * of an av, one per schema key, in order.  The default rebuilds the
+         * a{sv} and calls SubmitEvent; vendors can override it to use the
+         * schema's keys directly.
+         */
+        virtual QStatus SubmitCompactEvent(const char **errMsg, uint32_t id,
+                size_t count, const ajn::MsgArg *values, uint64_t timestamp = 0);
+
+        /*
+         * the schema registered under id through the default
+         * RegisterEventSchema, or NULL.
+         */
+        const AnalyticsEventSchema *FindEventSchema(uint32_t id) const
+        {
+            return schemas.Find(id);
+        }
+
+        /*
+         * Completion token for asynchronous operations.  The device object
+         * calls Complete() exactly once, from any thread, when the
+         * operation has finished.  The token must not be used afterwards.
+         */
+        class Completion {
+            public:
+                virtual void Complete(QStatus status, const char *errMsg) = 0;
+                virtual ~Completion() {}
+        };
+
+        /*
+         * asynchronous form of RequestDelivery, used by the bus object so
+         * that AllJoyn dispatch threads never wait on the cloud service.
+         * done may be NULL if the caller does not need to know the outcome.
+         * The default implementation delivers synchronously; vendors that
+         * can deliver in the background should override it.
+         */
+        virtual void RequestDeliveryAsync(Completion *done) {
+            RequestDelivery();
+            if (done) {
+                done->Complete(ER_OK, NULL);
+            }
+        }
+
         /*
          * called by the bus object when no more method calls are expected.
          * the AnalyticsDeviceObject is expected to flush any buffered data
-         * to the cloud service and free itself.  After calling this,
-         * the AnalyticsBusObject is no longer responsible for freeing this
-         * object.
+         * to the cloud service.  The bus object then returns the object
+         * to its Factory with Destroy().
          */
         virtual void Shutdown() {
             RequestDelivery();
-            delete this;
         }
 
+        /*
+         * return the object to its freshly constructed state so that a
+         * Factory can reuse it for another device.  Called after
+         * Shutdown().  Memory may be kept for the next user.
+         */
+        virtual void Reset() {
+            schemas.Clear();
+        }
+
+        /*
+         * called when the device has been idle for a while, after its
+         * buffered data has been handed off for delivery.  Release any
+         * memory that is not needed to keep the device's configuration.
+         */
+        virtual void Compact() {}
+
+        /*
+         * limit any delivery started by later calls to about ms
+         * milliseconds, including retries.  0 means no limit.  The bus
+         * object sets this before Shutdown() so that a slow cloud service
+         * cannot hold up teardown.
+         */
+        virtual void SetDeliveryTimeout(uint32_t ms) {}
+
+        /* approximate bytes of memory held by this object. */
+        virtual size_t MemoryFootprint() const {
+            return sizeof(*this) + schemas.Footprint();
+        }
+
+        /* bytes of event data waiting to be handed off for delivery. */
+        virtual size_t BufferedBytes() const { return 0; }
+
         virtual ~AnalyticsDeviceObject() {};
 
+        /*
+         * When the bus object runs with an AnalyticsExecutor, all calls
+         * into this device object are posted to this strand, so they run
+         * one at a time and in order, though not always on the same thread.
+         */
+        AnalyticsStrand strand;
+
+        /*
+         * bookkeeping for the bus object: the time of the last method
+         * call, whether the device has been compacted since, and its
+         * MemoryFootprint() and BufferedBytes() as of the last call.
+         * lastActive and idle are guarded by the bus object's devLock.
+         */
+        uint64_t lastActive;
+        bool idle;
+        volatile uint32_t footprint;
+        volatile uint32_t buffered;
+
+        /* SubmitError rate limiting for this device, guarded by devLock. */
+        uint64_t errorWindowStart;
+        uint32_t errorsInWindow;
+        uint32_t errorsSuppressed;
+
+        /*
+         * calls running against the device on dispatch threads, when the
+         * bus object has no executor.  Raised under devLock when a call is
+         * dispatched and lowered when its handler returns; the drain
+         * queue waits for it to reach 0 before retiring the device.
+         */
+        volatile int32_t handlers;
+
+        /*
+         * where the device object records the ANALYTICS_BYTES_ENCODED and
+         * delivery counters, or NULL.  Set by the bus object before the
+         * device's first call.
+         */
+        AnalyticsStats *stats;
+
         /*
          * An AnalyticsDeviceObject::Factory is passed to the constructor of
          * the bus object to tell it how to make the appropriate
@@ -73,11 +308,120 @@ class AnalyticsDeviceObject {
                 virtual AnalyticsDeviceObject *Construct() = 0;
                 virtual void Destroy(AnalyticsDeviceObject *ado) { delete ado; }
                 virtual ~Factory() {}
+
+                /*
+                 * load inputs for data that has left the device objects:
+                 * the number of updates waiting for delivery, and their
+                 * size in bytes.
+                 */
+                virtual size_t DeliveryBacklog() { return 0; }
+                virtual size_t DeliveryBytes() { return 0; }
         };
+
+    protected:
+        /* event schemas registered by this device. */
+        AnalyticsSchemaTable schemas;
 };
 
 
-class AnalyticsBusObject : public ajn::BusObject, ajn::BusListener {
+/*
+ * Tears down disconnected devices in the background, so that a burst of
+ * disconnects never waits on the cloud service.  A fixed number of
+ * threads calls Shutdown() on each device, then returns it to the
+ * factory, once no handler is still running against it.  Each device
+ * must be flushed within timeoutMs of being queued; one still queued
+ * after that is returned without a flush.
+ */
+class AnalyticsDrainQueue {
+    public:
+        AnalyticsDrainQueue(AnalyticsDeviceObject::Factory *factory,
+                unsigned threads = ANALYTICS_DRAIN_THREADS,
+                uint32_t timeoutMs = ANALYTICS_DRAIN_TIMEOUT_MS);
+
+        /* tears down every device still queued, then stops the workers. */
+        ~AnalyticsDrainQueue();
+
+        /* take over dev, which must no longer be reachable by method calls. */
+        void Enqueue(AnalyticsDeviceObject *dev);
+
+        /* number of devices waiting for or in teardown. */
+        size_t Depth();
+
+        /* number of devices returned unflushed because their deadline passed. */
+        uint32_t Expired() const { return expired; }
+
+    private:
+        struct Job {
+            AnalyticsDeviceObject *dev;
+            uint64_t deadline;
+        };
+
+        class Worker : public qcc::Thread {
+            public:
+                Worker(AnalyticsDrainQueue &queue) :
+                    qcc::Thread("AnalyticsDrain"),
+                    queue(queue)
+                {
+                }
+            protected:
+                virtual qcc::ThreadReturn STDCALL Run(void *arg);
+            private:
+                AnalyticsDrainQueue &queue;
+        };
+        friend class Worker;
+
+        /* wait for the next job.  Returns false once stopping and drained. */
+        bool Next(Job &job);
+
+        void Retire(Job &job);
+
+        AnalyticsDeviceObject::Factory *factory;
+        uint32_t timeoutMs;
+
+        qcc::Mutex lock;
+        qcc::Condition ready;
+        std::deque<Job> jobs;
+        size_t inFlight;
+        bool stopping;
+        std::vector<Worker *> workers;
+
+        volatile int32_t expired;
+};
+
+
+/*
+ * Factory that keeps destroyed device objects, after Reset(), and hands
+ * them out again from Construct(), so that devices which reconnect often
+ * do not churn the heap.  Vendors implement Allocate() to make a new
+ * object when the pool is empty.  Objects still pooled are deleted with
+ * the pool.
+ */
+class AnalyticsDevicePool : public AnalyticsDeviceObject::Factory {
+    public:
+        AnalyticsDevicePool(size_t maxPooled = ANALYTICS_DEVICE_POOL_SIZE) :
+            maxPooled(maxPooled)
+        {
+        }
+
+        virtual ~AnalyticsDevicePool();
+
+        virtual AnalyticsDeviceObject *Construct();
+        virtual void Destroy(AnalyticsDeviceObject *dev);
+
+        /* number of objects waiting for reuse. */
+        size_t Pooled();
+
+    protected:
+        virtual AnalyticsDeviceObject *Allocate() = 0;
+
+    private:
+        qcc::Mutex lock;
+        std::vector<AnalyticsDeviceObject *> pool;
+        size_t maxPooled;
+};
+
+
+class AnalyticsBusObject : public ajn::BusObject, ajn::SessionListener {
 
     public:
 
@@ -118,22 +462,165 @@ class AnalyticsBusObject : public ajn::BusObject, ajn::BusListener {
                 if (status != ER_OK) {
                     return status;
                 }
+
+                /*
+                 * batched form of SubmitEvent.  The reply lists only the
+                 * records that failed, as (index, error name, error message).
+                 */
+                status = iface->AddMethod("SubmitEvents", "a(stua{sv})", "a(uss)", "events,failures", 0);
+                if (status != ER_OK) {
+                    return status;
+                }
+
+                /*
+                 * compact events: register the event's name, keys and
+                 * key types ("s" holding one type code per key) once, then
+                 * submit only the values, in key order, under the
+                 * returned schema id.
+                 */
+                status = iface->AddMethod("RegisterEventSchema", "sass", "u", "name,keys,types,id", 0);
+                if (status != ER_OK) {
+                    return status;
+                }
+                status = iface->AddMethod("SubmitCompactEvent", "utuav", NULL, "id,timestamp,sequence,values", 0);
+                if (status != ER_OK) {
+                    return status;
+                }
+
+                /*
+                 * Any method may be called with ALLJOYN_FLAG_NO_REPLY_EXPECTED.
+                 * No reply is sent in that case; failures are reported
+                 * instead through this rate-limited signal, as (event or
+                 * method name, sequence, error name, error message, number
+                 * of errors suppressed since the last signal).
+                 */
+                status = iface->AddSignal("SubmitError", "sussu", "name,sequence,error,message,suppressed", 0);
+                if (status != ER_OK) {
+                    return status;
+                }
+
+                /*
+                 * the service's AnalyticsLoadLevel.  Throttle carries the
+                 * new level to every session whenever it changes.
+                 */
+                status = iface->AddProperty("LoadLevel", "u", PROP_ACCESS_READ);
+                if (status != ER_OK) {
+                    return status;
+                }
+                status = iface->AddPropertyAnnotation("LoadLevel",
+                        "org.freedesktop.DBus.Property.EmitsChangedSignal", "true");
+                if (status != ER_OK) {
+                    return status;
+                }
+                status = iface->AddSignal("Throttle", "u", "level", 0);
+                if (status != ER_OK) {
+                    return status;
+                }
+                iface->Activate();
+            }
+            return ER_OK;
+        }
+
+        /* Construct and install the ANALYTICS_STATS_INTERFACE description. */
+        static QStatus CreateStatsInterface(ajn::BusAttachment &bus)
+        {
+            using namespace ajn;
+            QStatus status = ER_OK;
+            InterfaceDescription *iface = NULL;
+            if (!bus.GetInterface(ANALYTICS_STATS_INTERFACE)) {
+                status = bus.CreateInterface(ANALYTICS_STATS_INTERFACE, iface, AJ_IFC_SECURITY_REQUIRED);
+                if (status != ER_OK) {
+                    return status;
+                }
+                if (!iface) {
+                    return ER_BUS_CANNOT_ADD_INTERFACE;
+                }
+
+                /*
+                 * heavy-hitter event names and devices, as (name, count,
+                 * maximum overcount), and the estimated number of distinct
+                 * values of each tracked key.  Empty unless the service
+                 * keeps sketches.
+                 */
+                status = iface->AddMethod("GetSketches", NULL, "a(stt)a(stt)a(st)", "events,devices,keys", 0);
+                if (status != ER_OK) {
+                    return status;
+                }
+
+                /*
+                 * counters, rates, buffered bytes and latency histograms,
+                 * keyed by name.  Histograms are (count, p50, p99, p99.9,
+                 * max, (bucket top, count) for each non-empty bucket), in
+                 * microseconds.  Empty unless the service keeps stats.
+                 */
+                status = iface->AddMethod("GetStats", NULL, "a{sv}", "stats", 0);
+                if (status != ER_OK) {
+                    return status;
+                }
                 iface->Activate();
             }
             return ER_OK;
         }
 
 
-        AnalyticsBusObject(ajn::BusAttachment &bus, AnalyticsDeviceObject::Factory *factory, const char *path, const char *ifname) :
+        /*
+         * If executor is not NULL, device object calls are made from its
+         * workers, on each device's strand, instead of on the AllJoyn
+         * dispatch thread that received the method call.
+         */
+        AnalyticsBusObject(ajn::BusAttachment &bus, AnalyticsDeviceObject::Factory *factory, const char *path, const char *ifname,
+                AnalyticsExecutor *executor = NULL) :
             BusObject(path),
             factory(factory),
+            executor(executor),
+            drain(factory),
             bus(bus),
-            ifName(ifname)
+            ifName(ifname),
+            submitErrorMember(NULL),
+            throttleMember(NULL),
+            submitEventMember(NULL),
+            requestDeliveryMember(NULL),
+            loadLevel(ANALYTICS_LOAD_NORMAL),
+            levelChangedAt(0),
+            maxLatencyMs(0),
+            errorWindowStart(0),
+            errorsInWindow(0),
+            errorsSuppressed(0),
+            pendingReplies(0),
+            pendingTasks(0),
+            filter(NULL),
+            sketches(NULL),
+            stats(NULL)
         {
         }
 
         virtual ~AnalyticsBusObject();
 
+        /*
+         * drop or sample incoming events with a compiled filter.  Must be
+         * called before the bus object is registered.  SubmitEvent calls
+         * are filtered on the dispatch thread, before a device is looked
+         * up; events in SubmitEvents and compact events are filtered
+         * before they reach the device object.  Dropped events are
+         * reported to the caller as successful.
+         */
+        void SetFilter(AnalyticsFilter *f) { filter = f; }
+
+        /*
+         * count the events that pass the filter in s, and report them
+         * through GetSketches.  Must be called before the bus object is
+         * registered.  Like the filter, SubmitEvent calls are counted on
+         * the dispatch thread.
+         */
+        void SetSketches(AnalyticsSketches *s) { sketches = s; }
+
+        /*
+         * record counters and latencies in s, and hand it to every device
+         * object, for GetStats.  Must be called before the bus object is
+         * registered.
+         */
+        void SetStats(AnalyticsStats *s) { stats = s; }
+
         QStatus Initialize()
         {
             QStatus status = ER_OK;
@@ -147,11 +634,27 @@ class AnalyticsBusObject : public ajn::BusObject, ajn::BusListener {
             if (status != ER_OK) {
                 return status;
             }
+            submitErrorMember = intf->GetMember("SubmitError");
+            throttleMember = intf->GetMember("Throttle");
+            submitEventMember = intf->GetMember("SubmitEvent");
+            requestDeliveryMember = intf->GetMember("RequestDelivery");
             const ajn::BusObject::MethodEntry methodEntries[] = {
                 { intf->GetMember("SubmitEvent"),
                     static_cast<ajn::MessageReceiver::MethodHandler>(
                             &AnalyticsBusObject::SubmitEvent)
                 },
+                { intf->GetMember("SubmitEvents"),
+                    static_cast<ajn::MessageReceiver::MethodHandler>(
+                            &AnalyticsBusObject::SubmitEvents)
+                },
+                { intf->GetMember("RegisterEventSchema"),
+                    static_cast<ajn::MessageReceiver::MethodHandler>(
+                            &AnalyticsBusObject::RegisterEventSchema)
+                },
+                { intf->GetMember("SubmitCompactEvent"),
+                    static_cast<ajn::MessageReceiver::MethodHandler>(
+                            &AnalyticsBusObject::SubmitCompactEvent)
+                },
                 { intf->GetMember("RequestDelivery"),
                     static_cast<ajn::MessageReceiver::MethodHandler>(
                             &AnalyticsBusObject::RequestDelivery)
@@ -166,14 +669,252 @@ class AnalyticsBusObject : public ajn::BusObject, ajn::BusListener {
                 },
             };
             status = AddMethodHandlers(methodEntries, sizeof(methodEntries)/sizeof(ajn::BusObject::MethodEntry));
+            if (status != ER_OK) {
+                return status;
+            }
+
+            status = CreateStatsInterface(bus);
+            if (status != ER_OK) {
+                return status;
+            }
+            const ajn::InterfaceDescription* statsIntf = bus.GetInterface(ANALYTICS_STATS_INTERFACE);
+            status = AddInterface(*statsIntf);
+            if (status != ER_OK) {
+                return status;
+            }
+            const ajn::BusObject::MethodEntry statsEntries[] = {
+                { statsIntf->GetMember("GetSketches"),
+                    static_cast<ajn::MessageReceiver::MethodHandler>(
+                            &AnalyticsBusObject::GetSketches)
+                },
+                { statsIntf->GetMember("GetStats"),
+                    static_cast<ajn::MessageReceiver::MethodHandler>(
+                            &AnalyticsBusObject::GetStats)
+                },
+            };
+            status = AddMethodHandlers(statsEntries, sizeof(statsEntries)/sizeof(ajn::BusObject::MethodEntry));
             return status;
         }
 
-        /* Used to detect session disconnect and handle clean up */
-        void NameOwnerChanged(const char *, const char *, const char *);
+        /*
+         * Device lifetime follows the analytics sessions.  The application
+         * calls SessionJoined from its SessionPortListener for every
+         * session joined on the analytics port; the bus object then
+         * listens to that session and shuts a device down once its bus
+         * name has left every analytics session.  A method call that
+         * arrives over a session before SessionJoined has been called for
+         * it records the membership itself; calls outside any session are
+         * refused with ER_BUS_NO_SESSION.
+         */
+        void SessionJoined(ajn::SessionId id, const char *joiner);
+
+        /* SessionListener */
+        virtual void SessionLost(ajn::SessionId id, SessionLostReason reason);
+        virtual void SessionMemberAdded(ajn::SessionId id, const char *uniqueName);
+        virtual void SessionMemberRemoved(ajn::SessionId id, const char *uniqueName);
+
+        /*
+         * flush and compact every device that has had no method call in
+         * the last idleMs milliseconds and has not been compacted since.
+         * Without an executor, devices with a call still running are left
+         * for a later pass.  Meant to be called periodically.  Returns the
+         * number of devices compacted.
+         */
+        uint32_t CompactIdle(uint32_t idleMs);
+
+        struct LoadStats {
+            uint32_t level;             /* an AnalyticsLoadLevel */
+            uint32_t load;              /* percent of the nearest limit */
+            uint64_t bufferedBytes;     /* in device objects and awaiting delivery */
+            uint32_t deliveryBacklog;
+            uint32_t latencyMs;         /* worst dispatch latency since the last update */
+        };
+
+        /*
+         * recompute the load level from its inputs, notifying clients if
+         * it changes.  Meant to be called about once a second.  Returns
+         * the new level.
+         */
+        uint32_t UpdateLoad(LoadStats *stats = NULL);
+
+        uint32_t GetLoadLevel() const { return loadLevel; }
+
+        struct MemoryStats {
+            uint32_t devices;
+            uint32_t idleDevices;   /* compacted since their last call */
+            uint64_t totalBytes;    /* sum of the devices' footprints */
+            uint32_t maxBytes;      /* largest single device */
+        };
+        void GetMemoryStats(MemoryStats &stats);
+
+        /*
+         * the arguments of a SubmitEvent call, unmarshalled once on the
+         * dispatch thread.  The pointers are into the message, which the
+         * task holds a reference to.
+         */
+        struct EventArgs {
+            const char *name;
+            uint64_t timestamp;
+            const ajn::MsgArg *kvs;
+            uint32_t sequence;
+            uint32_t count;
+        };
+
+        /*
+         * what the SubmitEvent and RequestDelivery handlers do once the
+         * call is unmarshalled, for a call from sender in session
+         * sessionId.  msg is only replied to; an empty Message, one that
+         * is not a method call, gets no reply, which lets submit_bench
+         * drive this path without a bus.  For such calls sender and the
+         * pointers in event must stay valid until the call has run.
+         * Initialize must have been called.
+         */
+        void SubmitEventFrom(const char *sender, ajn::SessionId sessionId,
+                const EventArgs &event, ajn::Message &msg);
+        void RequestDeliveryFrom(const char *sender, ajn::SessionId sessionId,
+                ajn::Message &msg);
+
+    protected:
+        /* property access for LoadLevel. */
+        virtual QStatus Get(const char *ifcName, const char *propName, ajn::MsgArg &val);
 
     private:
 
+        /*
+         * holds a RequestDelivery call until the device object reports
+         * that the delivery has finished, then sends the method reply.
+         */
+        class DeliveryReply : public AnalyticsDeviceObject::Completion {
+            public:
+                DeliveryReply(AnalyticsBusObject &owner, ajn::Message &msg) :
+                    owner(owner),
+                    msg(msg)
+                {
+                }
+                virtual void Complete(QStatus status, const char *errMsg);
+            private:
+                AnalyticsBusObject &owner;
+                ajn::Message msg;
+        };
+        friend class DeliveryReply;
+
+        /*
+         * the part of a method handler that runs against a device object.
+         * event is the parsed SubmitEvent call, or NULL for other methods.
+         */
+        typedef void (AnalyticsBusObject::*DeviceHandler)(AnalyticsDeviceObject *dev,
+                const ajn::InterfaceDescription::Member *member, ajn::Message &msg,
+                const EventArgs *event);
+
+        /* runs a DeviceHandler on the device's strand. */
+        class DeviceTask : public AnalyticsTask {
+            public:
+                DeviceTask(AnalyticsBusObject &owner, DeviceHandler handler,
+                        const ajn::InterfaceDescription::Member *member,
+                        ajn::Message &msg, const EventArgs *event,
+                        AnalyticsDeviceObject *dev, uint64_t posted, uint64_t received) :
+                    owner(owner),
+                    handler(handler),
+                    member(member),
+                    msg(msg),
+                    dev(dev),
+                    posted(posted),
+                    received(received)
+                {
+                    if (event) {
+                        this->event = *event;
+                    } else {
+                        this->event.name = NULL;
+                    }
+                }
+                virtual void Run();
+                virtual void Release();
+            private:
+                AnalyticsBusObject &owner;
+                DeviceHandler handler;
+                const ajn::InterfaceDescription::Member *member;
+                ajn::Message msg;
+                EventArgs event;        /* name is NULL if there is none */
+                AnalyticsDeviceObject *dev;
+                uint64_t posted;
+                uint64_t received;  /* in microseconds, if keeping stats */
+        };
+        friend class DeviceTask;
+
+        /*
+         * fails to compile if a DeviceTask outgrows the executor's pooled
+         * blocks, which would put a heap allocation back on every call.
+         */
+        typedef char DeviceTaskFitsPool[sizeof(DeviceTask) <= ANALYTICS_TASK_BYTES ? 1 : -1];
+
+        /* final task on a device's strand. */
+        class ShutdownTask : public AnalyticsTask {
+            public:
+                ShutdownTask(AnalyticsBusObject &owner, AnalyticsDeviceObject *dev) :
+                    owner(owner),
+                    dev(dev)
+                {
+                }
+                virtual void Run() { owner.drain.Enqueue(dev); }
+                virtual void Release();
+            private:
+                AnalyticsBusObject &owner;
+                AnalyticsDeviceObject *dev;
+        };
+        friend class ShutdownTask;
+
+        /* flushes and compacts an idle device on its strand. */
+        class CompactTask : public AnalyticsTask {
+            public:
+                CompactTask(AnalyticsBusObject &owner, AnalyticsDeviceObject *dev) :
+                    owner(owner),
+                    dev(dev)
+                {
+                }
+                virtual void Run() { CompactDev(dev); }
+                virtual void Release();
+            private:
+                AnalyticsBusObject &owner;
+                AnalyticsDeviceObject *dev;
+        };
+        friend class CompactTask;
+
+        /*
+         * find or make the device for sender and run handler against it,
+         * either inline or on the device's strand.  msg is the call.
+         */
+        void Dispatch(DeviceHandler handler,
+                const ajn::InterfaceDescription::Member *member,
+                const char *sender, ajn::SessionId sessionId, ajn::Message &msg,
+                const EventArgs *event = NULL);
+
+        /*
+         * hand a device to the drain queue once the work already posted
+         * for it has run.  Without an executor it is queued at once, and
+         * the drain waits out the handlers counted in dev->handlers.
+         */
+        void ShutdownDev(AnalyticsDeviceObject *dev);
+
+        static void CompactDev(AnalyticsDeviceObject *dev);
+
+        /*
+         * run handler, then measure the device and record the latency of
+         * event submissions from received, in microseconds.
+         */
+        void RunHandler(DeviceHandler handler, AnalyticsDeviceObject *dev,
+                const ajn::InterfaceDescription::Member *member, ajn::Message &msg,
+                const EventArgs *event, uint64_t received);
+
+        /* record a device's memory use after a call. */
+        static void MeasureDev(AnalyticsDeviceObject *dev);
+
+        /*
+         * feed a call's latency to the load level: its wait on the
+         * device's strand or, without an executor, its time in the
+         * handler.
+         */
+        void NoteLatency(uint32_t latencyMs);
+
         /*
          * method to supply vendor-specific data (api keys, etc)
          * method to supply device identification data
@@ -186,20 +927,134 @@ class AnalyticsBusObject : public ajn::BusObject, ajn::BusListener {
         /* method to log an analytics event. */
         void SubmitEvent(const ajn::InterfaceDescription::Member*, ajn::Message &msg);
 
+        /* method to log a batch of analytics events in one call. */
+        void SubmitEvents(const ajn::InterfaceDescription::Member*, ajn::Message &msg);
+
+        /* method to register an event schema for SubmitCompactEvent. */
+        void RegisterEventSchema(const ajn::InterfaceDescription::Member*, ajn::Message &msg);
+
+        /* method to log an event as the values of a registered schema. */
+        void SubmitCompactEvent(const ajn::InterfaceDescription::Member*, ajn::Message &msg);
+
+        /* stats method to read the sketches. */
+        void GetSketches(const ajn::InterfaceDescription::Member*, ajn::Message &msg);
+
+        /* stats method to read the counters and histograms. */
+        void GetStats(const ajn::InterfaceDescription::Member*, ajn::Message &msg);
+
+        /* the device-specific parts of the methods above. */
+        void DoSetVendorDataOrDeviceData(AnalyticsDeviceObject *dev,
+                const ajn::InterfaceDescription::Member*, ajn::Message &msg,
+                const EventArgs *event);
+        void DoRequestDelivery(AnalyticsDeviceObject *dev,
+                const ajn::InterfaceDescription::Member*, ajn::Message &msg,
+                const EventArgs *event);
+        void DoSubmitEvent(AnalyticsDeviceObject *dev,
+                const ajn::InterfaceDescription::Member*, ajn::Message &msg,
+                const EventArgs *event);
+        void DoSubmitEvents(AnalyticsDeviceObject *dev,
+                const ajn::InterfaceDescription::Member*, ajn::Message &msg,
+                const EventArgs *event);
+        void DoRegisterEventSchema(AnalyticsDeviceObject *dev,
+                const ajn::InterfaceDescription::Member*, ajn::Message &msg,
+                const EventArgs *event);
+        void DoSubmitCompactEvent(AnalyticsDeviceObject *dev,
+                const ajn::InterfaceDescription::Member*, ajn::Message &msg,
+                const EventArgs *event);
+
         /*
-         * internal method to look up the object based on the bus name of the
-         * device that called this method, or Construct one if needed.
+         * reply to a method call with the given status, unless the caller
+         * asked for no reply, in which case a failure is reported with
+         * SignalError instead.  name and sequence identify the failed event.
          */
-        AnalyticsDeviceObject *MakeOrFindDev(ajn::Message &msg);
+        void ReplyStatus(ajn::Message &msg, QStatus status, const char *err,
+                const char *name = NULL, uint32_t sequence = 0);
+
+        /*
+         * emit a SubmitError signal to the caller, subject to the rate
+         * limit of the caller's device.
+         */
+        void SignalError(ajn::Message &msg, const char *name, uint32_t sequence,
+                QStatus status, const char *err);
+
+        /*
+         * internal method to look up the object based on sender, the bus
+         * name of the device that made a call over session sessionId, or
+         * Construct one if needed.  Sets status to ER_BUS_NO_SESSION, and
+         * returns NULL, if the caller is not in a session.  devLock must
+         * be held.
+         */
+        AnalyticsDeviceObject *MakeOrFindDev(const char *sender, ajn::SessionId sessionId,
+                QStatus &status);
+
+        /* record that name is in session id.  devLock must be held. */
+        void AddMember(ajn::SessionId id, const char *name);
+
+        /*
+         * AddMember, listening to the session first if it is new.
+         * Returns false if the listener cannot be set.  devLock must be
+         * held, so the listener is in place before anyone can find the
+         * session in sessions.
+         */
+        bool JoinSession(ajn::SessionId id, const char *name);
+
+        /*
+         * forget one session membership of name, returning its device if
+         * that was its last session.  The caller removes name from the
+         * session's list.  devLock must be held.
+         */
+        AnalyticsDeviceObject *RemoveMember(const qcc::String &name);
 
         AnalyticsDeviceObject::Factory *factory;
 
-        std::map<std::string,AnalyticsDeviceObject *> devMap;
+        AnalyticsExecutor *executor;
+
+        /* tears down devices after they disconnect. */
+        AnalyticsDrainQueue drain;
+
+        /* device objects keyed by sender bus name, guarded by devLock. */
+        AnalyticsDeviceTable devMap;
+        qcc::Mutex devLock;
+
+        /*
+         * analytics session membership, guarded by devLock: the bus names
+         * in each session, and the number of sessions each name is in.
+         */
+        std::map<ajn::SessionId, std::vector<qcc::String> > sessions;
+        std::map<qcc::String, uint32_t> memberships;
 
         ajn::BusAttachment &bus;
 
         qcc::String ifName;
 
+        const ajn::InterfaceDescription::Member *submitErrorMember;
+        const ajn::InterfaceDescription::Member *throttleMember;
+        const ajn::InterfaceDescription::Member *submitEventMember;
+        const ajn::InterfaceDescription::Member *requestDeliveryMember;
+
+        /* load level state.  Only UpdateLoad changes the level. */
+        volatile int32_t loadLevel;
+        uint64_t levelChangedAt;
+        volatile uint32_t maxLatencyMs;     /* reset by UpdateLoad */
+
+        /*
+         * SubmitError rate limiting for callers without a device, guarded
+         * by devLock; devices have their own.
+         */
+        uint64_t errorWindowStart;
+        uint32_t errorsInWindow;
+        uint32_t errorsSuppressed;
+
+        /* number of DeliveryReply objects not yet completed. */
+        volatile int32_t pendingReplies;
+
+        /* number of tasks posted but not yet released. */
+        volatile int32_t pendingTasks;
+
+        AnalyticsFilter *filter;
+        AnalyticsSketches *sketches;
+        AnalyticsStats *stats;
+
 };
 
 #endif
@@ -0,0 +1,231 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#ifndef ANALYTICSCLIENT_H
+#define ANALYTICSCLIENT_H
+
+#include <qcc/Condition.h>
+#include <qcc/Mutex.h>
+#include <qcc/String.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/BusAttachment.h>
+#include <alljoyn/MessageReceiver.h>
+#include <alljoyn/MsgArg.h>
+#include <alljoyn/ProxyBusObject.h>
+
+#include <vector>
+
+/* the event interface implemented by AnalyticsBusObject. */
+#define ANALYTICS_EVENT_INTERFACE "org.allseen.Analytics.AnalyticsEventAgent"
+
+/* events an AnalyticsClient holds before Submit() starts dropping them. */
+#ifndef ANALYTICS_CLIENT_CAPACITY
+#define ANALYTICS_CLIENT_CAPACITY 4096
+#endif
+
+/* queued events that trigger a SubmitEvents call, and the most sent in one. */
+#ifndef ANALYTICS_CLIENT_BATCH
+#define ANALYTICS_CLIENT_BATCH 64
+#endif
+
+/* the longest an event waits for a batch to fill, in milliseconds. */
+#ifndef ANALYTICS_CLIENT_FLUSH_MS
+#define ANALYTICS_CLIENT_FLUSH_MS 1000
+#endif
+
+/* SubmitEvents calls allowed to await a reply at once. */
+#ifndef ANALYTICS_CLIENT_WINDOW
+#define ANALYTICS_CLIENT_WINDOW 4
+#endif
+
+/* reply timeout for the calls an AnalyticsClient makes, in milliseconds. */
+#ifndef ANALYTICS_CLIENT_CALL_TIMEOUT
+#define ANALYTICS_CLIENT_CALL_TIMEOUT 10000
+#endif
+
+/*
+ * Client side of the analytics interface for applications.
+ *
+ * Submit() copies an event into a ring of preallocated slots and returns;
+ * it never waits on the bus.  A background thread sends the queued events
+ * with SubmitEvents calls made through MethodCallAsync, once
+ * ANALYTICS_CLIENT_BATCH events are queued, once the oldest has waited
+ * ANALYTICS_CLIENT_FLUSH_MS, or on Flush().  At most
+ * ANALYTICS_CLIENT_WINDOW calls await replies at a time; while the window
+ * is full, or while there is no service, events stay queued, and once the
+ * ring is full Submit() drops them.
+ *
+ * The vendor and device data are sent to each service given to
+ * SetService(), SetDeviceData only once SetVendorData has succeeded, and
+ * events wait until both have; a refused setup is sent again after
+ * ANALYTICS_CLIENT_FLUSH_MS.  Events whose call fails or is refused are
+ * counted, not resent.
+ */
+class AnalyticsClient : public ajn::MessageReceiver {
+    public:
+        AnalyticsClient(ajn::BusAttachment &bus,
+                const char *ifname = ANALYTICS_EVENT_INTERFACE,
+                size_t capacity = ANALYTICS_CLIENT_CAPACITY,
+                size_t batch = ANALYTICS_CLIENT_BATCH,
+                uint32_t flushMs = ANALYTICS_CLIENT_FLUSH_MS,
+                unsigned window = ANALYTICS_CLIENT_WINDOW);
+
+        /* Stop()s the client. */
+        ~AnalyticsClient();
+
+        /* create the interface on the bus if needed and start sending. */
+        QStatus Start();
+
+        /*
+         * send what is queued, if there is a service, and wait up to
+         * timeoutMs for the replies; then stop.  Events still queued are
+         * counted as dropped.
+         */
+        void Stop(uint32_t timeoutMs = ANALYTICS_CLIENT_CALL_TIMEOUT);
+
+        /*
+         * send to the service at busName and path over sessionId from now
+         * on.  The events already queued go there too.
+         */
+        QStatus SetService(const char *busName, const char *path, ajn::SessionId sessionId);
+
+        /* stop sending, for example when the session is lost; events stay queued. */
+        void ClearService();
+
+        /*
+         * the a{sv} entries for SetVendorData and SetDeviceData.  They are
+         * copied, and sent to the current service and to each new one.
+         */
+        void SetVendorData(size_t count, const ajn::MsgArg *kvs);
+        void SetDeviceData(size_t count, const ajn::MsgArg *kvs);
+
+        /*
+         * queue one event; kvs is its a{sv} entries and is copied.  A
+         * timestamp of 0 lets the service stamp the event.  Returns
+         * ER_WOULDBLOCK, and drops the event, if the ring is full.
+         */
+        QStatus Submit(const char *name, uint64_t timestamp, size_t count, const ajn::MsgArg *kvs);
+
+        /* send the queued events without waiting for a batch to fill. */
+        void Flush();
+
+        /*
+         * wait up to timeoutMs until nothing is queued or awaiting a
+         * reply.  Returns false on timeout.  For shutdown and tests;
+         * never needed to make progress.
+         */
+        bool WaitIdle(uint32_t timeoutMs);
+
+        struct Stats {
+            uint64_t submitted;  /* events accepted by Submit() */
+            uint64_t dropped;    /* events refused by Submit() or left at Stop() */
+            uint64_t accepted;   /* events the service took */
+            uint64_t rejected;   /* events the service refused */
+            uint64_t failed;     /* events lost with a failed call */
+            uint64_t calls;      /* SubmitEvents calls made */
+            uint32_t queued;     /* events waiting to be sent */
+            uint32_t inFlight;   /* calls awaiting a reply */
+        };
+        void GetStats(Stats &stats);
+
+    private:
+        class Sender : public qcc::Thread {
+            public:
+                Sender(AnalyticsClient &client) :
+                    qcc::Thread("AnalyticsClient"),
+                    client(client)
+                {
+                }
+            protected:
+                virtual qcc::ThreadReturn STDCALL Run(void *arg);
+            private:
+                AnalyticsClient &client;
+        };
+        friend class Sender;
+
+        /* body of the sender thread. */
+        void SendLoop();
+
+        /* events to send now, at most up to the end of the ring; lock held. */
+        size_t Due(uint64_t now);
+
+        /*
+         * send the next setup call, SetVendorData or, once that has been
+         * acknowledged, SetDeviceData; lock held, released around the call.
+         */
+        void SendSetup();
+
+        /* send the whole setup again from SetVendorData; lock held. */
+        void RestartSetup();
+
+        /* MethodCallAsync reply handlers. */
+        void SubmitEventsReply(ajn::Message &reply, void *context);
+        void SetupReply(ajn::Message &reply, void *context);
+
+        static void CopyKVs(std::vector<ajn::MsgArg> &to, size_t count, const ajn::MsgArg *kvs);
+
+        ajn::BusAttachment &bus;
+        qcc::String ifname;
+        size_t batch;
+        uint32_t flushMs;
+        unsigned window;
+
+        qcc::Mutex lock;
+        qcc::Condition wake;       /* the sender has something to do */
+        qcc::Condition idle;       /* a reply arrived or events were sent */
+
+        /*
+         * the ring of (stua{sv}) records and when each was submitted;
+         * head is the oldest queued event.
+         */
+        std::vector<ajn::MsgArg> ring;
+        std::vector<uint64_t> submittedAt;
+        size_t head;
+        size_t queued;
+        uint32_t sequence;
+        bool flushing;
+
+        /* the current service; calls are made through copies of proxy. */
+        ajn::ProxyBusObject proxy;
+        bool haveService;
+
+        /*
+         * setup state for the current service.  setupEpoch changes with
+         * every restart, so that replies to an abandoned setup are ignored.
+         */
+        bool setupSent;            /* SetVendorData sent */
+        bool deviceDue;            /* SetVendorData acknowledged; SetDeviceData to send */
+        bool setupDone;            /* both acknowledged; events may go */
+        uint32_t setupEpoch;
+        uint64_t setupRetryAt;     /* no setup call before this time */
+        std::vector<ajn::MsgArg> vendorData;
+        std::vector<ajn::MsgArg> deviceData;
+
+        unsigned inFlight;         /* all calls awaiting replies, setup included */
+        Stats stats;
+
+        Sender *sender;
+        bool stopping;
+
+        /* not copyable */
+        AnalyticsClient(const AnalyticsClient &);
+        AnalyticsClient &operator=(const AnalyticsClient &);
+};
+
+#endif
@@ -0,0 +1,93 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#ifndef ANALYTICSDEVICETABLE_H
+#define ANALYTICSDEVICETABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class AnalyticsDeviceObject;
+
+/*
+ * Open-addressing hash table mapping the bus name of a client device to
+ * its AnalyticsDeviceObject.
+ *
+ * Names are interned: the table keeps its own copy of each name, made once
+ * when the device is inserted, so lookups never allocate.  Each slot also
+ * stores the full hash of its name, so a probe only falls back to a string
+ * compare when the hashes already match.
+ *
+ * The table is not thread-safe; the owner is expected to serialize access.
+ */
+class AnalyticsDeviceTable {
+    public:
+        AnalyticsDeviceTable();
+        ~AnalyticsDeviceTable();
+
+        /* hash function used for all keys.  Callers may compute it once per message. */
+        static uint32_t Hash(const char *name);
+
+        AnalyticsDeviceObject *Find(const char *name) const
+        {
+            return Find(name, Hash(name));
+        }
+        AnalyticsDeviceObject *Find(const char *name, uint32_t hash) const;
+
+        /*
+         * add a device under the given name, which must not already be
+         * present.  Returns false if memory for the table or the interned
+         * name could not be allocated.
+         */
+        bool Insert(const char *name, uint32_t hash, AnalyticsDeviceObject *dev);
+
+        /* remove the named device, returning it, or NULL if it was not present. */
+        AnalyticsDeviceObject *Remove(const char *name, uint32_t hash);
+
+        size_t Size() const { return count; }
+
+        /*
+         * iteration support.  Slots in [0, Capacity()) with a NULL device
+         * are empty.  Inserting or removing invalidates slot indices.
+         */
+        size_t Capacity() const { return capacity; }
+        AnalyticsDeviceObject *DeviceAt(size_t slot) const { return slots[slot].dev; }
+        const char *NameAt(size_t slot) const { return slots[slot].name; }
+
+    private:
+        struct Slot {
+            uint32_t hash;
+            char *name;
+            AnalyticsDeviceObject *dev;
+        };
+
+        /* returns the slot holding the name, or the empty slot where it belongs. */
+        size_t Probe(const char *name, uint32_t hash) const;
+
+        bool Grow();
+
+        Slot *slots;
+        size_t capacity;   /* always a power of two */
+        size_t count;
+
+        /* not copyable */
+        AnalyticsDeviceTable(const AnalyticsDeviceTable &);
+        AnalyticsDeviceTable &operator=(const AnalyticsDeviceTable &);
+};
+
+#endif
@@ -0,0 +1,175 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef ANALYTICSDISCOVERY_H
+#define ANALYTICSDISCOVERY_H
+
+#include <qcc/Condition.h>
+#include <qcc/Mutex.h>
+#include <qcc/String.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/AboutListener.h>
+#include <alljoyn/BusAttachment.h>
+#include <alljoyn/MessageReceiver.h>
+#include <alljoyn/SessionListener.h>
+
+#include <map>
+
+#include "AnalyticsClient.h"
+#include "AnalyticsHashRing.h"
+
+/* services, in ring order from the client's name, among which the least loaded is chosen. */
+#ifndef ANALYTICS_DISCOVERY_CHOICES
+#define ANALYTICS_DISCOVERY_CHOICES 2
+#endif
+
+/* how long a service that failed is passed over, in milliseconds. */
+#ifndef ANALYTICS_DISCOVERY_RETRY_MS
+#define ANALYTICS_DISCOVERY_RETRY_MS 5000
+#endif
+
+/* failures in a row, with no announcement between, after which a service is forgotten. */
+#ifndef ANALYTICS_DISCOVERY_MAX_FAILURES
+#define ANALYTICS_DISCOVERY_MAX_FAILURES 3
+#endif
+
+/*
+ * how long the session to a service we moved away from is kept, in
+ * milliseconds, so that replies to calls already made there arrive.
+ */
+#ifndef ANALYTICS_DISCOVERY_LINGER_MS
+#define ANALYTICS_DISCOVERY_LINGER_MS 2000
+#endif
+
+/*
+ * Finds the services implementing the analytics interface and keeps an
+ * AnalyticsClient connected to one of them.
+ *
+ * Every service announcing the interface is placed on an
+ * AnalyticsHashRing, under the shard name and with the capacity it
+ * announces if it runs as a shard (see AnalyticsShards), else under its
+ * bus name.  The client's bus unique name, which is also what a shard
+ * checks in AnalyticsShards::Owns, picks the first
+ * ANALYTICS_DISCOVERY_CHOICES services in ring order, and of those the
+ * one announcing the lowest load level, or
+ * reporting it with Throttle, is joined; the first wins ties.  So clients
+ * spread evenly over the services, a new service takes over only its own
+ * share of them, and a loaded one sheds clients to its neighbour.  The
+ * current service is kept unless another is two or more levels less
+ * loaded, so that clients do not flap between services at the margin.
+ *
+ * When the session is lost or cannot be joined, the service is passed
+ * over for ANALYTICS_DISCOVERY_RETRY_MS and the next one is joined at
+ * once; the client keeps its events queued in between.
+ */
+class AnalyticsDiscovery : public ajn::AboutListener, public ajn::SessionListener,
+    public ajn::MessageReceiver {
+    public:
+        AnalyticsDiscovery(ajn::BusAttachment &bus, AnalyticsClient &client,
+                const char *ifname = ANALYTICS_EVENT_INTERFACE);
+
+        /* Stop()s discovery. */
+        ~AnalyticsDiscovery();
+
+        /* look for services and connect the client to one. */
+        QStatus Start();
+
+        /*
+         * stop looking and leave the service; the client is kept, without
+         * a service.  Stop the client first if it should send what it holds.
+         */
+        void Stop();
+
+        /* the bus name of the service the client is sending to, or "". */
+        qcc::String Current();
+
+        /* services known. */
+        size_t Services();
+
+        /* AboutListener */
+        virtual void Announced(const char *busName, uint16_t version, ajn::SessionPort port,
+                const ajn::MsgArg &objectDescriptionArg, const ajn::MsgArg &aboutDataArg);
+
+        /* SessionListener */
+        virtual void SessionLost(ajn::SessionId sessionId, SessionLostReason reason);
+
+    private:
+        struct Service {
+            qcc::String busName;
+            qcc::String path;
+            ajn::SessionPort port;
+            uint32_t level;        /* load level, from About data or Throttle */
+            unsigned failures;     /* in a row */
+            uint64_t retryAt;      /* passed over until then */
+        };
+
+        class Joiner : public qcc::Thread {
+            public:
+                Joiner(AnalyticsDiscovery &discovery) :
+                    qcc::Thread("AnalyticsDiscovery"),
+                    discovery(discovery)
+                {
+                }
+            protected:
+                virtual qcc::ThreadReturn STDCALL Run(void *arg);
+            private:
+                AnalyticsDiscovery &discovery;
+        };
+        friend class Joiner;
+
+        /* body of the joiner thread. */
+        void JoinLoop();
+
+        /* the ring name of the service to use now, or NULL; lock held. */
+        const char *Choose(uint64_t now);
+
+        /* note that joining or using name failed; lock held. */
+        void Failed(const qcc::String &name, uint64_t now);
+
+        /* Throttle signal handler. */
+        void Throttle(const ajn::InterfaceDescription::Member *member,
+                const char *srcPath, ajn::Message &msg);
+
+        ajn::BusAttachment &bus;
+        AnalyticsClient &client;
+        qcc::String ifname;
+        qcc::String key;           /* the bus unique name, once started */
+
+        qcc::Mutex lock;
+        qcc::Condition wake;       /* services changed or the session was lost */
+
+        std::map<qcc::String, Service> services;   /* by ring name */
+        AnalyticsHashRing ring;
+
+        qcc::String current;       /* ring name of the service joined, or "" */
+        ajn::SessionId sessionId;
+        ajn::SessionId retired;    /* lingering session to the previous service */
+        uint64_t retiredAt;
+        bool joining;              /* the joiner is between JoinSession and SetService */
+
+        Joiner *joiner;
+        bool stopping;
+
+        /* not copyable */
+        AnalyticsDiscovery(const AnalyticsDiscovery &);
+        AnalyticsDiscovery &operator=(const AnalyticsDiscovery &);
+};
+
+#endif
@@ -0,0 +1,213 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#ifndef ANALYTICSEXECUTOR_H
+#define ANALYTICSEXECUTOR_H
+
+#include <qcc/Condition.h>
+#include <qcc/Mutex.h>
+#include <qcc/Thread.h>
+#include <qcc/atomic.h>
+
+#include <stddef.h>
+#include <vector>
+
+/* maximum number of tasks a worker runs from one strand before moving on. */
+#ifndef ANALYTICS_STRAND_BUDGET
+#define ANALYTICS_STRAND_BUDGET 32
+#endif
+
+/*
+ * tasks up to ANALYTICS_TASK_BYTES are kept on a free list when released,
+ * up to ANALYTICS_TASK_POOL of them, so posting a task does not touch the
+ * heap once the list has filled.
+ */
+#ifndef ANALYTICS_TASK_BYTES
+#define ANALYTICS_TASK_BYTES 128
+#endif
+#ifndef ANALYTICS_TASK_POOL
+#define ANALYTICS_TASK_POOL 4096
+#endif
+
+class AnalyticsExecutor;
+
+/* A unit of work posted to an AnalyticsStrand. */
+class AnalyticsTask {
+    public:
+        AnalyticsTask() : next(NULL), final(false) {}
+        virtual ~AnalyticsTask() {}
+
+        virtual void Run() = 0;
+
+        /* called once Run() has returned.  The default frees the task. */
+        virtual void Release() { delete this; }
+
+        /* task storage comes from, and returns to, a shared free list. */
+        static void *operator new(size_t size);
+        static void operator delete(void *p, size_t size);
+
+    private:
+        friend class AnalyticsStrand;
+        AnalyticsTask *next;
+        bool final;
+};
+
+/*
+ * A serial queue of tasks.  Tasks posted to one strand run one at a time,
+ * in the order they were posted; different strands run in parallel on the
+ * executor's workers.
+ */
+class AnalyticsStrand {
+    public:
+        AnalyticsStrand() :
+            head(NULL),
+            tail(NULL),
+            scheduled(false),
+            depth(0),
+            readyPrev(NULL),
+            readyNext(NULL)
+        {
+        }
+
+        /*
+         * queue a task.  If final is true the task must be the last one
+         * ever posted: the executor does not touch the strand once the
+         * task has started, so the task may destroy the strand's owner.
+         */
+        void Post(AnalyticsExecutor &executor, AnalyticsTask *task, bool final = false);
+
+        /* number of tasks posted but not yet run. */
+        int32_t Depth() const { return depth; }
+
+        /*
+         * make the strand usable again after its final task has run.  Must
+         * be called before anything else is posted to it.
+         */
+        void Reset();
+
+    private:
+        friend class AnalyticsExecutor;
+
+        /*
+         * run up to budget tasks, setting ran to the number run.  Returns
+         * true if tasks remain and the strand must be scheduled again.
+         */
+        bool RunSome(AnalyticsExecutor &executor, unsigned budget, unsigned &ran);
+
+        qcc::Mutex lock;
+        AnalyticsTask *head;
+        AnalyticsTask *tail;
+        bool scheduled;     /* queued on, or running in, a worker */
+        volatile int32_t depth;
+
+        /* links in a worker's ready list, guarded by the worker's lock. */
+        AnalyticsStrand *readyPrev;
+        AnalyticsStrand *readyNext;
+
+        /* not copyable */
+        AnalyticsStrand(const AnalyticsStrand &);
+        AnalyticsStrand &operator=(const AnalyticsStrand &);
+};
+
+/*
+ * Work-stealing pool of worker threads running AnalyticsStrands.  Each
+ * worker has its own queue of ready strands; an idle worker takes strands
+ * from the back of another worker's queue.
+ */
+class AnalyticsExecutor {
+    public:
+        AnalyticsExecutor(unsigned threads);
+
+        /* runs every task already posted, then stops the workers. */
+        ~AnalyticsExecutor();
+
+        struct Stats {
+            uint32_t threads;
+            uint32_t readyStrands;   /* strands waiting for a worker */
+            uint32_t queuedTasks;    /* tasks posted but not yet run */
+            uint64_t executed;       /* tasks run since start */
+            uint64_t steals;         /* strands taken from another worker */
+        };
+        void GetStats(Stats &stats);
+
+    private:
+        friend class AnalyticsStrand;
+
+        class Worker : public qcc::Thread {
+            public:
+                Worker(AnalyticsExecutor &executor, unsigned index) :
+                    qcc::Thread("AnalyticsWorker"),
+                    executor(executor),
+                    index(index),
+                    readyHead(NULL),
+                    readyTail(NULL),
+                    executed(0),
+                    steals(0)
+                {
+                }
+
+                AnalyticsExecutor &executor;
+                unsigned index;
+
+                /*
+                 * ready strands, linked through the strands themselves so
+                 * queueing one never allocates; the owner pops the front,
+                 * thieves the back.
+                 */
+                qcc::Mutex lock;
+                AnalyticsStrand *readyHead;
+                AnalyticsStrand *readyTail;
+
+                /* ready list operations; the caller holds lock. */
+                void PushBack(AnalyticsStrand *strand);
+                AnalyticsStrand *PopFront();
+                AnalyticsStrand *PopBack();
+
+                /* written only by this worker. */
+                uint64_t executed;
+                uint64_t steals;
+
+            protected:
+                virtual qcc::ThreadReturn STDCALL Run(void *arg);
+        };
+        friend class Worker;
+
+        /* make a strand with pending tasks runnable. */
+        void Schedule(AnalyticsStrand *strand);
+
+        /* queue a runnable strand on a worker and wake an idle worker. */
+        void MakeReady(Worker *worker, AnalyticsStrand *strand);
+
+        /* find a ready strand for self, stealing if needed, waiting if none. */
+        AnalyticsStrand *NextStrand(Worker &self);
+
+        AnalyticsStrand *Steal(Worker &self);
+
+        std::vector<Worker *> workers;
+
+        volatile int32_t readyCount;     /* strands in all ready queues */
+        volatile int32_t queuedTasks;
+        volatile int32_t nextWorker;     /* round robin for Schedule */
+
+        qcc::Mutex idleLock;
+        qcc::Condition idle;
+        volatile int32_t idleWaiters;
+        bool stopping;
+};
+
+#endif
@@ -0,0 +1,147 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef ANALYTICSFILTER_H
+#define ANALYTICSFILTER_H
+
+#include <alljoyn/MsgArg.h>
+#include <alljoyn/Status.h>
+#include <qcc/String.h>
+
+#include <vector>
+
+/* sampling rates are kept as parts per ANALYTICS_FILTER_RATE_SCALE. */
+#define ANALYTICS_FILTER_RATE_SCALE 1000000
+
+/*
+ * Drop and sampling rules for incoming events, checked by the bus object
+ * before an event reaches a device object.
+ *
+ * A rule names an event, or a prefix of event names ending in '*', with an
+ * optional key condition, and the fraction of matching events to keep.
+ * The rules are compiled into a perfect hash of the exact names and a
+ * trie of the prefixes; an event is decided by the first rule, in the
+ * order added, of its exact name whose key condition holds, then of its
+ * longest matching prefix, then of each shorter prefix.  Events no rule
+ * matches are kept.
+ *
+ * Sampling is deterministic: the same sender, event name and sequence
+ * number always get the same decision, so a retried event is not counted
+ * twice against the rate.
+ *
+ * Rules are added and compiled before the filter is used; after that
+ * Keep() may be called from any thread.
+ */
+class AnalyticsFilter {
+    public:
+        AnalyticsFilter();
+
+        /*
+         * add a rule keeping rate (0 to 1) of the events matching pattern.
+         * If key is not NULL the event must have that key, and if value is
+         * not NULL the key's value must be that string or integer.
+         * The rule takes effect at the next Compile().
+         */
+        bool AddRule(const char *pattern, double rate,
+                const char *key = NULL, const char *value = NULL);
+
+        /*
+         * add the rules in a file, one per line:
+         *
+         *     drop   pattern [key[=value]]
+         *     sample pattern rate [key[=value]]
+         *     keep   pattern [key[=value]]
+         *
+         * Blank lines and lines starting with '#' are ignored.  On failure
+         * errMsg and line describe the first bad line.
+         */
+        QStatus Load(const char *path, const char **errMsg, unsigned *line);
+
+        /*
+         * build the matcher from the rules added so far.  Keep() asserts
+         * that no rule has been added since.
+         */
+        void Compile();
+
+        bool Empty() const { return rules.empty(); }
+
+        /*
+         * decide one event.  kvs is the event's a{sv}, or, if keys is not
+         * NULL, its values in the order of keys, as for a compact event.
+         */
+        bool Keep(const char *sender, const char *name, uint32_t sequence,
+                size_t count, const ajn::MsgArg *kvs,
+                const char *const *keys = NULL);
+
+        struct Stats {
+            uint64_t matched;    /* events decided by a rule */
+            uint64_t dropped;    /* matched events not kept */
+        };
+        void GetStats(Stats &stats) const;
+
+    private:
+        struct Rule {
+            qcc::String key;
+            qcc::String value;
+            bool hasKey;
+            bool hasValue;
+            bool intValue;       /* value also parses as an integer */
+            int64_t ivalue;
+            uint32_t rate;       /* parts per ANALYTICS_FILTER_RATE_SCALE */
+        };
+
+        /* the rules for one exact name or prefix. */
+        struct Group {
+            qcc::String name;
+            bool prefix;
+            std::vector<uint32_t> rules;
+            int32_t parent;      /* group of the longest shorter prefix */
+        };
+
+        struct TrieNode {
+            TrieNode() : group(-1) {}
+            int32_t group;
+            std::vector<std::pair<unsigned char, uint32_t> > children;
+        };
+
+        static uint32_t Hash(uint32_t seed, const char *s);
+
+        /* the group of the longest prefix group matching name, or -1. */
+        int32_t FindPrefix(const char *name) const;
+
+        /* true if rule's key condition holds for the event. */
+        static bool KeyMatches(const Rule &rule, size_t count,
+                const ajn::MsgArg *kvs, const char *const *keys);
+
+        std::vector<Rule> rules;
+        std::vector<Group> groups;
+
+        /* perfect hash of the exact-name groups. */
+        std::vector<int32_t> slots;
+        uint32_t seed;
+
+        std::vector<TrieNode> trie;
+
+        bool compiled;           /* no rules added since Compile() */
+
+        volatile uint64_t matched;
+        volatile uint64_t dropped;
+};
+
+#endif
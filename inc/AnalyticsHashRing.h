@@ -0,0 +1,113 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#ifndef ANALYTICSHASHRING_H
+#define ANALYTICSHASHRING_H
+
+#include <qcc/String.h>
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* points on the ring for each unit of a member's weight. */
+#ifndef ANALYTICS_HASH_VNODES
+#define ANALYTICS_HASH_VNODES 160
+#endif
+
+/*
+ * largest weight a member gets; heavier ones are cut to it, so a remote
+ * peer announcing a huge capacity cannot make the ring huge.
+ */
+#ifndef ANALYTICS_HASH_MAX_WEIGHT
+#define ANALYTICS_HASH_MAX_WEIGHT 64
+#endif
+
+/*
+ * Consistent hash ring over named members, such as analytics services.
+ *
+ * Each member is placed at ANALYTICS_HASH_VNODES points per unit of
+ * weight, hashed from its name, and a key belongs to the member at the
+ * first point at or after the key's hash.  Adding or removing a member
+ * only moves the keys on its own arcs, and every process that builds a
+ * ring from the same members and weights maps keys the same way.
+ *
+ * Not thread-safe; the owner is expected to serialize access.
+ */
+class AnalyticsHashRing {
+    public:
+        /*
+         * add a member, or change its weight.  The weight is cut to
+         * 1..ANALYTICS_HASH_MAX_WEIGHT by ClampWeight().
+         */
+        void Add(const char *member, uint32_t weight = 1);
+
+        static uint32_t ClampWeight(uint32_t weight)
+        {
+            return weight == 0 ? 1 : weight > ANALYTICS_HASH_MAX_WEIGHT ? ANALYTICS_HASH_MAX_WEIGHT : weight;
+        }
+
+        /* returns false if member was not present. */
+        bool Remove(const char *member);
+
+        bool Contains(const char *member) const { return Find(member) >= 0; }
+
+        size_t Size() const { return members.size(); }
+
+        /*
+         * set out to up to max distinct members in ring order from key:
+         * the owner first, then the members that would take the key over
+         * if the ones before them were removed.  Returns the number set.
+         * The pointers are valid until the ring is next changed.
+         */
+        size_t Lookup(const char *key, const char **out, size_t max) const;
+
+        /* the member owning key, or NULL if the ring is empty. */
+        const char *Owner(const char *key) const
+        {
+            const char *owner = NULL;
+            return Lookup(key, &owner, 1) ? owner : NULL;
+        }
+
+    private:
+        struct Member {
+            qcc::String name;
+            uint32_t weight;
+        };
+
+        struct Point {
+            uint32_t hash;
+            uint32_t member;   /* index into members */
+
+            bool operator<(const Point &other) const
+            {
+                /* ties, however unlikely, are broken the same way everywhere. */
+                return hash < other.hash || (hash == other.hash && member < other.member);
+            }
+        };
+
+        int Find(const char *member) const;
+
+        /* recompute points after members changed. */
+        void Rebuild();
+
+        std::vector<Member> members;   /* sorted by name, so indices agree across processes */
+        std::vector<Point> points;     /* sorted by hash */
+};
+
+#endif
@@ -0,0 +1,152 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#ifndef ANALYTICSKV_H
+#define ANALYTICSKV_H
+
+#include <alljoyn/MsgArg.h>
+#include <string.h>
+
+/*
+ * Typed view of one {sv} entry of the a{sv} arrays passed to the
+ * AnalyticsDeviceObject methods.
+ *
+ * Parse() reads the entry's key and strips the value's variant wrappers
+ * once, so a vendor can switch on the value's type id directly instead of
+ * trying MsgArg::Get with one signature after another.
+ */
+struct AnalyticsKV {
+    const char *key;
+    ajn::AllJoynTypeId type;
+    const ajn::MsgArg *value;
+
+    /* returns false if entry is not a dictionary entry with a string key. */
+    bool Parse(const ajn::MsgArg &entry)
+    {
+        using namespace ajn;
+
+        if (entry.typeId != ALLJOYN_DICT_ENTRY) {
+            return false;
+        }
+        const MsgArg *k = entry.v_dictEntry.key;
+        const MsgArg *v = entry.v_dictEntry.val;
+        if (!k || k->typeId != ALLJOYN_STRING) {
+            return false;
+        }
+        while (v && v->typeId == ALLJOYN_VARIANT) {
+            v = v->v_variant.val;
+        }
+        if (!v) {
+            return false;
+        }
+
+        key = k->v_string.str;
+        type = v->typeId;
+        value = v;
+        return true;
+    }
+
+    /*
+     * get any integer or boolean value as an int64_t.  uint64_t values
+     * above INT64_MAX wrap.  Returns false for non-integer types.
+     */
+    bool GetInt64(int64_t &out) const
+    {
+        using namespace ajn;
+
+        switch (type) {
+        case ALLJOYN_BOOLEAN:
+            out = value->v_bool ? 1 : 0;
+            return true;
+        case ALLJOYN_BYTE:
+            out = value->v_byte;
+            return true;
+        case ALLJOYN_INT16:
+            out = value->v_int16;
+            return true;
+        case ALLJOYN_UINT16:
+            out = value->v_uint16;
+            return true;
+        case ALLJOYN_INT32:
+            out = value->v_int32;
+            return true;
+        case ALLJOYN_UINT32:
+            out = value->v_uint32;
+            return true;
+        case ALLJOYN_INT64:
+            out = value->v_int64;
+            return true;
+        case ALLJOYN_UINT64:
+            out = (int64_t)value->v_uint64;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /* returns the string value, or NULL if the value is not a string. */
+    const char *GetString() const
+    {
+        return type == ajn::ALLJOYN_STRING ? value->v_string.str : NULL;
+    }
+};
+
+/*
+ * 64-bit FNV-1a fingerprint of the keys, types and values of an a{sv}, for
+ * spotting repeated events without encoding them.  Entries that are not
+ * {sv} and values of other types contribute only their type.
+ */
+inline uint64_t AnalyticsKVFingerprint(size_t count, const ajn::MsgArg *kvs)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+#define ANALYTICS_FNV(p, n) do { \
+        const unsigned char *b_ = (const unsigned char *)(p); \
+        for (size_t i_ = 0; i_ < (n); i_++) { \
+            h ^= b_[i_]; \
+            h *= 1099511628211ULL; \
+        } \
+    } while (0)
+
+    for (size_t i = 0; i < count; i++) {
+        AnalyticsKV entry;
+        if (!entry.Parse(kvs[i])) {
+            ANALYTICS_FNV(&kvs[i].typeId, sizeof(kvs[i].typeId));
+            continue;
+        }
+
+        /* include the terminators so "ab","c" differs from "a","bc". */
+        ANALYTICS_FNV(entry.key, strlen(entry.key) + 1);
+        ANALYTICS_FNV(&entry.type, sizeof(entry.type));
+
+        int64_t x;
+        if (entry.GetInt64(x)) {
+            ANALYTICS_FNV(&x, sizeof(x));
+        } else if (entry.type == ajn::ALLJOYN_STRING) {
+            ANALYTICS_FNV(entry.value->v_string.str, entry.value->v_string.len + 1);
+        } else if (entry.type == ajn::ALLJOYN_DOUBLE) {
+            ANALYTICS_FNV(&entry.value->v_double, sizeof(double));
+        }
+    }
+
+#undef ANALYTICS_FNV
+
+    return h;
+}
+
+#endif
@@ -0,0 +1,110 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef ANALYTICSSCHEMA_H
+#define ANALYTICSSCHEMA_H
+
+#include <alljoyn/MsgArg.h>
+#include <alljoyn/Status.h>
+#include <qcc/String.h>
+
+#include <vector>
+
+/* maximum number of schemas one device may register. */
+#ifndef ANALYTICS_MAX_SCHEMAS
+#define ANALYTICS_MAX_SCHEMAS 64
+#endif
+
+/* maximum number of keys in one schema. */
+#ifndef ANALYTICS_MAX_SCHEMA_KEYS
+#define ANALYTICS_MAX_SCHEMA_KEYS 64
+#endif
+
+/*
+ * An event layout registered with RegisterEventSchema: the event name, the
+ * key names and one AllJoyn type code per key.  A SubmitCompactEvent for
+ * the schema carries only the values, in key order.
+ */
+struct AnalyticsEventSchema {
+    qcc::String name;
+    qcc::String types;
+    std::vector<qcc::String> keys;
+
+    /* keys[i].c_str(), stable for the life of the schema. */
+    std::vector<const char *> keyNames;
+};
+
+/*
+ * The schemas registered by one device, indexed by the small id returned
+ * to the client.  Not thread-safe; calls for one device are serialized by
+ * the bus object.
+ */
+class AnalyticsSchemaTable {
+    public:
+        AnalyticsSchemaTable() : bytes(0) {}
+        ~AnalyticsSchemaTable() { Clear(); }
+
+        /*
+         * add a schema and set id to its id.  Registering a schema that
+         * is identical to an existing one returns the existing id.  types
+         * holds one of b,y,n,q,i,u,x,t,s,d for each key.
+         */
+        QStatus Register(const char **errMsg, const char *name, size_t count,
+                const char *const *keys, const char *types, uint32_t &id);
+
+        /* returns NULL if no schema has this id. */
+        const AnalyticsEventSchema *Find(uint32_t id) const
+        {
+            return id < schemas.size() ? schemas[id] : NULL;
+        }
+
+        /*
+         * find the schema for id and check that values, the entries of an
+         * av, match its types.
+         */
+        QStatus Check(const char **errMsg, uint32_t id, size_t count,
+                const ajn::MsgArg *values, const AnalyticsEventSchema *&schema) const;
+
+        /* strip the variant wrappers from one entry of an av. */
+        static const ajn::MsgArg *Unwrap(const ajn::MsgArg *v)
+        {
+            while (v && v->typeId == ajn::ALLJOYN_VARIANT) {
+                v = v->v_variant.val;
+            }
+            return v;
+        }
+
+        void Clear();
+
+        /* approximate heap bytes held by the registered schemas. */
+        size_t Footprint() const
+        {
+            return bytes + schemas.capacity() * sizeof(AnalyticsEventSchema *);
+        }
+
+    private:
+        std::vector<AnalyticsEventSchema *> schemas;
+        size_t bytes;
+
+        /* not copyable */
+        AnalyticsSchemaTable(const AnalyticsSchemaTable &);
+        AnalyticsSchemaTable &operator=(const AnalyticsSchemaTable &);
+};
+
+#endif
@@ -0,0 +1,102 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef ANALYTICSSHARDS_H
+#define ANALYTICSSHARDS_H
+
+#include <qcc/Mutex.h>
+#include <qcc/String.h>
+
+#include <alljoyn/AboutListener.h>
+#include <alljoyn/BusAttachment.h>
+#include <alljoyn/BusListener.h>
+
+#include <map>
+
+#include "AnalyticsDiscovery.h"
+#include "AnalyticsHashRing.h"
+
+/*
+ * Device ownership for a service run as one of several shards.
+ *
+ * Each shard announces its name and capacity in About data (see
+ * ANALYTICS_ABOUT_SHARD).  The shards that announce the analytics
+ * interface are placed on an AnalyticsHashRing, weighted by capacity,
+ * and are forgotten when their bus name goes away.  A device, named by
+ * its unique name, belongs to the first ANALYTICS_DISCOVERY_CHOICES
+ * shards in ring order from it: the same ring AnalyticsDiscovery builds
+ * on the device, and the same services it chooses between.  Sessions
+ * from other devices are refused, which sends AnalyticsDiscovery on to
+ * the next shard.
+ *
+ * All the services announcing the interface should run as shards, or
+ * none; services without a shard name are left off the ring here.
+ */
+class AnalyticsShards : public ajn::AboutListener, public ajn::BusListener {
+    public:
+        /*
+         * a capacity of 0 counts as 1, and over ANALYTICS_HASH_MAX_WEIGHT
+         * as that; a peer's announced capacity is cut the same way.
+         */
+        AnalyticsShards(ajn::BusAttachment &bus, const char *shard, uint32_t capacity = 1,
+                const char *ifname = ANALYTICS_EVENT_INTERFACE);
+
+        /* Stop()s looking for shards. */
+        ~AnalyticsShards();
+
+        /* look for the other shards. */
+        QStatus Start();
+        void Stop();
+
+        /*
+         * whether this shard takes device.  If not, and owner is given,
+         * it is set to the name of the shard owning it.
+         */
+        bool Owns(const char *device, qcc::String *owner = NULL);
+
+        /* shards known, this one included. */
+        size_t Shards();
+
+        /* AboutListener */
+        virtual void Announced(const char *busName, uint16_t version, ajn::SessionPort port,
+                const ajn::MsgArg &objectDescriptionArg, const ajn::MsgArg &aboutDataArg);
+
+        /* BusListener */
+        virtual void NameOwnerChanged(const char *busName, const char *previousOwner,
+                const char *newOwner);
+
+    private:
+        /* drop a peer, and its shard too unless another peer has it; lock held. */
+        void Forget(const char *busName);
+
+        ajn::BusAttachment &bus;
+        qcc::String shard;
+        qcc::String ifname;
+
+        qcc::Mutex lock;
+        std::map<qcc::String, qcc::String> peers;   /* bus name to shard name */
+        AnalyticsHashRing ring;
+        bool started;
+
+        /* not copyable */
+        AnalyticsShards(const AnalyticsShards &);
+        AnalyticsShards &operator=(const AnalyticsShards &);
+};
+
+#endif
@@ -0,0 +1,193 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef ANALYTICSSKETCH_H
+#define ANALYTICSSKETCH_H
+
+#include <alljoyn/MsgArg.h>
+#include <qcc/Mutex.h>
+
+#include "AnalyticsStats.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* number of heavy hitters each top-K sketch tracks. */
+#ifndef ANALYTICS_SKETCH_TOPK
+#define ANALYTICS_SKETCH_TOPK 32
+#endif
+
+/* longest tracked name, including the terminator; longer names are cut. */
+#ifndef ANALYTICS_SKETCH_NAME_MAX
+#define ANALYTICS_SKETCH_NAME_MAX 64
+#endif
+
+/* number of event keys whose distinct values are counted. */
+#ifndef ANALYTICS_SKETCH_KEYS
+#define ANALYTICS_SKETCH_KEYS 16
+#endif
+
+/* log2 of the number of HyperLogLog registers; about 3% error at 10. */
+#ifndef ANALYTICS_SKETCH_HLL_BITS
+#define ANALYTICS_SKETCH_HLL_BITS 10
+#endif
+
+/*
+ * Space-saving top-K sketch.  Any name seen more than 1/K of the time is
+ * tracked; a tracked count overestimates the true count by at most its
+ * error.  Fixed size, never allocates.  Not thread-safe.
+ */
+class AnalyticsTopK {
+    public:
+        struct Entry {
+            char name[ANALYTICS_SKETCH_NAME_MAX];
+            uint32_t hash;
+            uint64_t count;
+            uint64_t error;
+        };
+
+        AnalyticsTopK() : size(0) {}
+
+        /* count n occurrences of name, whose AnalyticsDeviceTable::Hash is hash. */
+        void Add(const char *name, uint32_t hash, uint64_t n = 1, uint64_t error = 0);
+
+        /* add another sketch's counts to this one. */
+        void Merge(const AnalyticsTopK &other);
+
+        /* order the entries by count, highest first. */
+        void Sort();
+
+        size_t Size() const { return size; }
+        const Entry &operator[](size_t i) const { return entries[i]; }
+
+        void Clear() { size = 0; }
+
+    private:
+        Entry entries[ANALYTICS_SKETCH_TOPK];
+        size_t size;
+};
+
+/* HyperLogLog distinct count estimator.  Not thread-safe. */
+class AnalyticsHll {
+    public:
+        AnalyticsHll() { Clear(); }
+
+        /* add a 64-bit hash of a value. */
+        void Add(uint64_t hash)
+        {
+            uint32_t idx = (uint32_t)(hash >> (64 - ANALYTICS_SKETCH_HLL_BITS));
+            uint64_t w = hash << ANALYTICS_SKETCH_HLL_BITS;
+            uint8_t rank = 1;
+            while (rank <= 64 - ANALYTICS_SKETCH_HLL_BITS && !(w & 0x8000000000000000ULL)) {
+                w <<= 1;
+                rank++;
+            }
+            if (rank > reg[idx]) {
+                reg[idx] = rank;
+            }
+        }
+
+        void Merge(const AnalyticsHll &other);
+
+        uint64_t Estimate() const;
+
+        void Clear();
+
+    private:
+        uint8_t reg[1 << ANALYTICS_SKETCH_HLL_BITS];
+};
+
+/*
+ * Heavy-hitter event names and devices, and distinct value counts for the
+ * first ANALYTICS_SKETCH_KEYS event keys seen, kept in constant memory.
+ *
+ * Add() is called on the submit path.  As with AnalyticsStats, each
+ * thread updates its own slot, by AnalyticsStats::ThreadSlot(), without
+ * locks; threads without one share a slot under a lock.  Get() merges the
+ * slots, rereading a slot's top-K sketches if its thread changed them
+ * during the copy.  The slots take about 22 KB each, allocated up front.
+ */
+class AnalyticsSketches {
+    public:
+        AnalyticsSketches();
+        ~AnalyticsSketches();
+
+        /*
+         * count one event.  kvs is the event's a{sv}, or, if keys is not
+         * NULL, its values in the order of keys, as for a compact event.
+         */
+        void Add(const char *sender, const char *name, size_t count,
+                const ajn::MsgArg *kvs, const char *const *keys = NULL);
+
+        struct KeyCount {
+            const char *key;         /* valid for the life of the sketches */
+            uint64_t distinct;       /* estimated distinct values */
+        };
+
+        /*
+         * merge the slots into events and devices, sorted by count, and
+         * set keys to the number of tracked keys, filling in up to
+         * ANALYTICS_SKETCH_KEYS entries of counts.
+         */
+        void Get(AnalyticsTopK &events, AnalyticsTopK &devices,
+                KeyCount *counts, size_t &keys);
+
+        /* 64-bit hash of an event value, for AnalyticsHll. */
+        static uint64_t HashValue(const ajn::MsgArg *v);
+
+    private:
+        struct Slot {
+            Slot() : seq(0) {}
+
+            /* odd while the owning thread is changing events or devices. */
+            volatile int32_t seq;
+            AnalyticsTopK events;
+            AnalyticsTopK devices;
+            AnalyticsHll values[ANALYTICS_SKETCH_KEYS];
+        };
+
+        /* copy slot's top-K sketches into events and devices. */
+        static void CopyTopK(Slot &slot, AnalyticsTopK &events, AnalyticsTopK &devices);
+
+        /* merge slot into events, devices and values. */
+        void MergeSlot(Slot &slot, AnalyticsTopK &events, AnalyticsTopK &devices,
+                AnalyticsHll *values, size_t keys);
+
+        /* index of key in the tracked keys, adding it if there is room, or -1. */
+        int FindKey(const char *key);
+
+        Slot *slots;           /* ANALYTICS_STATS_SLOTS private slots */
+        Slot *shared;
+        qcc::Mutex sharedLock;
+
+        /*
+         * tracked key names.  Entries are written once, under keyLock,
+         * before nkeys counts them, so readers need no lock.
+         */
+        char keyNames[ANALYTICS_SKETCH_KEYS][ANALYTICS_SKETCH_NAME_MAX];
+        uint32_t keyHashes[ANALYTICS_SKETCH_KEYS];
+        volatile int32_t nkeys;
+        qcc::Mutex keyLock;
+
+        /* not copyable */
+        AnalyticsSketches(const AnalyticsSketches &);
+        AnalyticsSketches &operator=(const AnalyticsSketches &);
+};
+
+#endif
@@ -0,0 +1,176 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef ANALYTICSSTATS_H
+#define ANALYTICSSTATS_H
+
+#include <qcc/Mutex.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* number of threads that get a private AnalyticsStats slot. */
+#ifndef ANALYTICS_STATS_SLOTS
+#define ANALYTICS_STATS_SLOTS 64
+#endif
+
+/*
+ * AnalyticsHistogram resolution: 2^ANALYTICS_HIST_SUB_BITS buckets per
+ * power of two, so values are kept to within 1/8, and values up to
+ * 2^ANALYTICS_HIST_MAX_BITS - 1.
+ */
+#define ANALYTICS_HIST_SUB_BITS 3
+#define ANALYTICS_HIST_MAX_BITS 40
+#define ANALYTICS_HIST_BUCKETS \
+    (((ANALYTICS_HIST_MAX_BITS - ANALYTICS_HIST_SUB_BITS) + 1) << ANALYTICS_HIST_SUB_BITS)
+
+/* counters kept by AnalyticsStats. */
+enum AnalyticsCounter {
+    ANALYTICS_EVENTS,               /* events accepted by a device object */
+    ANALYTICS_EVENTS_FAILED,        /* events a device object refused */
+    ANALYTICS_BYTES_ENCODED,        /* encoded update bytes sent or queued for delivery */
+    ANALYTICS_DELIVERIES,           /* updates delivered */
+    ANALYTICS_DELIVERY_FAILURES,    /* updates abandoned */
+    ANALYTICS_BYTES_DELIVERED,
+    ANALYTICS_COUNTERS
+};
+
+/* latency histograms kept by AnalyticsStats, in microseconds. */
+enum AnalyticsLatency {
+    ANALYTICS_SUBMIT_LATENCY,       /* event method received to handled */
+    ANALYTICS_DELIVERY_LATENCY,     /* update handed off to delivered or abandoned */
+    ANALYTICS_LATENCIES
+};
+
+/*
+ * Log-linear histogram in the style of HdrHistogram: fixed size, constant
+ * time to record, and a bounded relative error.  Not thread-safe.
+ */
+class AnalyticsHistogram {
+    public:
+        AnalyticsHistogram() { Clear(); }
+
+        void Record(uint64_t value)
+        {
+            buckets[Index(value)]++;
+            count++;
+            sum += value;
+            if (value > max) {
+                max = value;
+            }
+        }
+
+        void Merge(const AnalyticsHistogram &other);
+
+        /* the value at quantile q, 0 to 1, as the top of its bucket. */
+        uint64_t Percentile(double q) const;
+
+        uint64_t Count() const { return count; }
+        uint64_t Sum() const { return sum; }
+        uint64_t Max() const { return max; }
+
+        /* bucket i holds the values from Low(i) to High(i). */
+        uint64_t Bucket(size_t i) const { return buckets[i]; }
+        static uint64_t Low(size_t i);
+        static uint64_t High(size_t i) { return Low(i + 1) - 1; }
+
+        void Clear();
+
+    private:
+        static size_t Index(uint64_t value);
+
+        uint64_t buckets[ANALYTICS_HIST_BUCKETS];
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+};
+
+/*
+ * Service counters and latency histograms.
+ *
+ * Each thread updates its own slot without locks or atomics; Read()
+ * merges the slots.  A thread's slot is assigned on its first update and,
+ * on POSIX, freed for another thread when it exits; its counts stay in
+ * the slot.  Threads that find all ANALYTICS_STATS_SLOTS in use, or all
+ * threads on compilers without thread-local storage, share one slot
+ * under a lock for their lifetime.  Elsewhere slots are never freed, so
+ * only the first ANALYTICS_STATS_SLOTS threads get one.
+ */
+class AnalyticsStats {
+    public:
+        AnalyticsStats();
+        ~AnalyticsStats();
+
+        void Add(AnalyticsCounter c, uint64_t n = 1);
+
+        void Record(AnalyticsLatency h, uint64_t micros);
+
+        /* monotonic time in microseconds, for measuring latencies. */
+        static uint64_t NowMicros();
+
+        /*
+         * this thread's slot index, below ANALYTICS_STATS_SLOTS, assigned on
+         * the first call; or -1 if it must use a shared slot.  Also used by
+         * AnalyticsSketches.
+         */
+        static int32_t ThreadSlot();
+
+        struct Snapshot {
+            uint64_t uptimeMs;
+            uint64_t counters[ANALYTICS_COUNTERS];
+
+            /* over the time since the last Read() at least a second ago. */
+            double eventsPerSec;
+            double bytesEncodedPerSec;
+
+            AnalyticsHistogram latency[ANALYTICS_LATENCIES];
+        };
+
+        /* merge all slots into snapshot. */
+        void Read(Snapshot &snapshot);
+
+    private:
+        struct Slot {
+            uint64_t counters[ANALYTICS_COUNTERS];
+            AnalyticsHistogram latency[ANALYTICS_LATENCIES];
+        };
+
+        /* this thread's slot, or NULL if it must use the shared one. */
+        Slot *Local();
+
+        Slot *slots;           /* ANALYTICS_STATS_SLOTS private slots */
+        Slot *shared;
+        qcc::Mutex sharedLock;
+
+        uint64_t started;
+
+        /* rate state, guarded by rateLock. */
+        qcc::Mutex rateLock;
+        uint64_t rateAt;
+        uint64_t rateEvents;
+        uint64_t rateBytes;
+        double eventsPerSec;
+        double bytesEncodedPerSec;
+
+        /* not copyable */
+        AnalyticsStats(const AnalyticsStats &);
+        AnalyticsStats &operator=(const AnalyticsStats &);
+};
+
+#endif
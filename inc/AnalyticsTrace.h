@@ -0,0 +1,162 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#ifndef ANALYTICSTRACE_H
+#define ANALYTICSTRACE_H
+
+/*
+ * Hot-path tracepoints.
+ *
+ * Build with -DANALYTICS_TRACING to enable them; otherwise the macros
+ * below expand to nothing.  With -DANALYTICS_TRACING_USDT as well, each
+ * traced stage is also a pair of USDT probes, analytics:<stage>_begin and
+ * analytics:<stage>_end, for perf and bpftrace (needs <sys/sdt.h>).
+ *
+ *     void Work()
+ *     {
+ *         ANALYTICS_TRACE_SCOPE(work);
+ *         ...
+ *     }
+ *
+ * records the time spent in the rest of the enclosing block as a "work"
+ * span in the calling thread's ring buffer.  Each thread has its own ring
+ * of the last ANALYTICS_TRACE_RING_SIZE spans, written without locks or
+ * atomics; AnalyticsTrace::Dump() writes every ring as Chrome trace JSON,
+ * for chrome://tracing or Perfetto.  When a thread exits its ring goes to
+ * the next thread to trace, which carries on under the same tid, so there
+ * are only as many rings as threads ever tracing at once.
+ */
+
+#ifdef ANALYTICS_TRACING
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+/* spans kept per thread; a power of two. */
+#ifndef ANALYTICS_TRACE_RING_SIZE
+#define ANALYTICS_TRACE_RING_SIZE 8192
+#endif
+
+class AnalyticsTrace {
+    public:
+        /* a timestamp in ticks; cheap, but only meaningful within one boot. */
+        static inline uint64_t Now()
+        {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+            return __builtin_ia32_rdtsc();
+#else
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+        }
+
+        /* add a span, named by a string literal, to this thread's ring. */
+        static inline void Record(const char *name, uint64_t start, uint64_t end)
+        {
+            Ring *r = ring;
+            if (!r) {
+                r = AttachThread();
+                if (!r) {
+                    return;
+                }
+            }
+            Span &s = r->spans[r->head & (ANALYTICS_TRACE_RING_SIZE - 1)];
+            s.name = name;
+            s.start = start;
+            s.end = end;
+            /* the span is complete before the dumper can count it. */
+            __asm__ __volatile__ ("" : : : "memory");
+            r->head++;
+        }
+
+        /*
+         * write the spans of every thread as Chrome trace JSON.  Safe to
+         * call while other threads trace; spans being overwritten during
+         * the dump may come out mixed.  Returns false if f could not be
+         * written.
+         */
+        static bool Dump(FILE *f);
+
+        /* Dump() to a new file named path.  Returns false on failure. */
+        static bool Dump(const char *path);
+
+    private:
+        struct Span {
+            const char *name;
+            uint64_t start;
+            uint64_t end;
+        };
+
+        struct Ring {
+            Span spans[ANALYTICS_TRACE_RING_SIZE];
+            volatile uint32_t head;     /* spans ever written */
+            uint32_t tid;
+            bool inUse;                 /* held by a live thread */
+            Ring *next;
+        };
+
+        /*
+         * give this thread a ring, reusing one an exited thread left or
+         * registering a new one for Dump().
+         */
+        static Ring *AttachThread();
+
+        /* thread exit hook: free the thread's ring for reuse. */
+        static void DetachThread(void *value);
+
+        static void MakeRingKey();
+
+        static __thread Ring *ring;
+
+        /* every ring ever made, guarded by a lock in AnalyticsTrace.cc. */
+        static Ring *rings;
+};
+
+/* times the rest of the enclosing block. */
+class AnalyticsTraceScope {
+    public:
+        AnalyticsTraceScope(const char *name) : name(name), start(AnalyticsTrace::Now()) {}
+        ~AnalyticsTraceScope() { AnalyticsTrace::Record(name, start, AnalyticsTrace::Now()); }
+    private:
+        const char *name;
+        uint64_t start;
+};
+
+#ifdef ANALYTICS_TRACING_USDT
+#include <sys/sdt.h>
+
+/* a local class per stage, so the probe names are fixed at compile time. */
+#define ANALYTICS_TRACE_SCOPE(stage) \
+    struct AnalyticsTrace_##stage : public AnalyticsTraceScope { \
+        AnalyticsTrace_##stage() : AnalyticsTraceScope(#stage) { DTRACE_PROBE(analytics, stage##_begin); } \
+        ~AnalyticsTrace_##stage() { DTRACE_PROBE(analytics, stage##_end); } \
+    } analyticsTrace_##stage
+#else
+#define ANALYTICS_TRACE_SCOPE(stage) AnalyticsTraceScope analyticsTrace_##stage(#stage)
+#endif
+
+#else
+
+#define ANALYTICS_TRACE_SCOPE(stage) do { } while (0)
+
+#endif
+
+#endif
@@ -16,8 +16,11 @@
  *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  ******************************************************************************/
 #include "TellientAnalytics.h"
+#include "AnalyticsTrace.h"
 #include "string.h"
 
+#include <qcc/time.h>
+
 #ifndef MAX_EVENT_KEYS
 #define MAX_EVENT_KEYS 32
 #endif
@@ -28,8 +31,6 @@
 using namespace ajn;
 
 
-uint32_t TellientAnalyticsDeviceObject::globalEventCount = 0;
-
 QStatus TellientAnalyticsDeviceObject::SetVendorData(const char **err, size_t count, const ajn::MsgArg *kv )
 {
     if (haveVendorData) {
@@ -43,19 +44,21 @@ QStatus TellientAnalyticsDeviceObject::SetVendorData(const char **err, size_t co
     int32_t manufacturer_id = 0;
 
     for (size_t i = 0; i < count; i++) {
-        const char *key;
-        int32_t x;
-        const char *s;
+        AnalyticsKV entry;
+        int64_t x;
 
-        if (ER_OK == kv[i].Get("{si}", &key, &x)) {
-            if (0==strcmp(key, "manufacturer_id")) {
-                manufacturer_id = x;
+        if (!entry.Parse(kv[i])) {
+            continue;
+        }
+        if (entry.GetInt64(x)) {
+            if (0==strcmp(entry.key, "manufacturer_id")) {
+                manufacturer_id = (int32_t)x;
             }
-        } else if (ER_OK == kv[i].Get("{ss}", &key, &s)) {
-            if (0==strcmp(key, "model")) {
-                model = s;
-            } else if (0==strcmp(key, "post_url")) {
-                post_url = s;
+        } else if (entry.type == ALLJOYN_STRING) {
+            if (0==strcmp(entry.key, "model")) {
+                model = entry.value->v_string.str;
+            } else if (0==strcmp(entry.key, "post_url")) {
+                post_url = entry.value->v_string.str;
             }
         }
     }
@@ -78,22 +81,60 @@ QStatus TellientAnalyticsDeviceObject::SetVendorData(const char **err, size_t co
     return ER_OK;
 }
 
-static QStatus argToKV(const char **err, const MsgArg *arg, teKeyValue *kv)
+/*
+ * convert one value to a teKeyValue.  Integer types that fit are sent as
+ * TE_I32; u, x and t are sent as TE_I64 (t values above INT64_MAX wrap).
+ */
+QStatus TellientAnalyticsDeviceObject::valueToKV(const char **err, const char *key,
+        const MsgArg *v, teKeyValue *kv)
 {
-    const int ebsm = ER_BUS_SIGNATURE_MISMATCH;
+    kv->name = key;
 
-    if (ebsm != arg->Get("{si}", &kv->name, &kv->value.i32val)) {
-        kv->type = TE_I32;
-    } else if (ebsm != arg->Get("{ss}", &kv->name, &kv->value.stringval)) {
+    switch (v->typeId) {
+    case ALLJOYN_STRING:
         kv->type = TE_STRING;
-    } else if (ebsm != arg->Get("{sx}", &kv->name, &kv->value.i64val)) {
+        kv->value.stringval = v->v_string.str;
+        break;
+    case ALLJOYN_BOOLEAN:
+        kv->type = TE_I32;
+        kv->value.i32val = v->v_bool ? 1 : 0;
+        break;
+    case ALLJOYN_BYTE:
+        kv->type = TE_I32;
+        kv->value.i32val = v->v_byte;
+        break;
+    case ALLJOYN_INT16:
+        kv->type = TE_I32;
+        kv->value.i32val = v->v_int16;
+        break;
+    case ALLJOYN_UINT16:
+        kv->type = TE_I32;
+        kv->value.i32val = v->v_uint16;
+        break;
+    case ALLJOYN_INT32:
+        kv->type = TE_I32;
+        kv->value.i32val = v->v_int32;
+        break;
+    case ALLJOYN_UINT32:
+        kv->type = TE_I64;
+        kv->value.i64val = v->v_uint32;
+        break;
+    case ALLJOYN_INT64:
+        kv->type = TE_I64;
+        kv->value.i64val = v->v_int64;
+        break;
+    case ALLJOYN_UINT64:
         kv->type = TE_I64;
+        kv->value.i64val = (int64_t)v->v_uint64;
+        break;
 #if TE_INCLUDE_FLOATING
-    } else if (ebsm != arg->Get("{sd}", &kv->name, &kv->value.doubleval)) {
+    case ALLJOYN_DOUBLE:
         kv->type = TE_DOUBLE;
+        kv->value.doubleval = v->v_double;
+        break;
 #endif
-    } else {
-        *err = "Invalid argument type (not i,s,x"
+    default:
+        *err = "Invalid argument type (not b,y,n,q,i,u,x,t,s"
 #if TE_INCLUDE_FLOATING
             ",d"
 #endif
@@ -104,6 +145,17 @@ static QStatus argToKV(const char **err, const MsgArg *arg, teKeyValue *kv)
     return ER_OK;
 }
 
+QStatus TellientAnalyticsDeviceObject::argToKV(const char **err, const MsgArg *arg, teKeyValue *kv)
+{
+    AnalyticsKV entry;
+    if (!entry.Parse(*arg)) {
+        *err = "expecting {sv}";
+        return ER_BAD_ARG_1;
+    }
+
+    return valueToKV(err, entry.key, entry.value, kv);
+}
+
 QStatus TellientAnalyticsDeviceObject::SetDeviceData(const char **err, size_t count, const ajn::MsgArg *args )
 {
     if (!haveVendorData) {
@@ -143,9 +195,7 @@ QStatus TellientAnalyticsDeviceObject::WriteDeviceData(const char **err)
 }
 
 
-QStatus TellientAnalyticsDeviceObject::SubmitEvent(
-        const char **err, const char *name,
-        size_t count, const ajn::MsgArg *args, uint64_t timestamp)
+QStatus TellientAnalyticsDeviceObject::BeginEvent(const char **err, size_t count)
 {
     if (!haveVendorData) {
         *err = "must call SetVendorData first";
@@ -159,11 +209,21 @@ QStatus TellientAnalyticsDeviceObject::SubmitEvent(
 
     if (!updateState) {
         wroteDeviceData = false;
-        updateState = new teUpdateState();
-        if (!updateState ||
-                TE_SUCCESS != te_init_update(updateState, teReallocBufferManager,
-                    NULL, 0, manufacturer_id, model.c_str())
-           ) {
+        /* reuse the buffer of an update already delivered, if there is one. */
+        updateState = delivery ? delivery->TakeState() : new teUpdateState();
+        teErrType status = TE_ERR_ALLOC;
+        if (updateState && wireVersion == 2) {
+            if (!strings) {
+                strings = new teStringTable();
+            }
+            status = te_init_update_v2(updateState, teReallocBufferManager,
+                    updateState->buf, updateState->buf_size, manufacturer_id, model.c_str(),
+                    strings);
+        } else if (updateState) {
+            status = te_init_update(updateState, teReallocBufferManager,
+                    updateState->buf, updateState->buf_size, manufacturer_id, model.c_str());
+        }
+        if (TE_SUCCESS != status) {
             FreeUpdateState();
             *err = "out of memory";
             return ER_OUT_OF_MEMORY;
@@ -171,51 +231,460 @@ QStatus TellientAnalyticsDeviceObject::SubmitEvent(
     }
 
     if (!wroteDeviceData) {
-        QStatus status = WriteDeviceData(err);
-        if (status != ER_OK) {
-            return status;
+        return WriteDeviceData(err);
+    }
+
+    return ER_OK;
+}
+
+QStatus TellientAnalyticsDeviceObject::AddEvent(const char **err,
+        const char *name, uint64_t timestamp, size_t count, teKeyValue *kv)
+{
+    ANALYTICS_TRACE_SCOPE(te_add_event);
+
+    if (TE_SUCCESS != te_add_event(updateState, name, timestamp, count, kv)) {
+        *err = "out of memory";
+        return ER_OUT_OF_MEMORY;
+    }
+
+    eventCount++;
+
+    return ER_OK;
+}
+
+QStatus TellientAnalyticsDeviceObject::SubmitEvent(
+        const char **err, const char *name,
+        size_t count, const ajn::MsgArg *args, uint64_t timestamp)
+{
+    if (rollupRules && rollupRules->Size()) {
+        int r = rollupRules->Find(name);
+        if (r >= 0) {
+            return Rollup(err, r, count, args, timestamp);
+        }
+    }
+    if (coalesced && !coalesced->empty() && count <= MAX_EVENT_KEYS - 3) {
+        int c = FindCoalesced(name);
+        if (c >= 0) {
+            return Coalesce(err, c, count, args, timestamp);
         }
     }
 
+    QStatus status = BeginEvent(err, count);
+    if (status != ER_OK) {
+        return status;
+    }
+
     teKeyValue kv[MAX_EVENT_KEYS];
 
+    {
+        ANALYTICS_TRACE_SCOPE(argToKV);
+
+        for (size_t i = 0; i < count; i++) {
+
+            status = argToKV(err, &args[i], &kv[i]);
+            if (ER_OK != status) {
+                return ER_BAD_ARG_1;
+            }
+
+            if ( status != ER_OK ) {
+                return status;
+            }
+        }
+    }
+
+    return AddEvent(err, name, timestamp, count, kv);
+}
+
+
+QStatus TellientAnalyticsDeviceObject::Rollup(const char **err, int r,
+        size_t count, const ajn::MsgArg *args, uint64_t timestamp)
+{
+    if (!haveVendorData) {
+        *err = "must call SetVendorData first";
+        return ER_FAIL;
+    }
+
+    if (rollups.empty()) {
+        rollups.resize(rollupRules->Size());
+    }
+
+    const TellientRollupRule &rule = (*rollupRules)[r];
+    TellientRollupWindow &window = rollups[r];
+
+    if (!timestamp) {
+        timestamp = qcc::GetEpochTimestamp();
+    }
+    if (window.Start() &&
+            (timestamp < window.Start() || timestamp >= window.Start() + rule.windowMs)) {
+        QStatus status = CloseRollup(err, r);
+        if (status != ER_OK) {
+            return status;
+        }
+    }
+    if (!window.Start()) {
+        window.Open(rule, timestamp);
+    }
+
+    window.AddEvent();
     for (size_t i = 0; i < count; i++) {
+        AnalyticsKV entry;
+        if (!entry.Parse(args[i])) {
+            continue;
+        }
 
-        QStatus status = argToKV(err, &args[i], &kv[i]);
-        if (ER_OK != status) {
-            return ER_BAD_ARG_1;
+        double value;
+        int64_t x;
+        if (entry.GetInt64(x)) {
+            value = (double)x;
+        } else if (entry.type == ajn::ALLJOYN_DOUBLE) {
+            value = entry.value->v_double;
+        } else {
+            continue;
         }
 
-        if ( status != ER_OK ) {
+        for (size_t k = 0; k < rule.keys.size(); k++) {
+            if (rule.keys[k].name == entry.key) {
+                window.Add(k, value);
+                break;
+            }
+        }
+    }
+
+    return ER_OK;
+}
+
+
+QStatus TellientAnalyticsDeviceObject::CloseRollup(const char **err, size_t r)
+{
+    TellientRollupWindow &window = rollups[r];
+    if (!window.Start()) {
+        return ER_OK;
+    }
+
+    const TellientRollupRule &rule = (*rollupRules)[r];
+    uint64_t start = window.Start();
+    teKeyValue kv[TE_ROLLUP_MAX_KVS];
+    char hist[TE_ROLLUP_MAX_KEYS][TE_ROLLUP_HIST_CHARS];
+
+    int n = window.Close(rule, kv, hist);
+
+    QStatus status = BeginEvent(err, n);
+    if (status != ER_OK) {
+        return status;
+    }
+    return AddEvent(err, rule.event.c_str(), start, n, kv);
+}
+
+
+void TellientAnalyticsDeviceObject::FlushRollups()
+{
+    const char *err;
+    for (size_t r = 0; r < rollups.size(); r++) {
+        QStatus status = CloseRollup(&err, r);
+        if (status != ER_OK) {
+            QCC_LogError(status, ("Dropping rollup of %s: %s",
+                        (*rollupRules)[r].event.c_str(), err));
+        }
+    }
+}
+
+
+int TellientAnalyticsDeviceObject::FindCoalesced(const char *name) const
+{
+    if (coalesced) {
+        for (size_t i = 0; i < coalesced->size(); i++) {
+            if ((*coalesced)[i] == name) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+
+/*
+ * only the fingerprint is compared, so a repeat costs one pass over the
+ * arguments and no copying or encoding.
+ */
+QStatus TellientAnalyticsDeviceObject::Coalesce(const char **err, int c,
+        size_t count, const ajn::MsgArg *args, uint64_t timestamp)
+{
+    if (!haveVendorData) {
+        *err = "must call SetVendorData first";
+        return ER_FAIL;
+    }
+
+    if (held.empty()) {
+        held.resize(coalesced->size());
+    }
+
+    TellientCoalescedEvent &e = held[c];
+    uint64_t fingerprint = AnalyticsKVFingerprint(count, args);
+
+    if (!timestamp) {
+        timestamp = qcc::GetEpochTimestamp();
+    }
+
+    if (e.repeats && e.fingerprint == fingerprint) {
+        e.repeats++;
+        e.last = timestamp;
+        return ER_OK;
+    }
+
+    if (e.repeats) {
+        QStatus status = EmitCoalesced(err, c);
+        if (status != ER_OK) {
             return status;
         }
     }
 
-    if (TE_SUCCESS != te_add_event(updateState, name, timestamp, count, kv)) {
-        *err = "out of memory";
-        return ER_OUT_OF_MEMORY;
+    /* check the new event now; a bad one would otherwise fail later. */
+    teKeyValue kv;
+    for (size_t i = 0; i < count; i++) {
+        QStatus status = argToKV(err, &args[i], &kv);
+        if (status != ER_OK) {
+            return status;
+        }
     }
 
-    eventCount++;
-    globalEventCount++;
+    e.fingerprint = fingerprint;
+    e.first = timestamp;
+    e.last = timestamp;
+    e.repeats = 1;
+    e.kvs.assign(args, args + count);
 
     return ER_OK;
 }
 
 
+QStatus TellientAnalyticsDeviceObject::EmitCoalesced(const char **err, size_t c)
+{
+    TellientCoalescedEvent &e = held[c];
+    if (!e.repeats) {
+        return ER_OK;
+    }
+
+    size_t count = e.kvs.size();
+    teKeyValue kv[MAX_EVENT_KEYS];
+
+    QStatus status = BeginEvent(err, count + 3);
+    for (size_t i = 0; status == ER_OK && i < count; i++) {
+        status = argToKV(err, &e.kvs[i], &kv[i]);
+    }
+
+    if (status == ER_OK && e.repeats > 1) {
+        kv[count].name = "repeat_count";
+        kv[count].type = TE_I32;
+        kv[count].value.i32val = e.repeats;
+        count++;
+        kv[count].name = "first_ts";
+        kv[count].type = TE_I64;
+        kv[count].value.i64val = e.first;
+        count++;
+        kv[count].name = "last_ts";
+        kv[count].type = TE_I64;
+        kv[count].value.i64val = e.last;
+        count++;
+    }
+
+    if (status == ER_OK) {
+        status = AddEvent(err, (*coalesced)[c].c_str(), e.first, count, kv);
+    }
+
+    e.repeats = 0;
+    e.kvs.clear();
+    return status;
+}
+
+
+void TellientAnalyticsDeviceObject::FlushCoalesced()
+{
+    const char *err;
+    for (size_t c = 0; c < held.size(); c++) {
+        QStatus status = EmitCoalesced(&err, c);
+        if (status != ER_OK) {
+            QCC_LogError(status, ("Dropping coalesced %s: %s",
+                        (*coalesced)[c].c_str(), err));
+        }
+    }
+}
+
+
+QStatus TellientAnalyticsDeviceObject::RegisterEventSchema(const char **err,
+        const char *name, size_t count, const char *const *keys,
+        const char *types, uint32_t &id)
+{
+    if (count > MAX_EVENT_KEYS) {
+        *err = "too many event keys (max " STRINGIFY(MAX_EVENT_KEYS) ")";
+        return ER_OUT_OF_MEMORY;
+    }
+
+#if !TE_INCLUDE_FLOATING
+    /* valueToKV would refuse every event of the schema. */
+    if (types && strchr(types, 'd')) {
+        *err = "invalid key type (not b,y,n,q,i,u,x,t,s)";
+        return ER_BAD_ARG_3;
+    }
+#endif
+
+    return AnalyticsDeviceObject::RegisterEventSchema(err, name, count, keys, types, id);
+}
+
+
+/*
+ * the schema's key names are already interned, and Check has verified the
+ * value types, so each value goes straight to the encoder.
+ */
+QStatus TellientAnalyticsDeviceObject::SubmitCompactEvent(const char **err,
+        uint32_t id, size_t count, const ajn::MsgArg *values, uint64_t timestamp)
+{
+    const AnalyticsEventSchema *schema;
+    QStatus status = schemas.Check(err, id, count, values, schema);
+    if (status != ER_OK) {
+        return status;
+    }
+
+    if ((rollupRules && rollupRules->Find(schema->name.c_str()) >= 0) ||
+            FindCoalesced(schema->name.c_str()) >= 0) {
+        /* rollups and coalescing work on named keys. */
+        return AnalyticsDeviceObject::SubmitCompactEvent(err, id, count, values, timestamp);
+    }
+
+    status = BeginEvent(err, count);
+    if (status != ER_OK) {
+        return status;
+    }
+
+    teKeyValue kv[MAX_EVENT_KEYS];
+
+    for (size_t i = 0; i < count; i++) {
+        status = valueToKV(err, schema->keyNames[i],
+                AnalyticsSchemaTable::Unwrap(&values[i]), &kv[i]);
+        if (status != ER_OK) {
+            return status;
+        }
+    }
+
+    return AddEvent(err, schema->name.c_str(), timestamp, count, kv);
+}
+
+
 void TellientAnalyticsDeviceObject::RequestDelivery()
 {
+    FlushRollups();
+    FlushCoalesced();
+
     if (eventCount == 0) {
         return;
     }
 
-    QStatus status = SendToCloud(postUrl, updateState->used, updateState->buf);
+    QStatus status = SendUpdate(deliveryTimeout);
     if (ER_OK == status) {
         FreeUpdateState();
     }
 }
 
 
+void TellientAnalyticsDeviceObject::RequestDeliveryAsync(Completion *done)
+{
+    if (!delivery) {
+        AnalyticsDeviceObject::RequestDeliveryAsync(done);
+        return;
+    }
+
+    FlushRollups();
+    FlushCoalesced();
+
+    if (eventCount == 0) {
+        if (done) {
+            done->Complete(ER_OK, NULL);
+        }
+        return;
+    }
+
+    if (stats) {
+        stats->Add(ANALYTICS_BYTES_ENCODED, updateState->used);
+    }
+    delivery->Enqueue(postUrl, DetachUpdateState(), done, deliveryTimeout, stats);
+}
+
+
+void TellientAnalyticsDeviceObject::Shutdown()
+{
+    RequestDeliveryAsync(NULL);
+}
+
+
+void TellientAnalyticsDeviceObject::Reset()
+{
+    FreeUpdateState();
+    haveVendorData = false;
+    manufacturer_id = 0;
+    model.clear();
+    postUrl.clear();
+    deviceData.clear();
+    rollups.clear();
+    held.clear();
+    deliveryTimeout = 0;
+    AnalyticsDeviceObject::Reset();
+}
+
+
+void TellientAnalyticsDeviceObject::Compact()
+{
+    /* events left here could not be handed off; keep them for next time. */
+    if (eventCount == 0) {
+        FreeUpdateState();
+    }
+    if (!updateState) {
+        delete strings;
+        strings = NULL;
+    }
+    std::vector<ajn::MsgArg>(deviceData).swap(deviceData);
+}
+
+
+size_t TellientAnalyticsDeviceObject::MemoryFootprint() const
+{
+    size_t bytes = sizeof(*this) + schemas.Footprint();
+    bytes += model.capacity() + postUrl.capacity();
+    bytes += deviceData.capacity() * sizeof(ajn::MsgArg);
+    bytes += rollups.capacity() * sizeof(TellientRollupWindow);
+    bytes += held.capacity() * sizeof(TellientCoalescedEvent);
+    for (size_t c = 0; c < held.size(); c++) {
+        bytes += held[c].kvs.capacity() * sizeof(ajn::MsgArg);
+    }
+    if (updateState) {
+        bytes += sizeof(*updateState) + updateState->buf_size;
+    }
+    if (strings) {
+        bytes += sizeof(*strings);
+    }
+    return bytes;
+}
+
+
+QStatus TellientAnalyticsDeviceObject::SendUpdate(uint32_t timeoutMs)
+{
+    if (!stats) {
+        return SendToCloud(postUrl, updateState->used, updateState->buf, timeoutMs);
+    }
+
+    /* a failed update stays here and is counted again when it is retried. */
+    uint64_t start = AnalyticsStats::NowMicros();
+    stats->Add(ANALYTICS_BYTES_ENCODED, updateState->used);
+    QStatus status = SendToCloud(postUrl, updateState->used, updateState->buf, timeoutMs);
+    stats->Record(ANALYTICS_DELIVERY_LATENCY, AnalyticsStats::NowMicros() - start);
+    if (ER_OK == status) {
+        stats->Add(ANALYTICS_DELIVERIES);
+        stats->Add(ANALYTICS_BYTES_DELIVERED, updateState->used);
+    } else {
+        stats->Add(ANALYTICS_DELIVERY_FAILURES);
+    }
+    return status;
+}
+
+
 void TellientAnalyticsDeviceObject::SendIfFull()
 {
     if (!updateState) {
@@ -224,7 +693,7 @@ void TellientAnalyticsDeviceObject::SendIfFull()
     }
 
     if ( ( TE_DEVICE_SOFT_CAP_BYTES && updateState->used > TE_DEVICE_SOFT_CAP_BYTES )) {
-        QStatus status = SendToCloud(postUrl, updateState->used, updateState->buf);
+        QStatus status = SendUpdate(0);
         if (ER_OK == status) {
             FreeUpdateState();
         }
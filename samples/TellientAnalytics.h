@@ -19,17 +19,50 @@
 #define TELLIANTANALYTICS_H
 
 #include "Analytics.h"
+#include "TellientDelivery.h"
+#include "TellientRollup.h"
 #include <vector>
 
 extern "C" {
 #include "teclient.h"
 };
 
+/*
+ * The last event of a coalesced event name, held back while identical
+ * events keep arriving.
+ */
+struct TellientCoalescedEvent {
+    TellientCoalescedEvent() : repeats(0) {}
+
+    uint64_t fingerprint;
+    uint64_t first;      /* timestamps of the first and last repeat */
+    uint64_t last;
+    uint32_t repeats;    /* 0 if nothing is held */
+    std::vector<ajn::MsgArg> kvs;
+};
+
 /* Tellient implementation of the Analytics device object. */
 
 class TellientAnalyticsDeviceObject : public AnalyticsDeviceObject {
     public:
-        TellientAnalyticsDeviceObject()
+        /*
+         * delivery is the queue used for background delivery.  If it is
+         * NULL, RequestDeliveryAsync delivers synchronously.  rollupRules,
+         * if not NULL, lists the events to aggregate instead of sending.
+         * coalesced, if not NULL, names the events whose identical
+         * repeats are sent once, with repeat_count, first_ts and last_ts.
+         * wireVersion is the update.proto version to encode, 1 or 2.
+         */
+        TellientAnalyticsDeviceObject(TellientDeliveryQueue *delivery = NULL,
+                const TellientRollupRules *rollupRules = NULL,
+                const std::vector<qcc::String> *coalesced = NULL,
+                unsigned wireVersion = 1) :
+            delivery(delivery),
+            deliveryTimeout(0),
+            rollupRules(rollupRules),
+            coalesced(coalesced),
+            wireVersion(wireVersion),
+            strings(NULL)
         {
             updateState = NULL;
             haveVendorData = false;
@@ -44,7 +77,30 @@ class TellientAnalyticsDeviceObject : public AnalyticsDeviceObject {
                 const ajn::MsgArg *);
         virtual QStatus SetDeviceData(const char **errMsg, size_t count,
                 const ajn::MsgArg *);
+        virtual QStatus RegisterEventSchema(const char **errMsg, const char *name,
+                size_t count, const char *const *keys, const char *types, uint32_t &id);
+        virtual QStatus SubmitCompactEvent(const char **errMsg, uint32_t id,
+                size_t count, const ajn::MsgArg *values, uint64_t timestamp = 0);
         virtual void RequestDelivery();
+        virtual void RequestDeliveryAsync(Completion *done);
+
+        /* hands any buffered events to the delivery queue instead of waiting. */
+        virtual void Shutdown();
+
+        /* forget the vendor and device data, keeping allocated memory. */
+        virtual void Reset();
+
+        /* drop the empty update and string table and trim the device data. */
+        virtual void Compact();
+
+        virtual void SetDeliveryTimeout(uint32_t ms) { deliveryTimeout = ms; }
+
+        virtual size_t MemoryFootprint() const;
+
+        virtual size_t BufferedBytes() const
+        {
+            return updateState ? updateState->used : 0;
+        }
 
         void SetVendorData(int32_t manufacturer_id, const char *post_url,
                 const char *model)
@@ -58,29 +114,93 @@ class TellientAnalyticsDeviceObject : public AnalyticsDeviceObject {
         virtual ~TellientAnalyticsDeviceObject()
         {
             FreeUpdateState();
+            delete strings;
         }
 
+        /*
+         * convert one value, named key, to a teKeyValue.  kv points into
+         * key and v.  Public for te_bench.
+         */
+        static QStatus valueToKV(const char **err, const char *key,
+                const ajn::MsgArg *v, teKeyValue *kv);
+
+        /* convert one {sv} entry to a teKeyValue. */
+        static QStatus argToKV(const char **err, const ajn::MsgArg *arg, teKeyValue *kv);
+
     private:
+        friend class TellientDeliveryQueue;
+
+        /*
+         * give up ownership of the current update, for delivery elsewhere.
+         * The next event starts a new one.
+         */
+        teUpdateState *DetachUpdateState() {
+            teUpdateState *state = updateState;
+            eventCount = 0;
+            wroteDeviceData = false;
+            updateState = NULL;
+            return state;
+        }
 
         void FreeUpdateState() {
             if (updateState) {
                 free(updateState->buf);
                 delete updateState;
-                globalEventCount -= eventCount;
                 eventCount = 0;
                 wroteDeviceData = false;
                 updateState = NULL;
             }
         }
 
+        /*
+         * check limits and start the update if needed, before an event
+         * of count keys is added.
+         */
+        QStatus BeginEvent(const char **err, size_t count);
+
+        /* encode one event into the update. */
+        QStatus AddEvent(const char **err, const char *name, uint64_t timestamp,
+                size_t count, teKeyValue *kv);
+
+        /* add an event to the open window of rollup rule r. */
+        QStatus Rollup(const char **err, int r, size_t count,
+                const ajn::MsgArg *args, uint64_t timestamp);
+
+        /* encode the open window of rollup rule r, if any. */
+        QStatus CloseRollup(const char **err, size_t r);
+
+        /* encode every open rollup window. */
+        void FlushRollups();
+
+        /* index of name in coalesced, or -1. */
+        int FindCoalesced(const char *name) const;
+
+        /* hold an event of coalesced name c, or count it as a repeat. */
+        QStatus Coalesce(const char **err, int c, size_t count,
+                const ajn::MsgArg *args, uint64_t timestamp);
+
+        /* encode the event held for coalesced name c, if any. */
+        QStatus EmitCoalesced(const char **err, size_t c);
+
+        /* encode every held event. */
+        void FlushCoalesced();
+
         /* internal method to write device data into the output buffer. */
         QStatus WriteDeviceData(const char **err);
 
         /*
          * utility method to POST the protobuf to the cloud service.
          * When this method returns ER_OK, the buffer can be reclaimed.
+         * A timeoutMs other than 0 bounds the whole request.
          */
-        static QStatus SendToCloud(qcc::String &url, size_t nbytes, void *buffer);
+        static QStatus SendToCloud(qcc::String &url, size_t nbytes, void *buffer,
+                uint32_t timeoutMs = 0);
+
+        /* one-time setup for SendToCloud, before it is used from several threads. */
+        static void CloudInit();
+
+        /* send the current update now, recording it in stats. */
+        QStatus SendUpdate(uint32_t timeoutMs);
 
         /*
          * method to send batched data to the cloud if limits are reached,
@@ -90,6 +210,26 @@ class TellientAnalyticsDeviceObject : public AnalyticsDeviceObject {
 
         teUpdateState *updateState;
 
+        TellientDeliveryQueue *delivery;
+
+        /* see SetDeliveryTimeout; 0 for none. */
+        uint32_t deliveryTimeout;
+
+        /* rules shared by the factory's devices, and this device's windows. */
+        const TellientRollupRules *rollupRules;
+        std::vector<TellientRollupWindow> rollups;
+
+        /* coalesced event names, and this device's held events. */
+        const std::vector<qcc::String> *coalesced;
+        std::vector<TellientCoalescedEvent> held;
+
+        /*
+         * the update.proto version, and for version 2 the string table of
+         * the update being encoded, allocated with the first update.
+         */
+        unsigned wireVersion;
+        teStringTable *strings;
+
         /* vendor data */
         bool haveVendorData;
         int manufacturer_id;
@@ -101,23 +241,64 @@ class TellientAnalyticsDeviceObject : public AnalyticsDeviceObject {
 
         /* number of events batched up */
         uint32_t eventCount;
-
-        /* number of events batched up (all devices) */
-        static uint32_t globalEventCount;
 };
 
-class TellientDevFactory : public AnalyticsDeviceObject::Factory {
+class TellientDevFactory : public AnalyticsDevicePool {
     public:
-        virtual AnalyticsDeviceObject *Construct()
+        TellientDevFactory() : wireVersion(1) {}
+        ~TellientDevFactory() {}
+
+        virtual size_t DeliveryBacklog() { return delivery.Depth(); }
+        virtual size_t DeliveryBytes() { return delivery.Bytes(); }
+
+        /* see TellientDeliveryQueue::Reserve. */
+        void ReserveUpdates(size_t count, size_t bytes)
         {
-            return new TellientAnalyticsDeviceObject();
+            delivery.Reserve(count, bytes);
         }
-        virtual void Destroy(AnalyticsDeviceObject *x)
+
+        /*
+         * aggregate the named keys of event over windows of windowSeconds
+         * (see TellientRollupRule).  Must be called before any device is
+         * constructed.  Returns false if the rule is invalid.
+         */
+        bool AddRollupRule(const char *event, uint32_t windowSeconds,
+                size_t nkeys, const char *const *keys)
         {
-            delete x;
-        };
+            return rollupRules.Add(event, windowSeconds, nkeys, keys);
+        }
 
-        ~TellientDevFactory() {}
+        /*
+         * coalesce identical consecutive events with this name.  Must be
+         * called before any device is constructed.
+         */
+        void AddCoalescedEvent(const char *event)
+        {
+            coalesced.push_back(event);
+        }
+
+        /*
+         * encode updates with this update.proto version, 1 (the default)
+         * or 2.  Must be called before any device is constructed.
+         */
+        void SetWireVersion(unsigned version)
+        {
+            wireVersion = version;
+        }
+
+    protected:
+        virtual AnalyticsDeviceObject *Allocate()
+        {
+            return new TellientAnalyticsDeviceObject(&delivery, &rollupRules, &coalesced,
+                    wireVersion);
+        }
+
+    private:
+        /* shared by all devices made by this factory. */
+        TellientDeliveryQueue delivery;
+        TellientRollupRules rollupRules;
+        std::vector<qcc::String> coalesced;
+        unsigned wireVersion;
 };
 
 #endif
@@ -0,0 +1,250 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#include "TellientDelivery.h"
+#include "TellientAnalytics.h"
+#include "AnalyticsTrace.h"
+
+#include <qcc/time.h>
+
+using namespace qcc;
+
+TellientDeliveryQueue::TellientDeliveryQueue(unsigned threads) :
+    jobs(16),
+    first(0),
+    queued(0),
+    inFlight(0),
+    bytes(0),
+    stopping(false)
+{
+    TellientAnalyticsDeviceObject::CloudInit();
+
+    spare.reserve(TE_DELIVERY_SPARE_UPDATES);
+
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        Worker *worker = new Worker(*this);
+        if (ER_OK == worker->Start()) {
+            workers.push_back(worker);
+        } else {
+            delete worker;
+        }
+    }
+}
+
+TellientDeliveryQueue::~TellientDeliveryQueue()
+{
+    lock.Lock();
+    stopping = true;
+    ready.Broadcast();
+    lock.Unlock();
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->Join();
+        delete workers[i];
+    }
+
+    /* nothing could be started; deliver whatever is left from here. */
+    while (queued) {
+        Job job = jobs[first];
+        first = (first + 1) % jobs.size();
+        queued--;
+        Deliver(job);
+    }
+
+    for (size_t i = 0; i < spare.size(); i++) {
+        free(spare[i]->buf);
+        delete spare[i];
+    }
+}
+
+void TellientDeliveryQueue::Enqueue(const qcc::String &url, teUpdateState *state,
+        AnalyticsDeviceObject::Completion *done, uint32_t timeoutMs,
+        AnalyticsStats *stats)
+{
+    ANALYTICS_TRACE_SCOPE(enqueue);
+
+    Job job;
+    job.url = url;
+    job.state = state;
+    job.done = done;
+    job.deadline = timeoutMs ? qcc::GetTimestamp64() + timeoutMs : 0;
+    job.stats = stats;
+    job.enqueued = stats ? AnalyticsStats::NowMicros() : 0;
+
+    lock.Lock();
+    if (queued == jobs.size()) {
+        /* full; unroll the ring into one twice the size. */
+        std::vector<Job> grown(jobs.size() * 2);
+        for (size_t i = 0; i < queued; i++) {
+            grown[i] = jobs[(first + i) % jobs.size()];
+        }
+        jobs.swap(grown);
+        first = 0;
+    }
+    jobs[(first + queued) % jobs.size()] = job;
+    queued++;
+    bytes += state->used;
+    ready.Signal();
+    lock.Unlock();
+}
+
+size_t TellientDeliveryQueue::Depth()
+{
+    lock.Lock();
+    size_t depth = queued + inFlight;
+    lock.Unlock();
+    return depth;
+}
+
+size_t TellientDeliveryQueue::Bytes()
+{
+    lock.Lock();
+    size_t n = bytes;
+    lock.Unlock();
+    return n;
+}
+
+bool TellientDeliveryQueue::Next(Job &job)
+{
+    lock.Lock();
+    while (!queued && !stopping) {
+        ready.Wait(lock);
+    }
+    if (!queued) {
+        lock.Unlock();
+        return false;
+    }
+    job = jobs[first];
+    /* drop the slot's url reference now rather than when it is reused. */
+    jobs[first].url.clear();
+    first = (first + 1) % jobs.size();
+    queued--;
+    inFlight++;
+    lock.Unlock();
+    return true;
+}
+
+void TellientDeliveryQueue::Deliver(Job &job)
+{
+    QStatus status = ER_FAIL;
+    uint32_t backoff = 100;
+
+    for (unsigned attempt = 0; attempt <= TE_DELIVERY_MAX_RETRIES; attempt++) {
+        if (attempt) {
+            qcc::Sleep(backoff);
+            backoff <<= 1;
+        }
+
+        uint32_t timeout = 0;
+        if (job.deadline) {
+            uint64_t now = qcc::GetTimestamp64();
+            if (now >= job.deadline) {
+                status = ER_TIMEOUT;
+                break;
+            }
+            timeout = (uint32_t)(job.deadline - now);
+        }
+
+        status = TellientAnalyticsDeviceObject::SendToCloud(job.url,
+                job.state->used, job.state->buf, timeout);
+        if (ER_OK == status) {
+            break;
+        }
+    }
+
+    if (ER_OK != status) {
+        QCC_LogError(status, ("Dropping %d byte update for %s", job.state->used, job.url.c_str()));
+    }
+
+    if (job.stats) {
+        job.stats->Record(ANALYTICS_DELIVERY_LATENCY, AnalyticsStats::NowMicros() - job.enqueued);
+        if (ER_OK == status) {
+            job.stats->Add(ANALYTICS_DELIVERIES);
+            job.stats->Add(ANALYTICS_BYTES_DELIVERED, job.state->used);
+        } else {
+            job.stats->Add(ANALYTICS_DELIVERY_FAILURES);
+        }
+    }
+
+    Recycle(job.state);
+    job.state = NULL;
+
+    if (job.done) {
+        job.done->Complete(status, ER_OK == status ? NULL : "delivery failed");
+    }
+}
+
+teUpdateState *TellientDeliveryQueue::TakeState()
+{
+    teUpdateState *state = NULL;
+
+    lock.Lock();
+    if (!spare.empty()) {
+        state = spare.back();
+        spare.pop_back();
+    }
+    lock.Unlock();
+
+    return state ? state : new teUpdateState();
+}
+
+void TellientDeliveryQueue::Reserve(size_t count, size_t bytes)
+{
+    lock.Lock();
+    while (count-- && spare.size() < TE_DELIVERY_SPARE_UPDATES) {
+        teUpdateState *state = new teUpdateState();
+        state->buf = malloc(bytes);
+        state->buf_size = state->buf ? (int32_t)bytes : 0;
+        state->used = 0;
+        spare.push_back(state);
+    }
+    lock.Unlock();
+}
+
+void TellientDeliveryQueue::Recycle(teUpdateState *state)
+{
+    lock.Lock();
+    if (spare.size() < TE_DELIVERY_SPARE_UPDATES) {
+        state->used = 0;
+        spare.push_back(state);
+        state = NULL;
+    }
+    lock.Unlock();
+
+    if (state) {
+        free(state->buf);
+        delete state;
+    }
+}
+
+ThreadReturn STDCALL TellientDeliveryQueue::Worker::Run(void *arg)
+{
+    Job job;
+    while (queue.Next(job)) {
+        size_t used = job.state->used;
+        queue.Deliver(job);
+
+        queue.lock.Lock();
+        queue.inFlight--;
+        queue.bytes -= used;
+        queue.lock.Unlock();
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef TELLIENTDELIVERY_H
+#define TELLIENTDELIVERY_H
+
+#include "Analytics.h"
+#include <vector>
+
+#include <qcc/Condition.h>
+#include <qcc/Thread.h>
+
+extern "C" {
+#include "teclient.h"
+};
+
+/*
+ * Background delivery of finished updates to the cloud service.
+ *
+ * A device object hands over its update buffer with Enqueue() and is free
+ * to start a new one straight away.  A small pool of worker threads POSTs
+ * queued updates, retrying failures up to TE_DELIVERY_MAX_RETRIES times,
+ * then reports the outcome to the job's completion token.
+ */
+class TellientDeliveryQueue {
+    public:
+        TellientDeliveryQueue(unsigned threads = TE_DELIVERY_THREADS);
+
+        /* delivers everything still queued, then stops the workers. */
+        ~TellientDeliveryQueue();
+
+        /*
+         * take ownership of state and its buffer and deliver it to url.
+         * done, if not NULL, is completed once the delivery has succeeded
+         * or been abandoned.  If timeoutMs is not 0 the update is
+         * abandoned once that long has passed, retries included.  The
+         * outcome is recorded in stats, if not NULL.
+         */
+        void Enqueue(const qcc::String &url, teUpdateState *state,
+                AnalyticsDeviceObject::Completion *done, uint32_t timeoutMs = 0,
+                AnalyticsStats *stats = NULL);
+
+        /* number of updates waiting for or in delivery. */
+        size_t Depth();
+
+        /* total size of the updates counted by Depth(). */
+        size_t Bytes();
+
+        /*
+         * an empty update state for a device object to start its next
+         * update in.  Its buffer, if any, is that of a delivered update,
+         * so a device that keeps sending updates of about the same size
+         * does not allocate for them.
+         */
+        teUpdateState *TakeState();
+
+        /*
+         * add spare update states with buffers of the given size, up to
+         * TE_DELIVERY_SPARE_UPDATES in all, so that the first updates
+         * of that size do not allocate either.
+         */
+        void Reserve(size_t count, size_t bytes);
+
+    private:
+        struct Job {
+            qcc::String url;
+            teUpdateState *state;
+            AnalyticsDeviceObject::Completion *done;
+            uint64_t deadline;  /* 0 for none */
+            AnalyticsStats *stats;
+            uint64_t enqueued;  /* in microseconds, if stats */
+        };
+
+        class Worker : public qcc::Thread {
+            public:
+                Worker(TellientDeliveryQueue &queue) :
+                    qcc::Thread("TellientDelivery"),
+                    queue(queue)
+                {
+                }
+            protected:
+                virtual qcc::ThreadReturn STDCALL Run(void *arg);
+            private:
+                TellientDeliveryQueue &queue;
+        };
+        friend class Worker;
+
+        /* wait for the next job.  Returns false once stopping and drained. */
+        bool Next(Job &job);
+
+        void Deliver(Job &job);
+
+        /* keep a delivered update's state for TakeState(), or free it. */
+        void Recycle(teUpdateState *state);
+
+        qcc::Mutex lock;
+        qcc::Condition ready;
+
+        /*
+         * queued jobs, a ring of jobs.size() slots starting at first.  It
+         * only grows, so a steady stream of updates does not allocate.
+         */
+        std::vector<Job> jobs;
+        size_t first;
+        size_t queued;
+
+        /* states of delivered updates, at most TE_DELIVERY_SPARE_UPDATES. */
+        std::vector<teUpdateState *> spare;
+
+        size_t inFlight;
+        size_t bytes;
+        bool stopping;
+        std::vector<Worker *> workers;
+};
+
+#endif
@@ -0,0 +1,167 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#include "TellientRollup.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+TellientRollupRules::~TellientRollupRules()
+{
+    for (size_t i = 0; i < rules.size(); i++) {
+        delete rules[i];
+    }
+}
+
+bool TellientRollupRules::Add(const char *event, uint32_t windowSeconds,
+        size_t nkeys, const char *const *keys)
+{
+    if (!event || !*event || windowSeconds == 0 ||
+            windowSeconds > TE_ROLLUP_MAX_WINDOW_SECONDS ||
+            nkeys == 0 || nkeys > TE_ROLLUP_MAX_KEYS || Find(event) >= 0) {
+        return false;
+    }
+
+    TellientRollupRule *rule = new TellientRollupRule();
+    if (!rule) {
+        return false;
+    }
+    rule->event = event;
+    rule->windowMs = windowSeconds * 1000;
+    rule->keys.resize(nkeys);
+    for (size_t i = 0; i < nkeys; i++) {
+        TellientRollupRule::Key &k = rule->keys[i];
+        k.name = keys[i];
+        k.count = k.name + ".count";
+        k.sum = k.name + ".sum";
+        k.min = k.name + ".min";
+        k.max = k.name + ".max";
+        k.hist = k.name + ".hist";
+    }
+
+    rules.push_back(rule);
+    return true;
+}
+
+int TellientRollupRules::Find(const char *event) const
+{
+    for (size_t i = 0; i < rules.size(); i++) {
+        if (rules[i]->event == event) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void TellientRollupWindow::Open(const TellientRollupRule &rule, uint64_t timestamp)
+{
+    start = timestamp - timestamp % rule.windowMs;
+    if (start == 0) {
+        /* 0 means no window is open. */
+        start = 1;
+    }
+    events = 0;
+    memset(acc, 0, sizeof(acc));
+}
+
+void TellientRollupWindow::Add(size_t key, double value)
+{
+    Accumulator &a = acc[key];
+
+    if (a.count == 0 || value < a.min) {
+        a.min = value;
+    }
+    if (a.count == 0 || value > a.max) {
+        a.max = value;
+    }
+    a.count++;
+    a.sum += value;
+
+    /* m = f * 2^e with f in [0.5, 1), so m in [2^(e-1), 2^e). */
+    double m = value < 0 ? -value : value;
+    int e = 0;
+    if (m >= 1.0) {
+        frexp(m, &e);
+        if (e > TE_ROLLUP_BUCKETS - 1) {
+            e = TE_ROLLUP_BUCKETS - 1;
+        }
+    }
+    a.buckets[e]++;
+}
+
+static void setNumber(teKeyValue *kv, const char *name, double value)
+{
+    kv->name = name;
+#if TE_INCLUDE_FLOATING
+    kv->type = TE_DOUBLE;
+    kv->value.doubleval = value;
+#else
+    kv->type = TE_I64;
+    kv->value.i64val = (int64_t)value;
+#endif
+}
+
+int TellientRollupWindow::Close(const TellientRollupRule &rule, teKeyValue *kv,
+        char hist[][TE_ROLLUP_HIST_CHARS])
+{
+    int n = 0;
+
+    kv[n].name = "window_ms";
+    kv[n].type = TE_I32;
+    kv[n].value.i32val = rule.windowMs;
+    n++;
+
+    kv[n].name = "events";
+    kv[n].type = TE_I32;
+    kv[n].value.i32val = events;
+    n++;
+
+    for (size_t i = 0; i < rule.keys.size(); i++) {
+        const Accumulator &a = acc[i];
+        const TellientRollupRule::Key &k = rule.keys[i];
+
+        kv[n].name = k.count.c_str();
+        kv[n].type = TE_I32;
+        kv[n].value.i32val = a.count;
+        n++;
+
+        if (a.count == 0) {
+            continue;
+        }
+
+        setNumber(&kv[n++], k.sum.c_str(), a.sum);
+        setNumber(&kv[n++], k.min.c_str(), a.min);
+        setNumber(&kv[n++], k.max.c_str(), a.max);
+
+        char *p = hist[i];
+        char *end = hist[i] + TE_ROLLUP_HIST_CHARS;
+        *p = '\0';
+        for (size_t b = 0; b < TE_ROLLUP_BUCKETS; b++) {
+            if (a.buckets[b]) {
+                p += snprintf(p, end - p, "%s%u:%u", p == hist[i] ? "" : ",",
+                        (unsigned)b, a.buckets[b]);
+            }
+        }
+        kv[n].name = k.hist.c_str();
+        kv[n].type = TE_STRING;
+        kv[n].value.stringval = hist[i];
+        n++;
+    }
+
+    start = 0;
+    return n;
+}
@@ -0,0 +1,149 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#ifndef TELLIENTROLLUP_H
+#define TELLIENTROLLUP_H
+
+#include "Analytics.h"
+#include <vector>
+
+extern "C" {
+#include "teclient.h"
+};
+
+/* maximum number of keys one rollup rule aggregates. */
+#ifndef TE_ROLLUP_MAX_KEYS
+#define TE_ROLLUP_MAX_KEYS 6
+#endif
+
+/*
+ * number of histogram buckets per key.  Bucket 0 counts values with
+ * magnitude below 1; bucket i counts magnitudes in [2^(i-1), 2^i).  The
+ * last bucket also takes everything larger.
+ */
+#ifndef TE_ROLLUP_BUCKETS
+#define TE_ROLLUP_BUCKETS 32
+#endif
+
+/*
+ * longest rollup window, in seconds.  The window is sent in
+ * milliseconds as an int32, so it must stay well below 2^31 ms.
+ */
+#ifndef TE_ROLLUP_MAX_WINDOW_SECONDS
+#define TE_ROLLUP_MAX_WINDOW_SECONDS 86400
+#endif
+
+/* room for one histogram string: "bucket:count," for every bucket. */
+#define TE_ROLLUP_HIST_CHARS (TE_ROLLUP_BUCKETS * 14 + 1)
+
+/* room needed in the teKeyValue array passed to TellientRollupWindow::Close. */
+#define TE_ROLLUP_MAX_KVS (2 + 5 * TE_ROLLUP_MAX_KEYS)
+
+/*
+ * A rollup rule: instead of sending each event with this name, the
+ * device object aggregates the listed numeric keys over fixed windows and
+ * sends one event per window.  That event has the same name, the keys
+ * "window_ms" and "events", and for each rule key k: k.count, k.sum,
+ * k.min, k.max, and k.hist, the histogram's non-empty buckets as
+ * "bucket:count,...".  Keys not in the rule are dropped.
+ */
+struct TellientRollupRule {
+    struct Key {
+        qcc::String name;
+        qcc::String count;
+        qcc::String sum;
+        qcc::String min;
+        qcc::String max;
+        qcc::String hist;
+    };
+
+    qcc::String event;
+    uint32_t windowMs;
+    std::vector<Key> keys;
+};
+
+/* The rollup rules of one factory.  Read-only once devices exist. */
+class TellientRollupRules {
+    public:
+        TellientRollupRules() {}
+        ~TellientRollupRules();
+
+        /*
+         * returns false if the rule is invalid, including a window of 0 or
+         * over TE_ROLLUP_MAX_WINDOW_SECONDS, or the event already has one.
+         */
+        bool Add(const char *event, uint32_t windowSeconds, size_t nkeys,
+                const char *const *keys);
+
+        /* index of the rule for event, or -1. */
+        int Find(const char *event) const;
+
+        const TellientRollupRule &operator[](size_t i) const { return *rules[i]; }
+        size_t Size() const { return rules.size(); }
+
+    private:
+        std::vector<TellientRollupRule *> rules;
+
+        /* not copyable */
+        TellientRollupRules(const TellientRollupRules &);
+        TellientRollupRules &operator=(const TellientRollupRules &);
+};
+
+/*
+ * One device's open window for one rule.  Adding a value does not
+ * allocate.
+ */
+class TellientRollupWindow {
+    public:
+        TellientRollupWindow() : start(0), events(0) {}
+
+        /* start of the open window, in ms, or 0 if there is none. */
+        uint64_t Start() const { return start; }
+
+        /* open a window covering timestamp. */
+        void Open(const TellientRollupRule &rule, uint64_t timestamp);
+
+        /* count an event in the open window. */
+        void AddEvent() { events++; }
+
+        /* add a value for the rule's key with index key. */
+        void Add(size_t key, double value);
+
+        /*
+         * fill kv, which must have room for TE_ROLLUP_MAX_KVS entries,
+         * with the aggregated event and close the window.  hist holds the
+         * histogram strings, which kv points into.  Returns the number of
+         * entries used.
+         */
+        int Close(const TellientRollupRule &rule, teKeyValue *kv,
+                char hist[][TE_ROLLUP_HIST_CHARS]);
+
+    private:
+        struct Accumulator {
+            uint32_t count;
+            double sum;
+            double min;
+            double max;
+            uint32_t buckets[TE_ROLLUP_BUCKETS];
+        };
+
+        uint64_t start;
+        uint32_t events;
+        Accumulator acc[TE_ROLLUP_MAX_KEYS];
+};
+
+#endif
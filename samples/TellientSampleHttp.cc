@@ -16,6 +16,7 @@
  *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  ******************************************************************************/
 #include "TellientAnalytics.h"
+#include "AnalyticsTrace.h"
 
 #include <curl/curl.h>
 
@@ -28,11 +29,21 @@
  * Once this method returns ER_OK, the TellientAnalytics object may reclaim the
  * buffer at any time, so an asynchronous implementation will need to
  * copy the buffer before returning.
+ *
+ * TellientDeliveryQueue calls this from several worker threads at once,
+ * after CloudInit has been called once.
  */
 
+void TellientAnalyticsDeviceObject::CloudInit()
+{
+    curl_global_init(CURL_GLOBAL_ALL);
+}
+
 QStatus TellientAnalyticsDeviceObject::SendToCloud(qcc::String &post_url,
-    size_t nbytes, void *buffer)
+    size_t nbytes, void *buffer, uint32_t timeoutMs)
 {
+    ANALYTICS_TRACE_SCOPE(post);
+
     CURL *request = curl_easy_init();
     if (!request) {
         return ER_FAIL;
@@ -43,16 +54,20 @@ QStatus TellientAnalyticsDeviceObject::SendToCloud(qcc::String &post_url,
     curl_easy_setopt(request, CURLOPT_POSTFIELDS, buffer);
     curl_easy_setopt(request, CURLOPT_POSTFIELDSIZE, nbytes);
     curl_easy_setopt(request, CURLOPT_VERBOSE, 1);
+    curl_easy_setopt(request, CURLOPT_NOSIGNAL, 1);
+    /* an HTTP error status is a failed delivery, to be retried. */
+    curl_easy_setopt(request, CURLOPT_FAILONERROR, 1);
+    if (timeoutMs) {
+        curl_easy_setopt(request, CURLOPT_TIMEOUT_MS, (long)timeoutMs);
+    }
 
     struct curl_slist *chunk = NULL;
     chunk = curl_slist_append(chunk, "Content-type: application/x-protobuf");
     curl_easy_setopt(request, CURLOPT_HTTPHEADER, chunk);
 
-    if (CURLE_OK != curl_easy_perform(request)) {
-        return ER_FAIL;
-    }
+    CURLcode result = curl_easy_perform(request);
 
     curl_easy_cleanup(request);
     curl_slist_free_all(chunk);
-    return ER_OK;
+    return CURLE_OK == result ? ER_OK : ER_FAIL;
 }
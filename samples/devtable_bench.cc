@@ -0,0 +1,115 @@
+/**
+ * @file
+ * @brief  Benchmark of device lookup cost in the analytics bus object
+ */
+
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Compares the std::map<std::string, ...> lookup previously used by
+ * AnalyticsBusObject::MakeOrFindDev against AnalyticsDeviceTable, using
+ * names shaped like AllJoyn unique bus names (":XXXXXXXX.N").
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "AnalyticsDeviceTable.h"
+
+/* number of lookups timed for each table size. */
+#define LOOKUPS 2000000
+
+static double NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void MakeNames(size_t n, std::vector<std::string> &names)
+{
+    char buf[32];
+    names.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        /* a router prefix shared by groups of clients, as on a real bus. */
+        snprintf(buf, sizeof(buf), ":%08x.%u", (unsigned)(i / 64) * 2654435761u, (unsigned)(i % 64) + 2);
+        names[i] = buf;
+    }
+}
+
+static void RunOne(size_t n)
+{
+    std::vector<std::string> names;
+    MakeNames(n, names);
+
+    /* fake device pointers; the tables never dereference them. */
+    AnalyticsDeviceObject *fake = reinterpret_cast<AnalyticsDeviceObject *>(&names);
+
+    std::map<std::string, AnalyticsDeviceObject *> map;
+    AnalyticsDeviceTable table;
+    for (size_t i = 0; i < n; i++) {
+        map[names[i]] = fake;
+        table.Insert(names[i].c_str(), AnalyticsDeviceTable::Hash(names[i].c_str()), fake);
+    }
+
+    /* lookup order is pseudo-random so neither structure stays in cache. */
+    std::vector<const char *> order(LOOKUPS);
+    unsigned seed = 12345;
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        seed = seed * 1103515245u + 12345u;
+        order[i] = names[(seed >> 8) % n].c_str();
+    }
+
+    size_t hits = 0;
+    double t0 = NowNs();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        /* as MakeOrFindDev did: a std::string is built from the sender on every call. */
+        if (map[order[i]]) {
+            hits++;
+        }
+    }
+    double t1 = NowNs();
+    for (size_t i = 0; i < LOOKUPS; i++) {
+        if (table.Find(order[i])) {
+            hits++;
+        }
+    }
+    double t2 = NowNs();
+
+    if (hits != 2 * (size_t)LOOKUPS) {
+        fprintf(stderr, "lookup mismatch at %u devices\n", (unsigned)n);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("%7u devices: std::map %7.1f ns/lookup, AnalyticsDeviceTable %6.1f ns/lookup\n",
+            (unsigned)n, (t1 - t0) / LOOKUPS, (t2 - t1) / LOOKUPS);
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t sizes[] = { 1000, 10000, 100000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        RunOne(sizes[i]);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,562 @@
+/**
+ * @file
+ * @brief  Local stand-in for the Tellient ingest server
+ */
+
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Accepts the application/x-protobuf POSTs made by TellientSampleHttp.cc,
+ * validates each Update with tedecode.c and counts the updates, events and
+ * bytes received, so delivery can be measured without a live server.
+ * Point post_url at http://localhost:<port>/.
+ *
+ * Faults can be injected to exercise delivery retries and backpressure:
+ * a fixed or jittered delay before every response (-l), a fraction of
+ * requests answered with 503 (-e), and bodies read no faster than a given
+ * rate (-s).  Once a second, and on SIGINT, the counts are printed.
+ */
+
+#include <qcc/platform.h>
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <deque>
+#include <vector>
+
+#include <qcc/Condition.h>
+#include <qcc/Mutex.h>
+#include <qcc/Thread.h>
+
+#include "tedecode.h"
+
+/* longest request head, and largest body, accepted. */
+#define MAX_HEAD_BYTES 8192
+#define MAX_BODY_BYTES (16 * 1024 * 1024)
+
+/* keep-alive connections idle for this long are closed. */
+#define IDLE_TIMEOUT_MS 30000
+
+static volatile sig_atomic_t s_interrupt = false;
+
+static void SigIntHandler(int sig)
+{
+    s_interrupt = true;
+}
+
+struct IngestConfig {
+    unsigned port;
+    unsigned threads;
+    unsigned latencyMs;     /* delay before every response ... */
+    unsigned jitterMs;      /* ... plus up to this much more */
+    double errorRate;       /* fraction of requests answered with 503 */
+    unsigned readRate;      /* body bytes read per second, 0 for unlimited */
+
+    IngestConfig() :
+        port(8080), threads(8), latencyMs(0), jitterMs(0), errorRate(0), readRate(0)
+    {
+    }
+};
+
+static IngestConfig s_config;
+
+class IngestServer;
+
+class IngestWorker : public qcc::Thread {
+    public:
+        IngestWorker(IngestServer &server, unsigned index) :
+            qcc::Thread("IngestWorker"),
+            requests(0), updates(0), events(0), bytes(0),
+            invalid(0), injected(0), rejected(0),
+            server(server),
+            seed(index * 2654435761u + 1),
+            have(0),
+            readyAt(0)
+        {
+        }
+
+        /* totals, read without locking by the reporting thread. */
+        volatile uint64_t requests;
+        volatile uint64_t updates;      /* valid updates accepted */
+        volatile uint64_t events;
+        volatile uint64_t bytes;        /* body bytes of accepted updates */
+        volatile uint64_t invalid;      /* updates that failed to decode */
+        volatile uint64_t injected;     /* 503s injected with -e */
+        volatile uint64_t rejected;     /* malformed or unsupported requests */
+
+    protected:
+        virtual qcc::ThreadReturn STDCALL Run(void *arg);
+
+    private:
+        void Serve(int fd);
+        bool Fill(int fd, size_t want);
+        bool Respond(int fd, int code, const char *reason, bool keepAlive);
+
+        uint32_t Random()
+        {
+            seed = seed * 1103515245u + 12345u;
+            return seed >> 8;
+        }
+
+        IngestServer &server;
+        uint32_t seed;
+
+        /* bytes read from the connection and not yet consumed. */
+        std::vector<char> buf;
+        size_t have;
+
+        /* with -s, when the connection may next be read. */
+        uint64_t readyAt;
+};
+
+class IngestServer {
+    public:
+        IngestServer() : stopping(false) {}
+
+        void Start(unsigned threads)
+        {
+            for (unsigned i = 0; i < threads; i++) {
+                IngestWorker *worker = new IngestWorker(*this, i);
+                if (ER_OK == worker->Start()) {
+                    workers.push_back(worker);
+                } else {
+                    delete worker;
+                }
+            }
+        }
+
+        void Stop()
+        {
+            lock.Lock();
+            stopping = true;
+            ready.Broadcast();
+            lock.Unlock();
+
+            for (size_t i = 0; i < workers.size(); i++) {
+                workers[i]->Join();
+                delete workers[i];
+            }
+            workers.clear();
+
+            while (!conns.empty()) {
+                close(conns.front());
+                conns.pop_front();
+            }
+        }
+
+        void Add(int fd)
+        {
+            lock.Lock();
+            conns.push_back(fd);
+            ready.Signal();
+            lock.Unlock();
+        }
+
+        /* the next accepted connection, or -1 when stopping. */
+        int Next()
+        {
+            lock.Lock();
+            while (conns.empty() && !stopping) {
+                ready.Wait(lock);
+            }
+            int fd = -1;
+            if (!stopping) {
+                fd = conns.front();
+                conns.pop_front();
+            }
+            lock.Unlock();
+            return fd;
+        }
+
+        bool Stopping() const { return stopping; }
+
+        std::vector<IngestWorker *> workers;
+
+    private:
+        qcc::Mutex lock;
+        qcc::Condition ready;
+        std::deque<int> conns;
+        volatile bool stopping;
+};
+
+qcc::ThreadReturn STDCALL IngestWorker::Run(void *arg)
+{
+    buf.resize(MAX_HEAD_BYTES);
+
+    int fd;
+    while ((fd = server.Next()) >= 0) {
+        /* short receive timeouts, so idle connections notice a shutdown. */
+        struct timeval tv;
+        tv.tv_sec = 0;
+        tv.tv_usec = 100 * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        have = 0;
+        readyAt = 0;
+        Serve(fd);
+        close(fd);
+    }
+    return 0;
+}
+
+static uint64_t NowMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/*
+ * read until buf holds at least want bytes, no faster than -s allows.
+ * Returns false on EOF, error, idle timeout or shutdown.
+ */
+bool IngestWorker::Fill(int fd, size_t want)
+{
+    if (buf.size() < want) {
+        buf.resize(want);
+    }
+
+    unsigned rate = s_config.readRate;
+    unsigned idleMs = 0;
+    while (have < want) {
+        /* take whatever has arrived, up to the buffer's size. */
+        size_t n = buf.size() - have;
+        if (rate) {
+            /* at most a twentieth of a second's worth at a time. */
+            size_t chunk = rate / 20 ? rate / 20 : 1;
+            if (n > chunk) {
+                n = chunk;
+            }
+            uint64_t now = NowMicros();
+            if (readyAt > now) {
+                usleep(readyAt - now);
+            }
+        }
+
+        ssize_t got = recv(fd, &buf[have], n, 0);
+        if (got > 0) {
+            have += got;
+            idleMs = 0;
+            if (rate) {
+                uint64_t now = NowMicros();
+                readyAt = (readyAt > now ? readyAt : now) + got * 1000000ULL / rate;
+            }
+            continue;
+        }
+        if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+            return false;
+        }
+        idleMs += 100;
+        if (server.Stopping() || idleMs >= IDLE_TIMEOUT_MS) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool IngestWorker::Respond(int fd, int code, const char *reason, bool keepAlive)
+{
+    if (s_config.latencyMs || s_config.jitterMs) {
+        unsigned ms = s_config.latencyMs + (s_config.jitterMs ? Random() % (s_config.jitterMs + 1) : 0);
+        usleep(ms * 1000);
+    }
+
+    char response[160];
+    int len = snprintf(response, sizeof(response),
+            "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+            code, reason, keepAlive ? "keep-alive" : "close");
+    return send(fd, response, len, MSG_NOSIGNAL) == len;
+}
+
+/* find a header's value in the NUL-terminated head, or NULL. */
+static const char *FindHeader(const char *head, const char *name)
+{
+    size_t len = strlen(name);
+    for (const char *line = strstr(head, "\r\n"); line; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (0 == strncasecmp(line, name, len) && line[len] == ':') {
+            const char *value = line + len + 1;
+            while (*value == ' ' || *value == '\t') {
+                value++;
+            }
+            return value;
+        }
+    }
+    return NULL;
+}
+
+void IngestWorker::Serve(int fd)
+{
+    for (;;) {
+        /* read the request line and headers. */
+        size_t headLen = 0;
+        for (;;) {
+            for (size_t i = 3; i < have; i++) {
+                if (0 == memcmp(&buf[i - 3], "\r\n\r\n", 4)) {
+                    headLen = i + 1;
+                    break;
+                }
+            }
+            if (headLen) {
+                break;
+            }
+            if (have >= MAX_HEAD_BYTES) {
+                rejected++;
+                Respond(fd, 431, "Request Header Fields Too Large", false);
+                return;
+            }
+            /* Fill reads at least one more byte. */
+            if (!Fill(fd, have + 1)) {
+                return;
+            }
+        }
+
+        std::vector<char> head(buf.begin(), buf.begin() + headLen);
+        head.push_back('\0');
+        requests++;
+
+        bool keepAlive = NULL == strstr(&head[0], "HTTP/1.0");
+        const char *connection = FindHeader(&head[0], "Connection");
+        if (connection && 0 == strncasecmp(connection, "close", 5)) {
+            keepAlive = false;
+        }
+
+        const char *type = FindHeader(&head[0], "Content-Type");
+        const char *length = FindHeader(&head[0], "Content-Length");
+        const char *expect = FindHeader(&head[0], "Expect");
+
+        if (0 != strncmp(&head[0], "POST ", 5)) {
+            rejected++;
+            Respond(fd, 405, "Method Not Allowed", false);
+            return;
+        }
+        if (!type || 0 != strncasecmp(type, "application/x-protobuf", 22)) {
+            rejected++;
+            Respond(fd, 415, "Unsupported Media Type", false);
+            return;
+        }
+        if (!length) {
+            rejected++;
+            Respond(fd, 411, "Length Required", false);
+            return;
+        }
+        unsigned long bodyLen = strtoul(length, NULL, 10);
+        if (bodyLen > MAX_BODY_BYTES) {
+            rejected++;
+            Respond(fd, 413, "Payload Too Large", false);
+            return;
+        }
+
+        if (expect && 0 == strncasecmp(expect, "100-continue", 12)) {
+            static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            if (send(fd, cont, sizeof(cont) - 1, MSG_NOSIGNAL) != (ssize_t)(sizeof(cont) - 1)) {
+                return;
+            }
+        }
+
+        if (!Fill(fd, headLen + bodyLen)) {
+            return;
+        }
+
+        bool ok;
+        if (s_config.errorRate > 0 && (Random() % 1000000) < s_config.errorRate * 1000000) {
+            injected++;
+            ok = Respond(fd, 503, "Service Unavailable", keepAlive);
+        } else {
+            teDecodeSummary summary;
+            teDecodeErr err = te_decode_update(&buf[headLen], bodyLen, &summary);
+            if (TE_DECODE_OK == err) {
+                updates++;
+                events += summary.events;
+                bytes += bodyLen;
+                ok = Respond(fd, 200, "OK", keepAlive);
+            } else {
+                invalid++;
+                fprintf(stderr, "invalid %lu byte update: %s\n", bodyLen, te_decode_error(err));
+                ok = Respond(fd, 400, "Bad Request", keepAlive);
+            }
+        }
+        if (!ok || !keepAlive) {
+            return;
+        }
+
+        /* keep any pipelined bytes of the next request. */
+        size_t used = headLen + bodyLen;
+        memmove(&buf[0], &buf[used], have - used);
+        have -= used;
+    }
+}
+
+static void Usage(const char *argv0)
+{
+    printf("usage: %s [-p port] [-t threads] [-l ms[:jitter]] [-e rate] [-s bytes/s]\n"
+            "  -p  port to listen on (8080)\n"
+            "  -t  worker threads (8)\n"
+            "  -l  delay every response this many ms, plus up to jitter ms more\n"
+            "  -e  fraction of requests, 0 to 1, answered with 503\n"
+            "  -s  read request bodies no faster than this\n",
+            argv0);
+}
+
+static bool ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0') {
+            return false;
+        }
+        const char *value = argv[++i];
+        char *end;
+        switch (argv[i - 1][1]) {
+        case 'p':
+            s_config.port = strtoul(value, NULL, 10);
+            break;
+        case 't':
+            s_config.threads = strtoul(value, NULL, 10);
+            break;
+        case 'l':
+            s_config.latencyMs = strtoul(value, &end, 10);
+            if (*end == ':') {
+                s_config.jitterMs = strtoul(end + 1, NULL, 10);
+            }
+            break;
+        case 'e':
+            s_config.errorRate = strtod(value, NULL);
+            break;
+        case 's':
+            s_config.readRate = strtoul(value, NULL, 10);
+            break;
+        default:
+            return false;
+        }
+    }
+    return s_config.port > 0 && s_config.port < 65536 && s_config.threads > 0 &&
+           s_config.errorRate >= 0 && s_config.errorRate <= 1;
+}
+
+struct IngestTotals {
+    uint64_t requests, updates, events, bytes, invalid, injected, rejected;
+};
+
+static void Sum(IngestServer &server, IngestTotals &t)
+{
+    memset(&t, 0, sizeof(t));
+    for (size_t i = 0; i < server.workers.size(); i++) {
+        IngestWorker *w = server.workers[i];
+        t.requests += w->requests;
+        t.updates += w->updates;
+        t.events += w->events;
+        t.bytes += w->bytes;
+        t.invalid += w->invalid;
+        t.injected += w->injected;
+        t.rejected += w->rejected;
+    }
+}
+
+/** Main entry point */
+int main(int argc, char** argv)
+{
+    if (!ParseArgs(argc, argv)) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, SigIntHandler);
+    signal(SIGPIPE, SIG_IGN);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(s_config.port);
+    if (listener < 0 || bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(listener, 1024) < 0) {
+        printf("Failed to listen on port %u (%s)\n", s_config.port, strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    IngestServer server;
+    server.Start(s_config.threads);
+    printf("listening on http://localhost:%u/ with %u threads\n", s_config.port,
+            (unsigned)server.workers.size());
+
+    IngestTotals last;
+    memset(&last, 0, sizeof(last));
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t nextReport = ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000 + 1000;
+
+    while (!s_interrupt) {
+        struct pollfd pfd;
+        pfd.fd = listener;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 100) > 0) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0) {
+                server.Add(fd);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t now = ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+        if (now >= nextReport) {
+            IngestTotals t;
+            Sum(server, t);
+            if (t.requests != last.requests) {
+                printf("%llu requests/s, %llu updates/s, %llu events/s, %.2f MB/s, %llu invalid, %llu injected errors\n",
+                        (unsigned long long)(t.requests - last.requests),
+                        (unsigned long long)(t.updates - last.updates),
+                        (unsigned long long)(t.events - last.events),
+                        (t.bytes - last.bytes) / 1e6,
+                        (unsigned long long)(t.invalid - last.invalid),
+                        (unsigned long long)(t.injected - last.injected));
+            }
+            last = t;
+            nextReport += 1000;
+            if (nextReport <= now) {
+                nextReport = now + 1000;
+            }
+        }
+    }
+
+    close(listener);
+    IngestTotals t;
+    Sum(server, t);
+    server.Stop();
+
+    printf("\n%llu requests: %llu updates, %llu events, %llu bytes accepted; "
+            "%llu invalid, %llu injected errors, %llu rejected\n",
+            (unsigned long long)t.requests, (unsigned long long)t.updates,
+            (unsigned long long)t.events, (unsigned long long)t.bytes,
+            (unsigned long long)t.invalid, (unsigned long long)t.injected,
+            (unsigned long long)t.rejected);
+    return EXIT_SUCCESS;
+}
@@ -34,6 +34,8 @@
 #include <alljoyn/AllJoynStd.h>
 #include <alljoyn/Status.h>
 #include "Analytics.h"
+#include "AnalyticsClient.h"
+#include "AnalyticsDiscovery.h"
 #include "ECDHEKeyXListener.h"
 
 using namespace std;
@@ -64,6 +66,47 @@ class MySessionListener : public SessionListener {
     }
 };
 
+/*
+ * Receives the SubmitError signal, which reports failures of method
+ * calls made with ALLJOYN_FLAG_NO_REPLY_EXPECTED.
+ */
+class MySubmitErrorReceiver : public MessageReceiver {
+    public:
+        void SubmitError(const InterfaceDescription::Member *member,
+                const char *srcPath, Message &msg)
+        {
+            const char *name;
+            uint32_t sequence;
+            const char *errName;
+            const char *errMsg;
+            uint32_t suppressed;
+            if (ER_OK == msg->GetArgs("sussu", &name, &sequence, &errName, &errMsg, &suppressed)) {
+                printf("SubmitError for %s (sequence %u): %s (%s), %u more suppressed\n",
+                        name, sequence, errName, errMsg, suppressed);
+            }
+        }
+};
+
+static MySubmitErrorReceiver s_errorReceiver;
+
+/*
+ * Receives the Throttle signal.  A real client would batch more, slow
+ * down, or stop calling RequestDelivery as the level rises.
+ */
+class MyThrottleReceiver : public MessageReceiver {
+    public:
+        void Throttle(const InterfaceDescription::Member *member,
+                const char *srcPath, Message &msg)
+        {
+            uint32_t level;
+            if (ER_OK == msg->GetArgs("u", &level)) {
+                printf("Throttle: service load level is now %u\n", level);
+            }
+        }
+};
+
+static MyThrottleReceiver s_throttleReceiver;
+
 class MyAboutListener : public AboutListener {
     void Announced(const char* busName, uint16_t version, SessionPort port,
             const MsgArg& objectDescriptionArg, const MsgArg& aboutDataArg)
@@ -125,6 +168,10 @@ QStatus MakeMethodCalls(void)
     assert(alljoynTestIntf);
     remoteObj.AddInterface(*alljoynTestIntf);
 
+    const InterfaceDescription* statsIntf = g_msgBus->GetInterface(ANALYTICS_STATS_INTERFACE);
+    assert(statsIntf);
+    remoteObj.AddInterface(*statsIntf);
+
     Message reply(*g_msgBus);
 
     MsgArg args[5];
@@ -132,6 +179,14 @@ QStatus MakeMethodCalls(void)
     MsgArg variant;
     QStatus status;
 
+    MsgArg level;
+    status = remoteObj.GetProperty(INTERFACE_NAME, "LoadLevel", level);
+    if (ER_OK == status) {
+        uint32_t l = 0;
+        level.Get("u", &l);
+        printf("LoadLevel is %u\n", l);
+    }
+
     /*
      * call SetVendorData method.  It takes one parameter, an array of
      * string-variant pairs.  For tellient, this list must include
@@ -218,6 +273,197 @@ QStatus MakeMethodCalls(void)
         }
     }
 
+    /* send a batch of events in a single call. */
+
+    MsgArg records[3];
+    for (int i = 0; i < 3; i++) {
+        variant.Set("s", "shiny");
+        kv[0].Set("{sv}", "description", &variant);
+        kv[0].Stabilize();
+
+        variant.Set("i", 98 + i);
+        kv[1].Set("{sv}", "temperature", &variant);
+        kv[1].Stabilize();
+
+        records[i].Set("(stua{sv})", "fakeeventname", 0LL, sequence++, 2, kv);
+        records[i].Stabilize();
+    }
+    args[0].Set("a(stua{sv})", 3, records);
+
+    status = remoteObj.MethodCall(INTERFACE_NAME, "SubmitEvents", args, 1, reply, 5000);
+    if (ER_OK == status) {
+        size_t nfailures;
+        const MsgArg *failures;
+        reply->GetArg(0)->Get("a(uss)", &nfailures, &failures);
+        printf("SubmitEvents success (%u of 3 events rejected)\n", (unsigned)nfailures);
+        for (size_t i = 0; i < nfailures; i++) {
+            uint32_t index;
+            const char *errName;
+            failures[i].Get("(uss)", &index, &errName, &err);
+            printf("  event %u: %s (%s)\n", index, errName, err);
+        }
+    } else {
+        err = reply->GetErrorDescription().c_str();
+        printf("SubmitEvents failed with %s.\n", err);
+        return status;
+    }
+
+    /*
+     * register the layout of an event once, then send only its values.
+     * The types string holds one type code per key.
+     */
+
+    const char *schemaKeys[] = { "description", "temperature" };
+    args[0].Set("s", "fakeeventname");
+    args[1].Set("as", 2, schemaKeys);
+    args[2].Set("s", "si");
+
+    status = remoteObj.MethodCall(INTERFACE_NAME, "RegisterEventSchema", args, 3, reply, 5000);
+    uint32_t schemaId = 0;
+    if (ER_OK == status) {
+        reply->GetArg(0)->Get("u", &schemaId);
+        printf("RegisterEventSchema success (id %u)\n", schemaId);
+    } else {
+        err = reply->GetErrorDescription().c_str();
+        printf("RegisterEventSchema failed with %s.\n", err);
+        return status;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        MsgArg inner[2];
+        MsgArg values[2];
+        inner[0].Set("s", "shiny");
+        inner[1].Set("i", 98 + i);
+        values[0].Set("v", &inner[0]);
+        values[1].Set("v", &inner[1]);
+
+        args[0].Set("u", schemaId);
+        args[1].Set("t", 0LL);
+        args[2].Set("u", sequence++);
+        args[3].Set("av", 2, values);
+
+        status = remoteObj.MethodCall(INTERFACE_NAME, "SubmitCompactEvent", args, 4, reply, 5000);
+        if (ER_OK == status) {
+            printf("%s success\n", "SubmitCompactEvent");
+        } else {
+            err = reply->GetErrorDescription().c_str();
+            printf("SubmitCompactEvent failed with %s.\n", err);
+            return status;
+        }
+    }
+
+    /*
+     * send events without waiting for replies.  Failures, if any, arrive
+     * asynchronously through the SubmitError signal.
+     */
+
+    for (int i = 0; i < 3; i++) {
+        args[0].Set("s", "fakeeventname");
+        args[1].Set("t", 0LL);
+        args[2].Set("u", sequence++);
+
+        variant.Set("s", "shiny");
+        kv[0].Set("{sv}", "description", &variant);
+        kv[0].Stabilize();
+
+        variant.Set("i", 98);
+        kv[1].Set("{sv}", "temperature", &variant);
+        kv[1].Stabilize();
+
+        args[3].Set("a{sv}", 2, kv);
+
+        status = remoteObj.MethodCall(INTERFACE_NAME, "SubmitEvent", args, 4, ALLJOYN_FLAG_NO_REPLY_EXPECTED);
+        if (ER_OK != status) {
+            printf("SubmitEvent (no reply) failed with %s.\n", QCC_StatusText(status));
+            return status;
+        }
+    }
+    printf("SubmitEvent (no reply) sent\n");
+
+    /*
+     * the same through AnalyticsClient, which queues events and sends
+     * them in SubmitEvents batches from its own thread, so Submit never
+     * waits on the bus.  It resends the vendor and device data to every
+     * service it is given.  AnalyticsDiscovery gives it one: of all the
+     * services announcing the interface, the one this client hashes to,
+     * or its neighbour if that is less loaded, and another if the session
+     * is lost.
+     */
+
+    AnalyticsClient client(*g_msgBus, INTERFACE_NAME);
+    AnalyticsDiscovery discovery(*g_msgBus, client, INTERFACE_NAME);
+
+    variant.Set("i", 1337);
+    kv[0].Set("{sv}", "manufacturer_id", &variant);
+    kv[0].Stabilize();
+    variant.Set("s", "http://localhost/teupdate");
+    kv[1].Set("{sv}", "post_url", &variant);
+    kv[1].Stabilize();
+    variant.Set("s", "bass-o-matic");
+    kv[2].Set("{sv}", "model", &variant);
+    kv[2].Stabilize();
+    client.SetVendorData(3, kv);
+
+    variant.Set("s", "102");
+    kv[0].Set("{sv}", "modelVer", &variant);
+    kv[0].Stabilize();
+    client.SetDeviceData(1, kv);
+
+    status = client.Start();
+    if (ER_OK == status) {
+        status = discovery.Start();
+    }
+    if (ER_OK != status) {
+        printf("AnalyticsClient failed to start (%s).\n", QCC_StatusText(status));
+        return status;
+    }
+    /* not needed to submit; events wait in the client until there is a service. */
+    for (int i = 0; i < 50 && discovery.Current().empty(); i++) {
+        qcc::Sleep(100);
+    }
+    printf("AnalyticsClient: sending to %s of %u services\n",
+            discovery.Current().c_str(), (unsigned)discovery.Services());
+
+    /*
+     * a lone event, with no Flush(), must still go out once it has waited
+     * the flush time; allow a second more for the call.
+     */
+    if (!discovery.Current().empty()) {
+        variant.Set("i", 89);
+        kv[0].Set("{sv}", "temperature", &variant);
+        kv[0].Stabilize();
+        client.Submit("fakeeventname", 0, 1, kv);
+        qcc::Sleep(ANALYTICS_CLIENT_FLUSH_MS + 1000);
+
+        AnalyticsClient::Stats flushStats;
+        client.GetStats(flushStats);
+        if (flushStats.calls == 0) {
+            printf("AnalyticsClient: a single event was not sent after %u ms.\n",
+                    ANALYTICS_CLIENT_FLUSH_MS + 1000);
+            client.Stop();
+            discovery.Stop();
+            return ER_FAIL;
+        }
+        printf("AnalyticsClient: single event sent without Flush\n");
+    }
+
+    for (int i = 0; i < 100; i++) {
+        variant.Set("i", 90 + i % 10);
+        kv[0].Set("{sv}", "temperature", &variant);
+        kv[0].Stabilize();
+        client.Submit("fakeeventname", 0, 1, kv);
+    }
+    client.Flush();
+    client.WaitIdle(5000);
+    client.Stop();
+    discovery.Stop();
+
+    AnalyticsClient::Stats clientStats;
+    client.GetStats(clientStats);
+    printf("AnalyticsClient: %llu events accepted, %llu rejected, %llu failed in %llu calls\n",
+            (unsigned long long)clientStats.accepted, (unsigned long long)clientStats.rejected,
+            (unsigned long long)clientStats.failed, (unsigned long long)clientStats.calls);
+
     /* request submission to service. */
 
     status = remoteObj.MethodCall(INTERFACE_NAME, "RequestDelivery", args, 0, reply, 5000);
@@ -230,6 +476,49 @@ QStatus MakeMethodCalls(void)
         return status;
     }
 
+    /* read the service's heavy hitters. */
+    status = remoteObj.MethodCall(ANALYTICS_STATS_INTERFACE, "GetSketches", NULL, 0, reply, 5000);
+    if (ER_OK == status) {
+        size_t n;
+        MsgArg *top;
+        reply->GetArg(0)->Get("a(stt)", &n, &top);
+        for (size_t i = 0; i < n; i++) {
+            const char *name;
+            uint64_t count, error;
+            top[i].Get("(stt)", &name, &count, &error);
+            printf("top event %s: %llu (+%llu)\n", name,
+                    (unsigned long long)count, (unsigned long long)error);
+        }
+        reply->GetArg(2)->Get("a(st)", &n, &top);
+        for (size_t i = 0; i < n; i++) {
+            const char *key;
+            uint64_t distinct;
+            top[i].Get("(st)", &key, &distinct);
+            printf("key %s: ~%llu distinct values\n", key, (unsigned long long)distinct);
+        }
+    } else {
+        err = reply->GetErrorDescription().c_str();
+        printf("GetSketches failed with %s.\n", err);
+        return status;
+    }
+
+    status = remoteObj.MethodCall(ANALYTICS_STATS_INTERFACE, "GetStats", NULL, 0, reply, 5000);
+    if (ER_OK == status) {
+        uint64_t events = 0, encoded = 0, buffered = 0;
+        double rate = 0;
+        const MsgArg *stats = reply->GetArg(0);
+        stats->GetElement("{st}", "events", &events);
+        stats->GetElement("{sd}", "eventsPerSec", &rate);
+        stats->GetElement("{st}", "bytesEncoded", &encoded);
+        stats->GetElement("{st}", "bufferedBytes", &buffered);
+        printf("service: %llu events (%.1f/s), %llu bytes encoded, %llu bytes buffered\n",
+                (unsigned long long)events, rate, (unsigned long long)encoded,
+                (unsigned long long)buffered);
+    } else {
+        err = reply->GetErrorDescription().c_str();
+        printf("GetStats failed with %s.\n", err);
+        return status;
+    }
 
     return ER_OK;
 }
@@ -273,6 +562,29 @@ int main(int argc, char** argv, char** envArg)
         return EXIT_FAILURE;
     }
 
+    status = AnalyticsBusObject::CreateStatsInterface(bus);
+    if (ER_OK != status) {
+        printf("Failed to create stats interface (%s)\n", QCC_StatusText(status));
+        return EXIT_FAILURE;
+    }
+
+    const InterfaceDescription* iface = bus.GetInterface(INTERFACE_NAME);
+    status = bus.RegisterSignalHandler(&s_errorReceiver,
+            static_cast<MessageReceiver::SignalHandler>(&MySubmitErrorReceiver::SubmitError),
+            iface->GetMember("SubmitError"), NULL);
+    if (ER_OK != status) {
+        printf("Failed to register SubmitError handler (%s)\n", QCC_StatusText(status));
+        return EXIT_FAILURE;
+    }
+
+    status = bus.RegisterSignalHandler(&s_throttleReceiver,
+            static_cast<MessageReceiver::SignalHandler>(&MyThrottleReceiver::Throttle),
+            iface->GetMember("Throttle"), NULL);
+    if (ER_OK != status) {
+        printf("Failed to register Throttle handler (%s)\n", QCC_StatusText(status));
+        return EXIT_FAILURE;
+    }
+
     MyAboutListener aboutListener;
     bus.RegisterAboutListener(aboutListener);
 
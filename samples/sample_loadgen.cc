@@ -0,0 +1,709 @@
+/**
+ * @file
+ * @brief  Multi-device load generator for the analytics service
+ */
+
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Simulates many devices submitting events to sample_service, to find
+ * how far one service scales.  Each device has its own BusAttachment,
+ * and therefore its own unique name and device object in the service,
+ * and runs on its own thread:
+ *
+ *   connect, join a session, SetVendorData, SetDeviceData, then call
+ *   SubmitEvent at a steady rate, with optional bursts, until the run
+ *   ends or its lifetime (with -c) is up; then disconnect and start
+ *   over as a new device.
+ *
+ * With -s, the load is spread over that many sharded services (see
+ * sample_service -s): each device joins the shard that owns it.
+ *
+ * Devices connect before the clock starts.  Once a second, and at the
+ * end of the run, events/sec, SubmitEvent latency percentiles and error
+ * counts are printed.
+ */
+
+#include <qcc/platform.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <map>
+#include <vector>
+
+#include <qcc/Mutex.h>
+#include <qcc/String.h>
+#include <qcc/Thread.h>
+
+#include <alljoyn/BusAttachment.h>
+#include <alljoyn/version.h>
+#include <alljoyn/AllJoynStd.h>
+#include <alljoyn/Status.h>
+#include "Analytics.h"
+#include "AnalyticsHashRing.h"
+#include "AnalyticsStats.h"
+#include "ECDHEKeyXListener.h"
+
+using namespace qcc;
+using namespace ajn;
+
+static const char* INTERFACE_NAME = "org.allseen.Analytics.AnalyticsEventAgent";
+static const char* SERVICE_PATH = "/analytics/example";
+
+/* a device reconnects after this many consecutive failed calls. */
+#define MAX_CONSECUTIVE_ERRORS 10
+
+#define MAX_KEYS 32
+
+static volatile sig_atomic_t s_interrupt = false;
+
+static void SigIntHandler(int sig)
+{
+    s_interrupt = true;
+}
+
+/* load parameters, set from the command line. */
+struct LoadConfig {
+    unsigned devices;
+    double rate;            /* events per second per device, 0 for unpaced */
+    unsigned keys;
+    const char *mix;        /* string, int, double or mixed */
+    unsigned names;         /* distinct event names */
+    unsigned burstEvents;   /* extra events sent back to back ... */
+    double burstSeconds;    /* ... this often */
+    double churnSeconds;    /* average device lifetime, 0 for no churn */
+    unsigned seconds;       /* length of the run */
+    const char *postUrl;
+    unsigned shards;        /* sharded services to wait for, 0 for one service */
+
+    LoadConfig() :
+        devices(10), rate(10), keys(4), mix("mixed"), names(4),
+        burstEvents(0), burstSeconds(0), churnSeconds(0), seconds(30),
+        postUrl("http://localhost/teupdate"), shards(0)
+    {
+    }
+};
+
+static LoadConfig s_config;
+
+/* the service found by About. */
+static qcc::String s_serviceName;
+static SessionPort s_servicePort;
+static volatile bool s_found = false;
+
+/* with -s, the shards found by About, by shard name, on the ring the shards build. */
+struct Shard {
+    qcc::String busName;
+    SessionPort port;
+};
+static qcc::Mutex s_shardsLock;
+static std::map<qcc::String, Shard> s_shards;
+static AnalyticsHashRing s_ring;
+
+/* set once every device has made its first connection. */
+static volatile bool s_go = false;
+static volatile bool s_stop = false;
+
+static void SleepMicros(uint64_t us)
+{
+#ifdef _WIN32
+    Sleep((DWORD)(us / 1000));
+#else
+    usleep((useconds_t)us);
+#endif
+}
+
+class LoadDevice : public qcc::Thread {
+    public:
+        LoadDevice(unsigned index) :
+            qcc::Thread("LoadDevice"),
+            index(index),
+            bus(NULL),
+            remoteObj(NULL),
+            sessionId(0),
+            seed(index * 2654435761u + 1),
+            connected(false),
+            firstConnect(false),
+            sequence(0),
+            events(0),
+            errors(0),
+            timeouts(0),
+            connects(0),
+            connectFailures(0)
+        {
+        }
+
+        ~LoadDevice()
+        {
+            Disconnect();
+        }
+
+        /* counters since the last Collect(). */
+        struct Counts {
+            uint64_t events;
+            uint64_t errors;
+            uint64_t timeouts;
+            uint64_t connects;
+            uint64_t connectFailures;
+        };
+
+        /* add and clear the counts and latencies since the last call. */
+        void Collect(Counts &counts, AnalyticsHistogram &latency)
+        {
+            lock.Lock();
+            counts.events += events;
+            counts.errors += errors;
+            counts.timeouts += timeouts;
+            counts.connects += connects;
+            counts.connectFailures += connectFailures;
+            events = errors = timeouts = connects = connectFailures = 0;
+            latency.Merge(interval);
+            interval.Clear();
+            lock.Unlock();
+        }
+
+        bool IsConnected() const { return connected; }
+        bool TriedFirstConnect() const { return firstConnect; }
+
+    protected:
+        virtual qcc::ThreadReturn STDCALL Run(void *arg);
+
+    private:
+        bool Connect();
+        void Disconnect();
+        QStatus Call(const char *method, const MsgArg *args, size_t nargs);
+        void MakeEvent(MsgArg *args, MsgArg *kv, MsgArg *values);
+
+        uint32_t Random()
+        {
+            seed = seed * 1103515245u + 12345u;
+            return seed >> 8;
+        }
+
+        unsigned index;
+        BusAttachment *bus;
+        ECDHEKeyXListener authListener;
+        ProxyBusObject *remoteObj;
+        SessionId sessionId;
+        uint32_t seed;
+        volatile bool connected;
+        volatile bool firstConnect;
+        uint32_t sequence;
+
+        /* guards the counters and histogram below, read by Collect(). */
+        qcc::Mutex lock;
+        uint64_t events;
+        uint64_t errors;
+        uint64_t timeouts;
+        uint64_t connects;
+        uint64_t connectFailures;
+        AnalyticsHistogram interval;
+};
+
+bool LoadDevice::Connect()
+{
+    bus = new BusAttachment("Analytics Load Device", true);
+
+    QStatus status = bus->Start();
+    if (ER_OK == status) {
+        status = bus->EnablePeerSecurity("ALLJOYN_ECDHE_PSK", &authListener);
+    }
+    if (ER_OK == status) {
+        status = bus->Connect();
+    }
+    if (ER_OK == status) {
+        status = AnalyticsBusObject::CreateInterface(*bus, INTERFACE_NAME);
+    }
+    qcc::String serviceName = s_serviceName;
+    SessionPort servicePort = s_servicePort;
+    if (ER_OK == status && s_config.shards) {
+        /* the shards own devices by unique name. */
+        s_shardsLock.Lock();
+        const Shard &shard = s_shards[s_ring.Owner(bus->GetUniqueName().c_str())];
+        serviceName = shard.busName;
+        servicePort = shard.port;
+        s_shardsLock.Unlock();
+    }
+    if (ER_OK == status) {
+        SessionOpts opts(SessionOpts::TRAFFIC_MESSAGES, false, SessionOpts::PROXIMITY_ANY, TRANSPORT_ANY);
+        status = bus->JoinSession(serviceName.c_str(), servicePort, NULL, sessionId, opts);
+    }
+    if (ER_OK == status) {
+        remoteObj = new ProxyBusObject(*bus, serviceName.c_str(), SERVICE_PATH, sessionId);
+        remoteObj->AddInterface(*bus->GetInterface(INTERFACE_NAME));
+
+        MsgArg args[1];
+        MsgArg kv[3];
+        MsgArg variant[3];
+        variant[0].Set("i", 1337);
+        kv[0].Set("{sv}", "manufacturer_id", &variant[0]);
+        variant[1].Set("s", s_config.postUrl);
+        kv[1].Set("{sv}", "post_url", &variant[1]);
+        variant[2].Set("s", "load-o-matic");
+        kv[2].Set("{sv}", "model", &variant[2]);
+        args[0].Set("a{sv}", 3, kv);
+        status = Call("SetVendorData", args, 1);
+
+        if (ER_OK == status) {
+            char serial[16];
+            snprintf(serial, sizeof(serial), "%u", index);
+            variant[0].Set("s", "102");
+            kv[0].Set("{sv}", "modelVer", &variant[0]);
+            variant[1].Set("s", serial);
+            kv[1].Set("{sv}", "serial", &variant[1]);
+            args[0].Set("a{sv}", 2, kv);
+            status = Call("SetDeviceData", args, 1);
+        }
+    }
+
+    lock.Lock();
+    if (ER_OK == status) {
+        connects++;
+    } else {
+        connectFailures++;
+    }
+    lock.Unlock();
+
+    if (ER_OK != status) {
+        printf("device %u: connect failed (%s)\n", index, QCC_StatusText(status));
+        Disconnect();
+        return false;
+    }
+    connected = true;
+    return true;
+}
+
+void LoadDevice::Disconnect()
+{
+    connected = false;
+    delete remoteObj;
+    remoteObj = NULL;
+    if (bus) {
+        if (sessionId) {
+            bus->LeaveSession(sessionId);
+            sessionId = 0;
+        }
+        bus->Disconnect();
+        bus->Stop();
+        bus->Join();
+        delete bus;
+        bus = NULL;
+    }
+}
+
+QStatus LoadDevice::Call(const char *method, const MsgArg *args, size_t nargs)
+{
+    Message reply(*bus);
+    return remoteObj->MethodCall(INTERFACE_NAME, method, args, nargs, reply, 5000);
+}
+
+/* fill args with a SubmitEvent call, using kv and values as storage. */
+void LoadDevice::MakeEvent(MsgArg *args, MsgArg *kv, MsgArg *values)
+{
+    static const char *const words[] = {
+        "temperature", "state", "firmware", "battery", "signal", "mode", "error", "duration"
+    };
+    /* of every four keys, this many are strings, integers and doubles. */
+    unsigned strings = 1, ints = 2;
+    if (0 == strcmp(s_config.mix, "string")) {
+        strings = 3;
+        ints = 1;
+    } else if (0 == strcmp(s_config.mix, "int")) {
+        strings = 0;
+        ints = 3;
+    } else if (0 == strcmp(s_config.mix, "double")) {
+        strings = 1;
+        ints = 0;
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "load_event_%u", Random() % s_config.names);
+
+    for (unsigned i = 0; i < s_config.keys; i++) {
+        unsigned slot = i % 4;
+        if (slot < strings) {
+            /* a few distinct values per key, as device states would have. */
+            static const char *const states[] = { "idle", "running", "paused", "error-recovery" };
+            values[i].Set("s", states[Random() % 4]);
+        } else if (slot < strings + ints) {
+            values[i].Set("i", (int32_t)(Random() % 1000));
+        } else {
+            values[i].Set("d", (Random() % 100000) / 100.0);
+        }
+        kv[i].Set("{sv}", words[i % 8], &values[i]);
+        kv[i].Stabilize();
+    }
+
+    args[0].Set("s", name);
+    args[0].Stabilize();
+    args[1].Set("t", (uint64_t)0);
+    args[2].Set("u", sequence++);
+    args[3].Set("a{sv}", (size_t)s_config.keys, kv);
+}
+
+qcc::ThreadReturn STDCALL LoadDevice::Run(void *arg)
+{
+    while (!s_stop) {
+        bool ok = Connect();
+        firstConnect = true;
+        if (!ok) {
+            /* back off before trying again. */
+            SleepMicros(1000000);
+            continue;
+        }
+
+        while (!s_go && !s_stop) {
+            SleepMicros(10000);
+        }
+
+        uint64_t now = AnalyticsStats::NowMicros();
+        uint64_t period = s_config.rate > 0 ? (uint64_t)(1e6 / s_config.rate) : 0;
+        uint64_t next = now;
+        uint64_t nextBurst = s_config.burstEvents ? now + (uint64_t)(s_config.burstSeconds * 1e6) : 0;
+        uint64_t end = 0;
+        if (s_config.churnSeconds > 0) {
+            /* lifetimes spread from half to one and a half times the average. */
+            end = now + (uint64_t)(s_config.churnSeconds * 1e6 * (500 + Random() % 1000) / 1000);
+        }
+        unsigned burst = 0;
+        unsigned consecutiveErrors = 0;
+
+        MsgArg args[4];
+        MsgArg kv[MAX_KEYS];
+        MsgArg values[MAX_KEYS];
+
+        while (!s_stop) {
+            now = AnalyticsStats::NowMicros();
+            if (end && now >= end) {
+                break;
+            }
+            if (nextBurst && now >= nextBurst) {
+                burst += s_config.burstEvents;
+                nextBurst += (uint64_t)(s_config.burstSeconds * 1e6);
+            }
+            if (burst) {
+                burst--;
+            } else if (period) {
+                if (now < next) {
+                    uint64_t wait = next - now;
+                    SleepMicros(wait < 100000 ? wait : 100000);
+                    continue;
+                }
+                next += period;
+                /* a device that fell far behind does not try to catch up. */
+                if (next + 1000000 < now) {
+                    next = now;
+                }
+            }
+
+            MakeEvent(args, kv, values);
+
+            uint64_t start = AnalyticsStats::NowMicros();
+            QStatus status = Call("SubmitEvent", args, 4);
+            uint64_t latency = AnalyticsStats::NowMicros() - start;
+
+            lock.Lock();
+            if (ER_OK == status) {
+                events++;
+                interval.Record(latency);
+            } else {
+                errors++;
+                if (ER_TIMEOUT == status) {
+                    timeouts++;
+                }
+            }
+            lock.Unlock();
+
+            consecutiveErrors = ER_OK == status ? 0 : consecutiveErrors + 1;
+            if (consecutiveErrors >= MAX_CONSECUTIVE_ERRORS) {
+                printf("device %u: %u failed calls in a row (%s), reconnecting\n",
+                        index, consecutiveErrors, QCC_StatusText(status));
+                break;
+            }
+        }
+
+        Disconnect();
+    }
+    return 0;
+}
+
+class MyAboutListener : public AboutListener {
+    void Announced(const char* busName, uint16_t version, SessionPort port,
+            const MsgArg& objectDescriptionArg, const MsgArg& aboutDataArg)
+    {
+        AboutObjectDescription aod(objectDescriptionArg);
+        if (!aod.HasInterface(SERVICE_PATH, INTERFACE_NAME)) {
+            return;
+        }
+        if (!s_config.shards) {
+            if (!s_found) {
+                s_serviceName = busName;
+                s_servicePort = port;
+                s_found = true;
+            }
+            return;
+        }
+
+        MsgArg *value;
+        const char *name;
+        uint32_t capacity = 1;
+        if (ER_OK != aboutDataArg.GetElement("{sv}", ANALYTICS_ABOUT_SHARD, &value) ||
+                ER_OK != value->Get("s", &name)) {
+            return;
+        }
+        if (ER_OK == aboutDataArg.GetElement("{sv}", ANALYTICS_ABOUT_CAPACITY, &value)) {
+            value->Get("u", &capacity);
+        }
+
+        s_shardsLock.Lock();
+        Shard &shard = s_shards[name];
+        shard.busName = busName;
+        shard.port = port;
+        s_ring.Add(name, capacity);
+        if (s_ring.Size() >= s_config.shards) {
+            s_found = true;
+        }
+        s_shardsLock.Unlock();
+    }
+};
+
+static void Usage(const char *argv0)
+{
+    printf("usage: %s [-n devices] [-r events/s] [-k keys] [-m string|int|double|mixed]\n"
+            "    [-e names] [-b events:seconds] [-c seconds] [-t seconds] [-u post_url] [-s shards]\n"
+            "  -n  devices to simulate, each with its own bus attachment (10)\n"
+            "  -r  events per second per device, 0 for as fast as replies allow (10)\n"
+            "  -k  keys per event, 1 to %u (4)\n"
+            "  -m  mostly string, int or double values, or a mix (mixed)\n"
+            "  -e  distinct event names (4)\n"
+            "  -b  each device also sends this many events back to back this often\n"
+            "  -c  devices disconnect and come back as new devices after this long\n"
+            "      on average\n"
+            "  -t  length of the run (30)\n"
+            "  -u  post_url given in SetVendorData (http://localhost/teupdate)\n"
+            "  -s  wait for this many sharded services and send each device to\n"
+            "      the shard owning it\n",
+            argv0, MAX_KEYS);
+}
+
+static bool ParseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0') {
+            return false;
+        }
+        const char *value = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'n':
+            s_config.devices = strtoul(value, NULL, 10);
+            break;
+        case 'r':
+            s_config.rate = strtod(value, NULL);
+            break;
+        case 'k':
+            s_config.keys = strtoul(value, NULL, 10);
+            break;
+        case 'm':
+            s_config.mix = value;
+            break;
+        case 'e':
+            s_config.names = strtoul(value, NULL, 10);
+            break;
+        case 'b': {
+                char *colon;
+                s_config.burstEvents = strtoul(value, &colon, 10);
+                if (*colon != ':') {
+                    return false;
+                }
+                s_config.burstSeconds = strtod(colon + 1, NULL);
+                break;
+            }
+        case 'c':
+            s_config.churnSeconds = strtod(value, NULL);
+            break;
+        case 't':
+            s_config.seconds = strtoul(value, NULL, 10);
+            break;
+        case 'u':
+            s_config.postUrl = value;
+            break;
+        case 's':
+            s_config.shards = strtoul(value, NULL, 10);
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return s_config.devices > 0 && s_config.keys > 0 && s_config.keys <= MAX_KEYS &&
+           s_config.names > 0 && s_config.rate >= 0 && s_config.seconds > 0 &&
+           (s_config.burstEvents == 0 || s_config.burstSeconds > 0) &&
+           (0 == strcmp(s_config.mix, "string") || 0 == strcmp(s_config.mix, "int") ||
+            0 == strcmp(s_config.mix, "double") || 0 == strcmp(s_config.mix, "mixed"));
+}
+
+static void PrintLatency(const AnalyticsHistogram &latency)
+{
+    printf("p50 %llu us, p90 %llu us, p99 %llu us, p99.9 %llu us, max %llu us",
+            (unsigned long long)latency.Percentile(0.5),
+            (unsigned long long)latency.Percentile(0.9),
+            (unsigned long long)latency.Percentile(0.99),
+            (unsigned long long)latency.Percentile(0.999),
+            (unsigned long long)latency.Max());
+}
+
+/** Main entry point */
+int main(int argc, char** argv, char** envArg)
+{
+    if (!ParseArgs(argc, argv)) {
+        Usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, SigIntHandler);
+
+    /* find the service with a bus attachment of our own; devices connect separately. */
+    BusAttachment bus("Analytics Load Generator", true);
+    QStatus status = bus.Start();
+    if (ER_OK == status) {
+        status = bus.Connect();
+    }
+    if (ER_OK != status) {
+        printf("Failed to connect to router (%s)\n", QCC_StatusText(status));
+        return EXIT_FAILURE;
+    }
+
+    MyAboutListener aboutListener;
+    bus.RegisterAboutListener(aboutListener);
+    const char* interfaces[] = { INTERFACE_NAME };
+    status = bus.WhoImplements(interfaces, sizeof(interfaces) / sizeof(interfaces[0]));
+    if (ER_OK != status) {
+        printf("WhoImplements call FAILED with status %s\n", QCC_StatusText(status));
+        return EXIT_FAILURE;
+    }
+    while (!s_found && !s_interrupt) {
+        SleepMicros(100000);
+    }
+    if (s_interrupt) {
+        return EXIT_FAILURE;
+    }
+    if (s_config.shards) {
+        s_shardsLock.Lock();
+        printf("found %u shards; connecting %u devices\n", (unsigned)s_ring.Size(), s_config.devices);
+        s_shardsLock.Unlock();
+    } else {
+        printf("found service %s; connecting %u devices\n", s_serviceName.c_str(), s_config.devices);
+    }
+
+    std::vector<LoadDevice *> devices;
+    for (unsigned i = 0; i < s_config.devices; i++) {
+        LoadDevice *device = new LoadDevice(i);
+        if (ER_OK != device->Start()) {
+            printf("Failed to start device thread %u\n", i);
+            delete device;
+            break;
+        }
+        devices.push_back(device);
+    }
+
+    /* wait for every device's first connection attempt before timing. */
+    uint64_t connectStart = AnalyticsStats::NowMicros();
+    for (;;) {
+        unsigned tried = 0, connected = 0;
+        for (size_t i = 0; i < devices.size(); i++) {
+            tried += devices[i]->TriedFirstConnect() ? 1 : 0;
+            connected += devices[i]->IsConnected() ? 1 : 0;
+        }
+        if (tried == devices.size() || s_interrupt) {
+            printf("%u of %u devices connected in %.1f s\n", connected, (unsigned)devices.size(),
+                    (AnalyticsStats::NowMicros() - connectStart) / 1e6);
+            break;
+        }
+        SleepMicros(100000);
+    }
+
+    LoadDevice::Counts total = { 0, 0, 0, 0, 0 };
+    AnalyticsHistogram totalLatency;
+
+    /* connections made so far are setup, not churn. */
+    for (size_t i = 0; i < devices.size(); i++) {
+        AnalyticsHistogram unused;
+        devices[i]->Collect(total, unused);
+    }
+    total.connects = total.connectFailures = 0;
+
+    s_go = true;
+    uint64_t start = AnalyticsStats::NowMicros();
+    uint64_t last = start;
+
+    for (unsigned second = 1; second <= s_config.seconds && !s_interrupt; second++) {
+        uint64_t wake = start + second * 1000000ULL;
+        uint64_t now = AnalyticsStats::NowMicros();
+        while (now < wake && !s_interrupt) {
+            SleepMicros(wake - now < 100000 ? wake - now : 100000);
+            now = AnalyticsStats::NowMicros();
+        }
+
+        LoadDevice::Counts counts = { 0, 0, 0, 0, 0 };
+        AnalyticsHistogram latency;
+        unsigned connected = 0;
+        for (size_t i = 0; i < devices.size(); i++) {
+            devices[i]->Collect(counts, latency);
+            connected += devices[i]->IsConnected() ? 1 : 0;
+        }
+
+        double elapsed = (now - last) / 1e6;
+        last = now;
+        printf("%4u s: %u devices, %.0f events/s, %llu errors, ", second, connected,
+                counts.events / elapsed, (unsigned long long)counts.errors);
+        PrintLatency(latency);
+        printf("\n");
+
+        total.events += counts.events;
+        total.errors += counts.errors;
+        total.timeouts += counts.timeouts;
+        total.connects += counts.connects;
+        total.connectFailures += counts.connectFailures;
+        totalLatency.Merge(latency);
+    }
+
+    double elapsed = (last - start) / 1e6;
+    s_stop = true;
+    for (size_t i = 0; i < devices.size(); i++) {
+        devices[i]->Join();
+        delete devices[i];
+    }
+
+    uint64_t calls = total.events + total.errors;
+    printf("\n%u devices, %.1f s: %llu events, %.1f events/s sustained\n",
+            (unsigned)devices.size(), elapsed, (unsigned long long)total.events,
+            elapsed > 0 ? total.events / elapsed : 0.0);
+    printf("errors: %llu of %llu calls (%.3f%%), %llu timeouts\n",
+            (unsigned long long)total.errors, (unsigned long long)calls,
+            calls ? 100.0 * total.errors / calls : 0.0, (unsigned long long)total.timeouts);
+    printf("churn: %llu reconnects, %llu failed connects\n",
+            (unsigned long long)total.connects, (unsigned long long)total.connectFailures);
+    printf("SubmitEvent latency: ");
+    PrintLatency(totalLatency);
+    printf("\n");
+
+    return EXIT_SUCCESS;
+}
@@ -20,6 +20,8 @@
  ******************************************************************************/
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <vector>
 
 #include <qcc/platform.h>
@@ -28,6 +30,8 @@
 #include <alljoyn/BusObject.h>
 #include <alljoyn/AboutObj.h>
 #include "TellientAnalytics.h"
+#include "AnalyticsShards.h"
+#include "AnalyticsTrace.h"
 #include "ECDHEKeyXListener.h"
 
 using namespace std;
@@ -61,6 +65,12 @@ static const ajn::SessionPort ASSIGNED_SERVICE_PORT = 900;
 
 static const qcc::String DEFAULT_LANGUAGE = "en";
 
+/* devices with no method calls for this long are flushed and compacted. */
+static const uint32_t IDLE_COMPACT_MS = 5 * 60 * 1000;
+
+/* how often to print device memory use. */
+static const uint32_t STATS_INTERVAL_MS = 60 * 1000;
+
 static volatile sig_atomic_t s_interrupt = false;
 
 static void SigIntHandler(int sig)
@@ -68,14 +78,51 @@ static void SigIntHandler(int sig)
     s_interrupt = true;
 }
 
+#ifdef ANALYTICS_TRACING
+/* SIGUSR1 asks for a trace dump, written from the main loop. */
+static volatile sig_atomic_t s_dumpTrace = false;
+
+static void SigUsr1Handler(int sig)
+{
+    s_dumpTrace = true;
+}
+
+static void DumpTrace()
+{
+    static unsigned dumps = 0;
+    char path[64];
+    snprintf(path, sizeof(path), "analytics-trace-%d-%u.json", (int)getpid(), dumps++);
+    if (AnalyticsTrace::Dump(path)) {
+        printf("trace written to %s\n", path);
+    } else {
+        printf("failed to write trace to %s\n", path);
+    }
+}
+#endif
+
 class MySessionPortListener : public SessionPortListener {
     public:
+        MySessionPortListener() : analytics(NULL), shards(NULL) {}
+
+        /* told about every session, so device objects follow session membership. */
+        AnalyticsBusObject *analytics;
+
+        /* with -s, the devices this shard takes. */
+        AnalyticsShards *shards;
+
         bool AcceptSessionJoiner(ajn::SessionPort sessionPort, const char* joiner, const ajn::SessionOpts& opts)
         {
             if (sessionPort != ASSIGNED_SERVICE_PORT) {
                 printf("Rejecting join attempt on unexpected session port %d.\n", sessionPort);
                 return false;
             }
+            qcc::String owner;
+            if (shards && !shards->Owns(joiner, &owner)) {
+                /* the joiner's AnalyticsDiscovery moves on to the next shard. */
+                printf("Rejecting join session request from %s, which belongs to shard %s.\n",
+                        joiner, owner.c_str());
+                return false;
+            }
             printf("Accepting join session request from %s (opts.proximity=%x, opts.traffic=%x, opts.transports=%x).\n",
                     joiner, opts.proximity, opts.traffic, opts.transports);
             return true;
@@ -83,6 +130,44 @@ class MySessionPortListener : public SessionPortListener {
         void SessionJoined(SessionPort sessionPort, SessionId id, const char* joiner)
         {
             printf("Session Joined SessionId = %u\n", id);
+            if (analytics) {
+                analytics->SessionJoined(id, joiner);
+            }
+        }
+};
+
+/*
+ * About data carrying the service's load level, and with -s its shard
+ * name and capacity, so that clients choosing between services, such as
+ * AnalyticsDiscovery, need not join each.
+ */
+class AnalyticsAboutData : public AboutData {
+    public:
+        AnalyticsAboutData(const char *language) : AboutData(language)
+        {
+            SetNewFieldDetails(ANALYTICS_ABOUT_LOAD_LEVEL, ANNOUNCED, "u");
+            SetNewFieldDetails(ANALYTICS_ABOUT_SHARD, ANNOUNCED, "s");
+            SetNewFieldDetails(ANALYTICS_ABOUT_CAPACITY, ANNOUNCED, "u");
+            SetLoadLevel(ANALYTICS_LOAD_NORMAL);
+        }
+
+        QStatus SetShard(const char *shard, uint32_t capacity)
+        {
+            MsgArg arg;
+            arg.Set("s", shard);
+            QStatus status = SetField(ANALYTICS_ABOUT_SHARD, arg);
+            if (ER_OK == status) {
+                arg.Set("u", capacity);
+                status = SetField(ANALYTICS_ABOUT_CAPACITY, arg);
+            }
+            return status;
+        }
+
+        QStatus SetLoadLevel(uint32_t level)
+        {
+            MsgArg arg;
+            arg.Set("u", level);
+            return SetField(ANALYTICS_ABOUT_LOAD_LEVEL, arg);
         }
 };
 
@@ -146,16 +231,90 @@ static QStatus FillAboutPropertyStoreImplData(AboutData& aboutData)
     return status;
 }
 
-/** Wait for SIGINT before continuing. */
-void WaitForSigInt(void)
+/**
+ * Compact idle devices, announce load level changes and report memory use
+ * until SIGINT.
+ */
+void RunUntilSigInt(AnalyticsBusObject &analytics, AnalyticsDevicePool &pool,
+        AboutObj &aboutObj, AnalyticsAboutData &aboutData)
 {
+    uint32_t elapsed = 0;
+
     while (s_interrupt == false) {
 #ifdef _WIN32
         Sleep(100);
 #else
         usleep(100 * 1000);
 #endif
+        elapsed += 100;
+#ifdef ANALYTICS_TRACING
+        if (s_dumpTrace) {
+            s_dumpTrace = false;
+            DumpTrace();
+        }
+#endif
+        if (elapsed % 1000 == 0) {
+            analytics.CompactIdle(IDLE_COMPACT_MS);
+
+            AnalyticsBusObject::LoadStats load;
+            uint32_t level = analytics.GetLoadLevel();
+            if (analytics.UpdateLoad(&load) != level) {
+                printf("load level %u (load %u%%: %llu bytes buffered, %u updates awaiting delivery, %u ms latency)\n",
+                        load.level, load.load, (unsigned long long)load.bufferedBytes,
+                        load.deliveryBacklog, load.latencyMs);
+                aboutData.SetLoadLevel(load.level);
+                aboutObj.Announce(ASSIGNED_SERVICE_PORT, aboutData);
+            }
+        }
+        if (elapsed >= STATS_INTERVAL_MS) {
+            AnalyticsBusObject::MemoryStats stats;
+            analytics.GetMemoryStats(stats);
+            printf("devices: %u (%u idle), %llu bytes, %llu bytes avg, %u bytes max, %u pooled\n",
+                    stats.devices, stats.idleDevices,
+                    (unsigned long long)stats.totalBytes,
+                    (unsigned long long)(stats.devices ? stats.totalBytes / stats.devices : 0),
+                    stats.maxBytes, (unsigned)pool.Pooled());
+            elapsed = 0;
+        }
+    }
+}
+
+/*
+ * parse "event:seconds:key[,key...]" and add it to the factory as a
+ * rollup rule.
+ */
+static bool AddRollupRule(TellientDevFactory &factory, const char *spec)
+{
+    qcc::String s(spec);
+    size_t c1 = s.find_first_of(':');
+    size_t c2 = c1 == qcc::String::npos ? c1 : s.find_first_of(':', c1 + 1);
+    if (c2 == qcc::String::npos) {
+        return false;
+    }
+
+    qcc::String event = s.substr(0, c1);
+    /* checked before narrowing, so a huge value cannot wrap into range. */
+    unsigned long seconds = strtoul(s.substr(c1 + 1, c2 - c1 - 1).c_str(), NULL, 10);
+    if (seconds > TE_ROLLUP_MAX_WINDOW_SECONDS) {
+        return false;
     }
+
+    std::vector<qcc::String> names;
+    size_t pos = c2 + 1;
+    for (;;) {
+        size_t comma = s.find_first_of(',', pos);
+        names.push_back(s.substr(pos, comma == qcc::String::npos ? qcc::String::npos : comma - pos));
+        if (comma == qcc::String::npos) {
+            break;
+        }
+        pos = comma + 1;
+    }
+
+    std::vector<const char *> keys;
+    for (size_t i = 0; i < names.size(); i++) {
+        keys.push_back(names[i].c_str());
+    }
+    return factory.AddRollupRule(event.c_str(), seconds, keys.size(), &keys[0]);
 }
 
 int main(int argc, char**argv, char**envArg)
@@ -164,6 +323,9 @@ int main(int argc, char**argv, char**envArg)
 
     /* Install SIGINT handler so Ctrl + C deallocates memory properly */
     signal(SIGINT, SigIntHandler);
+#ifdef ANALYTICS_TRACING
+    signal(SIGUSR1, SigUsr1Handler);
+#endif
 
     printf("AllJoyn Library version: %s.\n", ajn::GetVersion());
     printf("AllJoyn Library build info: %s.\n", ajn::GetBuildInfo());
@@ -197,7 +359,7 @@ int main(int argc, char**argv, char**envArg)
         return EXIT_FAILURE;
     }
 
-    AboutData aboutData("en");
+    AnalyticsAboutData aboutData("en");
 
     status = FillAboutPropertyStoreImplData(aboutData);
     if (ER_OK != status) {
@@ -205,8 +367,78 @@ int main(int argc, char**argv, char**envArg)
         return EXIT_FAILURE;
     }
 
+    /* outlives devFactory, whose delivery queue records into it. */
+    AnalyticsStats stats;
+
     TellientDevFactory devFactory;
-    AnalyticsBusObject testObj(bus, &devFactory, SERVICE_PATH, INTERFACE_NAME);
+    AnalyticsFilter filter;
+    AnalyticsSketches sketches;
+
+    /*
+     * -r event:seconds:key[,key...] aggregates that event instead of sending it.
+     * -c event sends identical consecutive repeats of that event once.
+     * -f file loads drop and sampling rules.
+     * -s name[:capacity] runs the service as that shard, taking only its devices;
+     *    capacity is 1 to ANALYTICS_HASH_MAX_WEIGHT.
+     * -j threads sets the number of executor threads; one per core by default.
+     * -v version encodes updates with that update.proto version, 1 or 2.
+     */
+    qcc::String shard;
+    uint32_t capacity = 1;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp(argv[i], "-r") && i + 1 < argc) {
+            if (!AddRollupRule(devFactory, argv[++i])) {
+                printf("Invalid rollup rule %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (0 == strcmp(argv[i], "-c") && i + 1 < argc) {
+            devFactory.AddCoalescedEvent(argv[++i]);
+        } else if (0 == strcmp(argv[i], "-f") && i + 1 < argc) {
+            const char *err;
+            unsigned line;
+            status = filter.Load(argv[++i], &err, &line);
+            if (ER_OK != status) {
+                printf("%s:%u: %s\n", argv[i], line, err);
+                return EXIT_FAILURE;
+            }
+        } else if (0 == strcmp(argv[i], "-s") && i + 1 < argc) {
+            shard = argv[++i];
+            size_t colon = shard.find_first_of(':');
+            if (colon != qcc::String::npos) {
+                /* checked before narrowing, so a huge value cannot wrap into range. */
+                unsigned long n = strtoul(shard.c_str() + colon + 1, NULL, 10);
+                capacity = n > ANALYTICS_HASH_MAX_WEIGHT ? 0 : (uint32_t)n;
+                shard = shard.substr(0, colon);
+            }
+            if (shard.empty() || capacity == 0) {
+                printf("Invalid shard %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+        } else if (0 == strcmp(argv[i], "-j") && i + 1 < argc) {
+            threads = strtol(argv[++i], NULL, 10);
+        } else if (0 == strcmp(argv[i], "-v") && i + 1 < argc) {
+            unsigned long version = strtoul(argv[++i], NULL, 10);
+            if (version != 1 && version != 2) {
+                printf("Invalid update version %s\n", argv[i]);
+                return EXIT_FAILURE;
+            }
+            devFactory.SetWireVersion(version);
+        } else {
+            printf("usage: %s [-r event:seconds:key[,key...]]... [-c event]... [-f file] [-s name[:capacity]] [-j threads] [-v version]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    /* process device work on all cores, in order for each device. */
+    AnalyticsExecutor executor(threads > 0 ? threads : 1);
+
+    AnalyticsBusObject testObj(bus, &devFactory, SERVICE_PATH, INTERFACE_NAME, &executor);
+    if (!filter.Empty()) {
+        testObj.SetFilter(&filter);
+    }
+    testObj.SetSketches(&sketches);
+    testObj.SetStats(&stats);
 
     status = testObj.Initialize();
     if (ER_OK != status) {
@@ -214,12 +446,29 @@ int main(int argc, char**argv, char**envArg)
         return EXIT_FAILURE;
     }
 
+    sessionPortListener.analytics = &testObj;
+
     status = bus.RegisterBusObject(testObj);
     if (ER_OK != status) {
         printf("Failed to register testObj (%s)\n", QCC_StatusText(status));
         return EXIT_FAILURE;
     }
 
+    AnalyticsShards *shards = NULL;
+    if (!shard.empty()) {
+        shards = new AnalyticsShards(bus, shard.c_str(), capacity, INTERFACE_NAME);
+        status = shards->Start();
+        if (ER_OK == status) {
+            status = aboutData.SetShard(shard.c_str(), capacity);
+        }
+        if (ER_OK != status) {
+            printf("Failed to start shard %s (%s)\n", shard.c_str(), QCC_StatusText(status));
+            return EXIT_FAILURE;
+        }
+        sessionPortListener.shards = shards;
+        printf("running as shard %s with capacity %u\n", shard.c_str(), capacity);
+    }
+
     AboutObj aboutObj(bus);
 
     status = aboutObj.Announce(ASSIGNED_SERVICE_PORT, aboutData);
@@ -231,8 +480,11 @@ int main(int argc, char**argv, char**envArg)
 
     /* Perform the service asynchronously until the user signals for an exit. */
     if (ER_OK == status) {
-        WaitForSigInt();
+        RunUntilSigInt(testObj, devFactory, aboutObj, aboutData);
     }
 
+    sessionPortListener.shards = NULL;
+    delete shards;
+
     return 0;
 }
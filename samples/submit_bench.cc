@@ -0,0 +1,334 @@
+/**
+ * @file
+ * @brief  Allocation check and benchmark of the service's SubmitEvent path
+ */
+
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Drives the service side of SubmitEvent through AnalyticsBusObject,
+ * without a bus connection: every event goes to SubmitEventFrom, the
+ * code the SubmitEvent handler runs once the call is unmarshalled, which
+ * counts it in the sketches, finds the sender's device in the device
+ * table and posts a DeviceTask to its strand on an AnalyticsExecutor,
+ * where the TellientAnalyticsDeviceObject logs it and the stats and the
+ * device's footprint are updated.  Every 256 events a device is sent a
+ * RequestDeliveryFrom, which hands its update to the
+ * TellientDeliveryQueue, whose workers "send" it through a SendToCloud
+ * that only returns ER_OK.  The senders are made members of a session
+ * up front, as a multipoint session reports them, and the factory gives
+ * each new device the vendor and device data a client would set.
+ *
+ * Spare updates are reserved up front, and submitting pauses while the
+ * delivery backlog is longer than one update per device, as it would be
+ * in a service whose cloud keeps up.  After a warm-up that lets the task
+ * pool and the device, stats and sketch state reach their working sizes,
+ * malloc, calloc and realloc calls are counted over the measured run.
+ * Results are written to stdout as JSON:
+ *
+ *   {"events":...,"devices":...,"keys":...,"ns_per_event":...,
+ *    "allocs_per_event":...}
+ *
+ * With -c the program exits with failure if the measured run allocated
+ * at all; make and make bench run it that way.  Unmarshalling the call
+ * and sending the method reply need a bus and are not covered.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#include <alljoyn/BusAttachment.h>
+#include <qcc/Thread.h>
+#include <qcc/atomic.h>
+
+#include "Analytics.h"
+#include "AnalyticsExecutor.h"
+#include "AnalyticsSketch.h"
+#include "AnalyticsStats.h"
+#include "TellientAnalytics.h"
+
+using namespace ajn;
+
+#define DEVICES 16
+#define SESSION 1
+#define KEYS 8
+#define WARMUP_EVENTS 100000
+#define EVENTS 400000
+
+/* events per device between deliveries. */
+#define DELIVER_EVERY 256
+
+/* tasks posted but not yet run allowed at once. */
+#define MAX_PENDING 2048
+
+/*
+ * updates allowed to wait for delivery before submitting stops; a
+ * backlog beyond what the spare updates cover is not a steady state.
+ */
+#define MAX_BACKLOG DEVICES
+
+/* buffer size for the spare updates; DELIVER_EVERY events fit. */
+#define UPDATE_BYTES 65536
+
+static volatile int32_t allocations;
+
+#ifdef __GLIBC__
+#define COUNT_ALLOCATIONS 1
+
+extern "C" {
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size) throw()
+{
+    qcc::IncrementAndFetch(&allocations);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) throw()
+{
+    qcc::IncrementAndFetch(&allocations);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) throw()
+{
+    qcc::IncrementAndFetch(&allocations);
+    return __libc_realloc(p, size);
+}
+}
+#else
+#define COUNT_ALLOCATIONS 0
+#endif
+
+/* the network is not part of the path being measured. */
+QStatus TellientAnalyticsDeviceObject::SendToCloud(qcc::String &, size_t, void *, uint32_t)
+{
+    return ER_OK;
+}
+
+void TellientAnalyticsDeviceObject::CloudInit()
+{
+}
+
+static double NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const char *keyNames[KEYS] = {
+    "temp", "humidity", "state", "battery", "rssi", "mode", "uptime", "label"
+};
+
+static const char *eventNames[] = { "reading", "status", "alarm", "heartbeat" };
+
+/* the data a client sends with SetVendorData and SetDeviceData. */
+static MsgArg deviceData[1];
+
+/* sets up each device as its client would before submitting. */
+class BenchFactory : public TellientDevFactory {
+    public:
+        BenchFactory() : setupFailures(0) {}
+
+        virtual AnalyticsDeviceObject *Construct()
+        {
+            TellientAnalyticsDeviceObject *dev =
+                static_cast<TellientAnalyticsDeviceObject *>(TellientDevFactory::Construct());
+            const char *err;
+            if (!dev) {
+                qcc::IncrementAndFetch(&setupFailures);
+                return NULL;
+            }
+            dev->SetVendorData(1337, "http://localhost:8080/", "benchmodel");
+            if (ER_OK != dev->SetDeviceData(&err, 1, deviceData)) {
+                qcc::IncrementAndFetch(&setupFailures);
+            }
+            return dev;
+        }
+
+        volatile int32_t setupFailures;
+};
+
+struct Device {
+    char sender[32];
+    uint32_t submitted;
+};
+
+/* a message's values, built once; GetArgs would hand out pointers into the message. */
+static MsgArg values[KEYS];
+static MsgArg kvs[KEYS];
+
+/* calls made, each posting one task to the executor. */
+static uint64_t posted;
+
+static uint64_t Executed(AnalyticsExecutor &executor)
+{
+    AnalyticsExecutor::Stats es;
+    executor.GetStats(es);
+    return es.executed;
+}
+
+static void Submit(AnalyticsBusObject &analytics, BenchFactory &factory,
+        AnalyticsExecutor &executor, Message &call, Device *devices, unsigned events)
+{
+    for (unsigned n = 0; n < events; n++) {
+        while (n % 16 == 0 && (posted - Executed(executor) >= MAX_PENDING ||
+                    factory.DeliveryBacklog() >= MAX_BACKLOG)) {
+            qcc::Sleep(0);
+        }
+
+        Device &device = devices[n % DEVICES];
+        AnalyticsBusObject::EventArgs event;
+        event.name = eventNames[n % (sizeof(eventNames) / sizeof(eventNames[0]))];
+        event.timestamp = 0;
+        event.kvs = kvs;
+        event.sequence = n;
+        event.count = KEYS;
+        analytics.SubmitEventFrom(device.sender, SESSION, event, call);
+        posted++;
+
+        if (++device.submitted % DELIVER_EVERY == 0) {
+            analytics.RequestDeliveryFrom(device.sender, SESSION, call);
+            posted++;
+        }
+    }
+}
+
+static void Drain(BenchFactory &factory, AnalyticsExecutor &executor)
+{
+    while (Executed(executor) < posted || factory.DeliveryBacklog()) {
+        qcc::Sleep(1);
+    }
+}
+
+static void Usage(void)
+{
+    printf("Usage: submit_bench [-h] [-c]\n\n");
+    printf("Options:\n");
+    printf("   -h   = Print this help message\n");
+    printf("   -c   = Fail if the measured run allocates\n");
+}
+
+int main(int argc, char **argv)
+{
+    bool check = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (0 == strcmp("-c", argv[i])) {
+            check = true;
+        } else {
+            Usage();
+            exit(0 == strcmp("-h", argv[i]) ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+
+    for (unsigned i = 0; i < KEYS; i++) {
+        switch (i % 4) {
+        case 0:
+            values[i].Set("d", 21.5 + i);
+            break;
+        case 1:
+            values[i].Set("i", (int32_t)(40 + i));
+            break;
+        case 2:
+            values[i].Set("x", (int64_t)(1400000000000LL + i));
+            break;
+        default:
+            values[i].Set("s", "nominal");
+            break;
+        }
+        kvs[i].Set("{sv}", keyNames[i], &values[i]);
+    }
+
+    MsgArg fwVersion;
+    fwVersion.Set("s", "1.0.2");
+    deviceData[0].Set("{sv}", "fwVersion", &fwVersion);
+
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    BenchFactory factory;
+    factory.ReserveUpdates(TE_DELIVERY_SPARE_UPDATES, UPDATE_BYTES);
+    AnalyticsExecutor executor(cores > 1 ? (unsigned)cores : 1);
+    AnalyticsSketches sketches;
+    AnalyticsStats stats;
+
+    BusAttachment bus("submit_bench", true);
+    AnalyticsBusObject analytics(bus, &factory, "/analytics/bench",
+            "org.allseen.Analytics.AnalyticsEventAgent", &executor);
+    analytics.SetSketches(&sketches);
+    analytics.SetStats(&stats);
+    if (ER_OK != analytics.Initialize()) {
+        fprintf(stderr, "bus object setup failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    /* not a method call, so nothing is replied to. */
+    Message call(bus);
+
+    Device devices[DEVICES];
+    for (unsigned i = 0; i < DEVICES; i++) {
+        snprintf(devices[i].sender, sizeof(devices[i].sender), ":bench.%u", i + 2);
+        devices[i].submitted = 0;
+        analytics.SessionMemberAdded(SESSION, devices[i].sender);
+    }
+
+    Submit(analytics, factory, executor, call, devices, WARMUP_EVENTS);
+    Drain(factory, executor);
+
+    int32_t a0 = allocations;
+    double t0 = NowNs();
+    Submit(analytics, factory, executor, call, devices, EVENTS);
+    Drain(factory, executor);
+    double t1 = NowNs();
+    int32_t allocs = allocations - a0;
+
+    printf("{\"events\":%u,\"devices\":%u,\"keys\":%u,\"ns_per_event\":%.1f,\"allocs_per_event\":",
+            EVENTS, DEVICES, KEYS, (t1 - t0) / EVENTS);
+    if (COUNT_ALLOCATIONS) {
+        printf("%.4f}\n", (double)allocs / EVENTS);
+    } else {
+        printf("null}\n");
+    }
+
+    AnalyticsStats::Snapshot *snap = new AnalyticsStats::Snapshot;
+    stats.Read(*snap);
+    uint64_t logged = snap->counters[ANALYTICS_EVENTS];
+    uint64_t failed = snap->counters[ANALYTICS_EVENTS_FAILED];
+    delete snap;
+
+    if (factory.setupFailures || failed || logged != WARMUP_EVENTS + EVENTS) {
+        fprintf(stderr, "%d device setups failed, %llu of %u events logged, %llu failed\n",
+                (int)factory.setupFailures, (unsigned long long)logged,
+                WARMUP_EVENTS + EVENTS, (unsigned long long)failed);
+        return EXIT_FAILURE;
+    }
+    if (check && COUNT_ALLOCATIONS && allocs) {
+        fprintf(stderr, "%d allocations in %u events; the submit path must not allocate\n",
+                (int)allocs, EVENTS);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
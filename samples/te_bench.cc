@@ -0,0 +1,525 @@
+/**
+ * @file
+ * @brief  Benchmark of the teclient encoder and MsgArg to teKeyValue conversion
+ */
+
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Times te_init_update, te_add_event and te_add_defaults over string-,
+ * int- and double-heavy key/value mixes of 1 to 32 keys with both buffer
+ * managers, in update.proto versions 1 and 2,
+ * TellientAnalyticsDeviceObject::argToKV over prebuilt {sv} MsgArgs, and
+ * the teclient varint helpers.  Results are written to stdout as JSON,
+ * one object per case, so runs of two builds can be compared:
+ *
+ *   {"results":[{"bench":"add_event","mix":"string","keys":8,
+ *     "buffer":"fixed","version":2,"ns_per_event":...,
+ *     "bytes_per_event":...,"allocs_per_event":...}, ...]}
+ *
+ * Fields that do not apply to a case are null.  allocs_per_event counts
+ * malloc, calloc and realloc calls and is null where they cannot be
+ * interposed (anything but glibc).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "TellientAnalytics.h"
+
+using namespace ajn;
+
+/* events or calls timed for each case. */
+#define EVENTS 200000
+
+/* updates are restarted once they reach the size the service would send. */
+#define UPDATE_BYTES TE_DEVICE_SOFT_CAP_BYTES
+
+/* fixed buffer; large enough for UPDATE_BYTES plus one 32 key event. */
+#define FIXED_BYTES (UPDATE_BYTES + 16384)
+
+#define MAX_KEYS 32
+
+/* varint helpers from te_bench_internal.c */
+extern "C" {
+teErrType te_bench_write_uint32(teUpdateState *statep, uint32_t value);
+teErrType te_bench_write_uint64(teUpdateState *statep, uint64_t value);
+teErrType te_bench_write_sint32(teUpdateState *statep, int32_t value);
+teErrType te_bench_write_sint64(teUpdateState *statep, int64_t value);
+unsigned int te_bench_wirelength_uint64(uint64_t value);
+unsigned int te_bench_wirelength_sint64(int64_t value);
+}
+
+static size_t allocations;
+
+#ifdef __GLIBC__
+#define COUNT_ALLOCATIONS 1
+
+extern "C" {
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+void *malloc(size_t size) throw()
+{
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) throw()
+{
+    allocations++;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) throw()
+{
+    allocations++;
+    return __libc_realloc(p, size);
+}
+}
+#else
+#define COUNT_ALLOCATIONS 0
+#endif
+
+/* keeps results the compiler could otherwise discard. */
+static volatile uint64_t sink;
+
+static double NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/*
+ * a key/value mix: of every four keys, this many are strings, integers
+ * and doubles, in that order.
+ */
+struct Mix {
+    const char *name;
+    unsigned strings;
+    unsigned ints;
+    unsigned doubles;
+};
+
+static const Mix mixes[] = {
+    { "string", 3, 1, 0 },
+    { "int", 0, 3, 1 },
+    { "double", 1, 0, 3 },
+    { "mixed", 1, 2, 1 },
+};
+
+static const unsigned keyCounts[] = { 1, 4, 8, 16, 32 };
+
+static bool first = true;
+
+static void Report(const char *bench, const char *mix, unsigned keys, const char *buffer,
+        unsigned version, double ns, double events, double bytes, double allocs)
+{
+    printf("%s\n    {\"bench\":\"%s\",\"mix\":", first ? "" : ",", bench);
+    first = false;
+    if (mix) {
+        printf("\"%s\"", mix);
+    } else {
+        printf("null");
+    }
+    printf(",\"keys\":");
+    if (keys) {
+        printf("%u", keys);
+    } else {
+        printf("null");
+    }
+    printf(",\"buffer\":");
+    if (buffer) {
+        printf("\"%s\"", buffer);
+    } else {
+        printf("null");
+    }
+    printf(",\"version\":");
+    if (version) {
+        printf("%u", version);
+    } else {
+        printf("null");
+    }
+    printf(",\"ns_per_event\":%.1f,\"bytes_per_event\":", ns / events);
+    if (bytes >= 0) {
+        printf("%.1f", bytes / events);
+    } else {
+        printf("null");
+    }
+    printf(",\"allocs_per_event\":");
+    if (COUNT_ALLOCATIONS) {
+        printf("%.3f", allocs / events);
+    } else {
+        printf("null");
+    }
+    printf("}");
+}
+
+/* key names and string values shaped like those of a real device. */
+static char keyNames[MAX_KEYS][24];
+static char stringValues[MAX_KEYS][48];
+
+static void MakeNames()
+{
+    static const char *const words[] = {
+        "temperature", "state", "firmware", "battery", "signal", "mode", "error", "duration"
+    };
+    for (unsigned i = 0; i < MAX_KEYS; i++) {
+        snprintf(keyNames[i], sizeof(keyNames[i]), "%s_%u", words[i % 8], i / 8);
+        /* 8 to 40 characters */
+        unsigned len = 8 + (i * 11) % 33;
+        for (unsigned j = 0; j < len; j++) {
+            stringValues[i][j] = 'a' + (i + j) % 26;
+        }
+        stringValues[i][len] = '\0';
+    }
+}
+
+static char KeyType(const Mix &mix, unsigned i)
+{
+    unsigned slot = i % 4;
+    if (slot < mix.strings) {
+        return 's';
+    }
+    if (slot < mix.strings + mix.ints) {
+        /* alternate small and wide integers. */
+        return (i / 4) % 2 ? 'x' : 'i';
+    }
+    return 'd';
+}
+
+static void MakeKVs(const Mix &mix, unsigned keys, teKeyValue *kv)
+{
+    for (unsigned i = 0; i < keys; i++) {
+        kv[i].name = keyNames[i];
+        switch (KeyType(mix, i)) {
+        case 's':
+            kv[i].type = TE_STRING;
+            kv[i].value.stringval = stringValues[i];
+            break;
+        case 'i':
+            kv[i].type = TE_I32;
+            kv[i].value.i32val = 20 + i;
+            break;
+        case 'x':
+            kv[i].type = TE_I64;
+            kv[i].value.i64val = 1400000000000LL + i;
+            break;
+        default:
+            kv[i].type = TE_DOUBLE;
+            kv[i].value.doubleval = 21.5 + i;
+            break;
+        }
+    }
+}
+
+/* the state and buffer of one update being encoded. */
+struct Update {
+    teUpdateState state;
+    teStringTable strings;
+    char fixed[FIXED_BYTES];
+    bool grow;
+    unsigned version;
+
+    /*
+     * grow selects teReallocBufferManager over teFixedBufferManager;
+     * version is the update.proto version.
+     */
+    Update(bool grow, unsigned version = 1) : grow(grow), version(version)
+    {
+        state.buf = NULL;
+    }
+
+    ~Update()
+    {
+        Release();
+    }
+
+    teErrType Init()
+    {
+        if (version == 2) {
+            if (grow) {
+                return te_init_update_v2(&state, teReallocBufferManager, NULL, 0, 1234,
+                        "benchmodel", &strings);
+            }
+            return te_init_update_v2(&state, teFixedBufferManager, fixed, sizeof(fixed), 1234,
+                    "benchmodel", &strings);
+        }
+        if (grow) {
+            return te_init_update(&state, teReallocBufferManager, NULL, 0, 1234, "benchmodel");
+        }
+        return te_init_update(&state, teFixedBufferManager, fixed, sizeof(fixed), 1234, "benchmodel");
+    }
+
+    void Release()
+    {
+        if (grow) {
+            free(state.buf);
+        }
+        state.buf = NULL;
+    }
+};
+
+static void BenchInit(bool grow, unsigned version)
+{
+    Update *update = new Update(grow, version);
+    double bytes = 0;
+
+    size_t a0 = allocations;
+    double t0 = NowNs();
+    for (unsigned i = 0; i < EVENTS; i++) {
+        if (TE_SUCCESS != update->Init()) {
+            fprintf(stderr, "te_init_update failed\n");
+            exit(EXIT_FAILURE);
+        }
+        bytes += update->state.used;
+        /* timed: a new realloc'd update starts from an empty buffer. */
+        update->Release();
+    }
+    double t1 = NowNs();
+
+    Report("init_update", NULL, 0, grow ? "realloc" : "fixed", version,
+            t1 - t0, EVENTS, bytes, (double)(allocations - a0));
+    delete update;
+}
+
+/*
+ * times te_add_event, or te_add_defaults if defaults is true, filling
+ * updates to UPDATE_BYTES and starting new ones outside the timed section.
+ */
+static void BenchAdd(bool defaults, const Mix &mix, unsigned keys, bool grow, unsigned version)
+{
+    teKeyValue kv[MAX_KEYS];
+    MakeKVs(mix, keys, kv);
+
+    Update *update = new Update(grow, version);
+    double ns = 0;
+    double bytes = 0;
+    size_t allocs = 0;
+    unsigned events = 0;
+    int64_t timestamp = 1400000000000LL;
+
+    while (events < EVENTS) {
+        update->Release();
+        if (TE_SUCCESS != update->Init()) {
+            fprintf(stderr, "te_init_update failed\n");
+            exit(EXIT_FAILURE);
+        }
+        int32_t start = update->state.used;
+
+        size_t a0 = allocations;
+        double t0 = NowNs();
+        unsigned n = 0;
+        teErrType err = TE_SUCCESS;
+        while (update->state.used < UPDATE_BYTES && events + n < EVENTS) {
+            if (defaults) {
+                err = te_add_defaults(&update->state, keys, kv);
+            } else {
+                err = te_add_event(&update->state, "benchevent", timestamp++, keys, kv);
+            }
+            if (err != TE_SUCCESS) {
+                break;
+            }
+            n++;
+        }
+        double t1 = NowNs();
+
+        if (err != TE_SUCCESS) {
+            fprintf(stderr, "encoding failed (%d)\n", err);
+            exit(EXIT_FAILURE);
+        }
+        ns += t1 - t0;
+        allocs += allocations - a0;
+        bytes += update->state.used - start;
+        events += n;
+    }
+
+    Report(defaults ? "add_defaults" : "add_event", mix.name, keys, grow ? "realloc" : "fixed",
+            version, ns, events, bytes, (double)allocs);
+    delete update;
+}
+
+static void BenchArgToKV(const Mix &mix, unsigned keys)
+{
+    std::vector<MsgArg> values(keys);
+    std::vector<MsgArg> entries(keys);
+    for (unsigned i = 0; i < keys; i++) {
+        switch (KeyType(mix, i)) {
+        case 's':
+            values[i].Set("s", stringValues[i]);
+            break;
+        case 'i':
+            values[i].Set("i", (int32_t)(20 + i));
+            break;
+        case 'x':
+            values[i].Set("x", (int64_t)(1400000000000LL + i));
+            break;
+        default:
+            values[i].Set("d", 21.5 + i);
+            break;
+        }
+        entries[i].Set("{sv}", keyNames[i], &values[i]);
+    }
+
+    teKeyValue kv[MAX_KEYS];
+    const char *err = NULL;
+
+    size_t a0 = allocations;
+    double t0 = NowNs();
+    for (unsigned n = 0; n < EVENTS; n++) {
+        for (unsigned i = 0; i < keys; i++) {
+            if (ER_OK != TellientAnalyticsDeviceObject::argToKV(&err, &entries[i], &kv[i])) {
+                fprintf(stderr, "argToKV failed: %s\n", err);
+                exit(EXIT_FAILURE);
+            }
+        }
+        sink += kv[keys - 1].type;
+    }
+    double t1 = NowNs();
+
+    Report("arg_to_kv", mix.name, keys, NULL, 0, t1 - t0, EVENTS, -1, (double)(allocations - a0));
+}
+
+/* values whose varints are 1, 3 and 9 or 10 bytes long, with mixed signs. */
+static const char *const ranges[] = { "small", "medium", "large" };
+
+static void MakeValues(unsigned range, std::vector<int64_t> &values)
+{
+    unsigned seed = 12345;
+    values.resize(1024);
+    for (size_t i = 0; i < values.size(); i++) {
+        seed = seed * 1103515245u + 12345u;
+        int64_t v;
+        switch (range) {
+        case 0:
+            v = (seed >> 8) % 64;
+            break;
+        case 1:
+            v = 8192 + (seed >> 8) % 500000;
+            break;
+        default:
+            v = (int64_t)(((uint64_t)seed << 29) | (1ULL << 61));
+            break;
+        }
+        values[i] = (i & 1) ? -v : v;
+    }
+}
+
+enum VarintOp {
+    WRITE_UINT32,
+    WRITE_SINT32,
+    WRITE_UINT64,
+    WRITE_SINT64,
+    WIRELENGTH_UINT64,
+    WIRELENGTH_SINT64
+};
+
+static const char *const varintNames[] = {
+    "write_uint32", "write_sint32", "write_uint64", "write_sint64",
+    "wirelength_uint64", "wirelength_sint64"
+};
+
+static void BenchVarint(VarintOp op, unsigned range)
+{
+    std::vector<int64_t> values;
+    MakeValues(range, values);
+
+    Update *update = new Update(false);
+    update->Init();
+    unsigned mask = values.size() - 1;
+    double bytes = 0;
+    unsigned lengths = 0;
+
+    size_t a0 = allocations;
+    double t0 = NowNs();
+    for (unsigned n = 0; n < EVENTS; n++) {
+        int64_t v = values[n & mask];
+        teUpdateState *statep = &update->state;
+        if (statep->used > FIXED_BYTES - 16) {
+            bytes += statep->used;
+            statep->used = 0;
+        }
+        switch (op) {
+        case WRITE_UINT32:
+            te_bench_write_uint32(statep, (uint32_t)v);
+            break;
+        case WRITE_SINT32:
+            te_bench_write_sint32(statep, (int32_t)v);
+            break;
+        case WRITE_UINT64:
+            te_bench_write_uint64(statep, (uint64_t)v);
+            break;
+        case WRITE_SINT64:
+            te_bench_write_sint64(statep, v);
+            break;
+        case WIRELENGTH_UINT64:
+            lengths += te_bench_wirelength_uint64((uint64_t)v);
+            break;
+        case WIRELENGTH_SINT64:
+            lengths += te_bench_wirelength_sint64(v);
+            break;
+        }
+    }
+    double t1 = NowNs();
+    bytes += update->state.used;
+    sink += lengths;
+
+    bool writes = op < WIRELENGTH_UINT64;
+    Report(varintNames[op], ranges[range], 0, NULL, 0, t1 - t0, EVENTS,
+            writes ? bytes : -1, (double)(allocations - a0));
+    delete update;
+}
+
+int main(int argc, char **argv)
+{
+    MakeNames();
+
+    printf("{\"results\":[");
+
+    for (unsigned version = 1; version <= 2; version++) {
+        BenchInit(false, version);
+        BenchInit(true, version);
+    }
+
+    for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+        for (size_t k = 0; k < sizeof(keyCounts) / sizeof(keyCounts[0]); k++) {
+            for (unsigned version = 1; version <= 2; version++) {
+                BenchAdd(false, mixes[m], keyCounts[k], false, version);
+                BenchAdd(false, mixes[m], keyCounts[k], true, version);
+                BenchAdd(true, mixes[m], keyCounts[k], false, version);
+                BenchAdd(true, mixes[m], keyCounts[k], true, version);
+            }
+            BenchArgToKV(mixes[m], keyCounts[k]);
+        }
+    }
+
+    for (unsigned op = WRITE_UINT32; op <= WIRELENGTH_SINT64; op++) {
+        for (unsigned r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+            BenchVarint((VarintOp)op, r);
+        }
+    }
+
+    printf("\n]}\n");
+    return EXIT_SUCCESS;
+}
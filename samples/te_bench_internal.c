@@ -0,0 +1,55 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+/*
+ * Builds teclient.c together with non-static entry points to its varint
+ * helpers, so te_bench can time them directly.  te_bench links this
+ * object in place of teclient.o.
+ */
+
+#include "teclient.c"
+
+teErrType te_bench_write_uint32(teUpdateState *statep, uint32_t value)
+{
+    return write_uint32(statep, value);
+}
+
+teErrType te_bench_write_uint64(teUpdateState *statep, uint64_t value)
+{
+    return write_uint64(statep, value);
+}
+
+teErrType te_bench_write_sint32(teUpdateState *statep, int32_t value)
+{
+    return write_sint32(statep, value);
+}
+
+teErrType te_bench_write_sint64(teUpdateState *statep, int64_t value)
+{
+    return write_sint64(statep, value);
+}
+
+unsigned int te_bench_wirelength_uint64(uint64_t value)
+{
+    return wirelength_uint64(value);
+}
+
+unsigned int te_bench_wirelength_sint64(int64_t value)
+{
+    return wirelength_sint64(value);
+}
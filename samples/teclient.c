@@ -21,6 +21,9 @@
 
 #define PROTOVER 1
 
+/* string table and timestamp deltas; see te_init_update_v2. */
+#define PROTOVER_V2 2
+
 #define VARINT 0
 #define LENGTHDELIM 2
 #define FIXED32 5
@@ -36,12 +39,15 @@
 #define FIELD_UMODELVER fieldtag(5, LENGTHDELIM)
 #define FIELD_UDEFAULT  fieldtag(7, LENGTHDELIM)
 #define FIELD_UEVENT    fieldtag(8, LENGTHDELIM)
+#define FIELD_USTRING   fieldtag(9, LENGTHDELIM)
 #define FIELD_UTIMESTAMP fieldtag(15,VARINT)
 
 /* encoded field numbers for event fields */
 #define FIELD_ENAME             fieldtag(1, LENGTHDELIM)
 #define FIELD_ETIMESTAMP        fieldtag(2, VARINT)
+#define FIELD_ETIMEDELTA        fieldtag(3, VARINT)
 #define FIELD_ESEQUENCE         fieldtag(4, VARINT)
+#define FIELD_ENAMEINDEX        fieldtag(5, VARINT)
 #define FIELD_EKV               fieldtag(15, LENGTHDELIM)
 
 /* encoded field numbers for kv fields */
@@ -51,6 +57,8 @@
 #define FIELD_KVI64VAL  fieldtag(6, VARINT)
 #define FIELD_KVFLOATVAL  fieldtag(4, FIXED32)
 #define FIELD_KVDOUBLEVAL  fieldtag(5, FIXED64)
+#define FIELD_KVNAMEINDEX  fieldtag(7, VARINT)
+#define FIELD_KVSVALINDEX  fieldtag(8, VARINT)
 
 
 /*
@@ -60,6 +68,8 @@
 #define KVLENGTH _scratch[0]
 #define KVNAMELENGTH _scratch[1]
 #define KVSVALLENGTH _scratch[2]
+#define KVNAMEINDEX _scratch[3]
+#define KVSVALINDEX _scratch[4]
 
 
 #if TE_ALLOW_REALLOC
@@ -219,7 +229,7 @@ static unsigned int wirelength_sint32(int32_t value)
 
 static unsigned int wirelength_sint64(int64_t value)
 {
-    uint64_t uval = (uint64_t)((value<<1) ^ (value >> 31));
+    uint64_t uval = (uint64_t)((value<<1) ^ (value >> 63));
     return wirelength_uint64(uval);
 }
 
@@ -235,13 +245,15 @@ static unsigned int wirelength_int64(int64_t value)
     return wirelength_uint64(uval);
 }
 
-teErrType te_init_update(
+static teErrType init_update(
     teUpdateState *statep,
     const teBufferManager *mgr,
     void *buffer,
     unsigned buf_size,
+    int32_t version,
     int32_t manufacturer_id,
-    const char *model)
+    const char *model,
+    teStringTable *strings)
 {
     int len_model;
     statep->mgr = mgr;
@@ -249,6 +261,15 @@ teErrType te_init_update(
     statep->buf_size = buf_size;
     statep->used = 0;
     statep->hadError = 0;
+    statep->strings = strings;
+    statep->base_timestamp = 0;
+    statep->has_base_timestamp = 0;
+
+    if (strings) {
+        strings->count = 0;
+        strings->used = 0;
+        memset(strings->slot, 0, sizeof(strings->slot));
+    }
 
     len_model = strlen(model);
     if (TE_SUCCESS != statep->mgr->assure_space(statep, len_model + 40)) {
@@ -256,7 +277,7 @@ teErrType te_init_update(
     }
 
     write_int32(statep, FIELD_UVERSION);
-    write_int32(statep, PROTOVER);
+    write_int32(statep, version);
 
     write_int32(statep, FIELD_UMFGID);
     write_int32(statep, manufacturer_id);
@@ -270,24 +291,152 @@ teErrType te_init_update(
     return TE_SUCCESS;
 }
 
+teErrType te_init_update(
+    teUpdateState *statep,
+    const teBufferManager *mgr,
+    void *buffer,
+    unsigned buf_size,
+    int32_t manufacturer_id,
+    const char *model)
+{
+    return init_update(statep, mgr, buffer, buf_size, PROTOVER,
+            manufacturer_id, model, NULL);
+}
+
+teErrType te_init_update_v2(
+    teUpdateState *statep,
+    const teBufferManager *mgr,
+    void *buffer,
+    unsigned buf_size,
+    int32_t manufacturer_id,
+    const char *model,
+    teStringTable *strings)
+{
+    return init_update(statep, mgr, buffer, buf_size, PROTOVER_V2,
+            manufacturer_id, model, strings);
+}
+
+
+/*
+ * Returns the string table index of the len bytes at s, adding them to
+ * the table if there is room, or -1 if they are to be written in place.
+ * New entries are written to the update by write_strings.
+ */
+static int intern_string(teStringTable *t, const char *s, unsigned len)
+{
+    uint32_t hash = 2166136261u;
+    unsigned i;
+    unsigned slot;
+
+    if (len == 0 || len > TE_STRING_TABLE_MAX_LENGTH) {
+        return -1;
+    }
+
+    /* FNV-1a */
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)s[i]) * 16777619u;
+    }
+
+    slot = hash % TE_STRING_TABLE_SLOTS;
+    while (t->slot[slot]) {
+        unsigned index = t->slot[slot] - 1;
+        if (t->hash[index] == hash && t->length[index] == len &&
+                0 == memcmp(t->chars + t->offset[index], s, len)) {
+            return index;
+        }
+        slot = (slot + 1) % TE_STRING_TABLE_SLOTS;
+    }
+
+    if (t->count == TE_STRING_TABLE_STRINGS || t->used + len > TE_STRING_TABLE_BYTES) {
+        return -1;
+    }
+
+    i = t->count++;
+    t->hash[i] = hash;
+    t->offset[i] = t->used;
+    t->length[i] = len;
+    memcpy(t->chars + t->used, s, len);
+    t->used += len;
+    t->slot[slot] = i + 1;
+    return i;
+}
+
+/*
+ * Drops the entries added since the table held count strings, when
+ * they could not be written after all.  They are the newest, so no
+ * older entry's probe sequence runs through their slots.
+ */
+static void unintern_strings(teStringTable *t, unsigned count)
+{
+    unsigned slot;
+
+    if (t->count <= count) {
+        return;
+    }
+    for (slot = 0; slot < TE_STRING_TABLE_SLOTS; slot++) {
+        if (t->slot[slot] > count) {
+            t->slot[slot] = 0;
+        }
+    }
+    t->used = t->offset[count];
+    t->count = count;
+}
+
+/* wire size of the string table entries from index first on. */
+static unsigned wirelength_strings(const teStringTable *t, unsigned first)
+{
+    unsigned len = 0;
+
+    for (; first < t->count; first++) {
+        len += 1 + t->length[first] + wirelength_int32(t->length[first]);
+    }
+    return len;
+}
+
+/* write the string table entries from index first on. */
+static void write_strings(teUpdateState *statep, unsigned first)
+{
+    const teStringTable *t = statep->strings;
+
+    for (; first < t->count; first++) {
+        write_int32(statep, FIELD_USTRING);
+        write_int32(statep, t->length[first]);
+        statep->mgr->write_bytes(statep, t->chars + t->offset[first], t->length[first]);
+    }
+}
 
 /*
  * Calculates the wire size of a teKeyValue, not including the size header.
  * _scratch[0] will be set to the total size.
  * _scratch[1] will be set to the byte length of the key string.
  * _scratch[2] will be set to the byte length of the value string, if any.
+ * _scratch[3] and [4] will be set to the string table indices of the key
+ * and the value string, or -1 to write them in place.
  */
-static void precalc_kv_size(teKeyValue *kv)
+static void precalc_kv_size(teUpdateState *statep, teKeyValue *kv)
 {
     /* length of value part */
     int vallen;
 
     kv->KVNAMELENGTH = strlen(kv->name);
-    kv->KVLENGTH = 1+ kv->KVNAMELENGTH + wirelength_int32(kv->KVNAMELENGTH);
+    kv->KVNAMEINDEX = statep->strings ?
+        intern_string(statep->strings, kv->name, kv->KVNAMELENGTH) : -1;
+    if (kv->KVNAMEINDEX >= 0) {
+        /* the required name, empty, then the index. */
+        kv->KVLENGTH = 2 + 1 + wirelength_int32(kv->KVNAMEINDEX);
+    } else {
+        kv->KVLENGTH = 1+ kv->KVNAMELENGTH + wirelength_int32(kv->KVNAMELENGTH);
+    }
     switch(kv->type) {
         case TE_STRING:
             kv->KVSVALLENGTH = strlen(kv->value.stringval);
-            vallen = kv->KVSVALLENGTH + wirelength_int32(kv->KVSVALLENGTH);
+            kv->KVSVALINDEX = statep->strings ?
+                intern_string(statep->strings, kv->value.stringval, kv->KVSVALLENGTH) : -1;
+            if (kv->KVSVALINDEX >= 0) {
+                vallen = wirelength_int32(kv->KVSVALINDEX);
+            } else {
+                vallen = kv->KVSVALLENGTH + wirelength_int32(kv->KVSVALLENGTH);
+            }
             break;
         case TE_I32:
             vallen = wirelength_sint32(kv->value.i32val);
@@ -333,12 +482,24 @@ static void write_endian_bytes(teUpdateState *statep, const void *p, int nbytes)
 static void write_kv(teUpdateState *statep, teKeyValue *kv)
 {
 
-    write_int32(statep, FIELD_KVNAME);
-    write_int32(statep, kv->KVNAMELENGTH);
-    statep->mgr->write_bytes(statep, kv->name, kv->KVNAMELENGTH);
+    if (kv->KVNAMEINDEX >= 0) {
+        write_int32(statep, FIELD_KVNAME);
+        write_int32(statep, 0);
+        write_int32(statep, FIELD_KVNAMEINDEX);
+        write_int32(statep, kv->KVNAMEINDEX);
+    } else {
+        write_int32(statep, FIELD_KVNAME);
+        write_int32(statep, kv->KVNAMELENGTH);
+        statep->mgr->write_bytes(statep, kv->name, kv->KVNAMELENGTH);
+    }
 
     switch(kv->type) {
         case TE_STRING:
+            if (kv->KVSVALINDEX >= 0) {
+                write_int32(statep, FIELD_KVSVALINDEX);
+                write_int32(statep, kv->KVSVALINDEX);
+                break;
+            }
             write_int32(statep, FIELD_KVSVAL);
             write_int32(statep, kv->KVSVALLENGTH);
             statep->mgr->write_bytes(statep, kv->value.stringval,
@@ -372,10 +533,23 @@ teErrType te_add_event(teUpdateState *statep, const char *name,
     unsigned kv_length;
     unsigned event_length = 0;
     unsigned name_length;
+    int name_index = -1;
     int i;
 
+    /* version 2: string table entries and Update.timestamp written ahead of the event. */
+    teStringTable *strings = statep->strings;
+    unsigned first_string = strings ? strings->count : 0;
+    unsigned prefix_length = 0;
+    int write_base = 0;
+    int64_t delta = 0;
+
+    name_length = strlen(name);
+    if (strings) {
+        name_index = intern_string(strings, name, name_length);
+    }
+
     for (i = 0; i < num_keys; i++) {
-        precalc_kv_size(&kv[i]);
+        precalc_kv_size(statep, &kv[i]);
 
         kv_length = kv[i].KVLENGTH;
 
@@ -385,28 +559,66 @@ teErrType te_add_event(teUpdateState *statep, const char *name,
 
     /* event_length now contains the number of wire bytes for the key/values. */
 
-    name_length = strlen(name);
-
-    event_length += 1 + name_length + wirelength_int32(name_length);
+    if (name_index >= 0) {
+        /* the required name, empty, then the index. */
+        event_length += 2 + 1 + wirelength_int32(name_index);
+    } else {
+        event_length += 1 + name_length + wirelength_int32(name_length);
+    }
 
-    if (timestamp) {
+    if (timestamp && strings) {
+        if (!statep->has_base_timestamp) {
+            write_base = 1;
+            prefix_length += 1 + wirelength_int64(timestamp);
+        } else {
+            delta = timestamp - statep->base_timestamp;
+        }
+        event_length += 1 + wirelength_sint64(delta);
+    } else if (timestamp) {
         event_length += 1 + wirelength_int64(timestamp);
     }
 
-    if (TE_SUCCESS != statep->mgr->assure_space(statep, event_length + 12) ) {
+    if (strings) {
+        prefix_length += wirelength_strings(strings, first_string);
+    }
+
+    if (TE_SUCCESS != statep->mgr->assure_space(statep, prefix_length + event_length + 12) ) {
+        if (strings) {
+            unintern_strings(strings, first_string);
+        }
         return TE_ERR_ALLOC;
     }
 
     /* we know the buffer is big enough, so start writing to it. */
 
+    if (strings) {
+        write_strings(statep, first_string);
+    }
+    if (write_base) {
+        write_int32(statep, FIELD_UTIMESTAMP);
+        write_int64(statep, timestamp);
+        statep->base_timestamp = timestamp;
+        statep->has_base_timestamp = 1;
+    }
+
     write_int32(statep, FIELD_UEVENT);
     write_int32(statep, event_length);
 
-    write_int32(statep, FIELD_ENAME);
-    write_int32(statep, name_length);
-    statep->mgr->write_bytes(statep, name, name_length);
+    if (name_index >= 0) {
+        write_int32(statep, FIELD_ENAME);
+        write_int32(statep, 0);
+        write_int32(statep, FIELD_ENAMEINDEX);
+        write_int32(statep, name_index);
+    } else {
+        write_int32(statep, FIELD_ENAME);
+        write_int32(statep, name_length);
+        statep->mgr->write_bytes(statep, name, name_length);
+    }
 
-    if (timestamp) {
+    if (timestamp && strings) {
+        write_int32(statep, FIELD_ETIMEDELTA);
+        write_sint64(statep, delta);
+    } else if (timestamp) {
         write_int32(statep, FIELD_ETIMESTAMP);
         write_int64(statep, timestamp);
     }
@@ -447,11 +659,19 @@ teErrType te_set_modelver(teUpdateState *statep, const char *val)
 
 teErrType te_set_timestamp(teUpdateState *statep, int64_t val)
 {
+    /* events already written are relative to the first timestamp. */
+    if (statep->strings && statep->has_base_timestamp) {
+        return TE_ERR_ORDER;
+    }
     if (TE_SUCCESS != statep->mgr->assure_space(statep, 11)) {
         return TE_ERR_ALLOC;
     }
     write_int32(statep, FIELD_UTIMESTAMP);
     write_int64(statep, val);
+    if (statep->strings) {
+        statep->base_timestamp = val;
+        statep->has_base_timestamp = 1;
+    }
     return TE_SUCCESS;
 }
 
@@ -460,18 +680,31 @@ teErrType te_add_defaults(teUpdateState *statep,int num_keys,teKeyValue kv[])
 {
     int len;
     int i;
+    teStringTable *strings = statep->strings;
+    unsigned first_string = strings ? strings->count : 0;
 
     len = 0;
     for (i = 0; i < num_keys; i++) {
-        precalc_kv_size(&kv[i]);
+        precalc_kv_size(statep, &kv[i]);
 
         len += 1 + kv[i].KVLENGTH + wirelength_int32(kv[i].KVLENGTH);
     }
 
+    if (strings) {
+        len += wirelength_strings(strings, first_string);
+    }
+
     if (TE_SUCCESS != statep->mgr->assure_space(statep,len)) {
+        if (strings) {
+            unintern_strings(strings, first_string);
+        }
         return TE_ERR_ALLOC;
     }
 
+    if (strings) {
+        write_strings(statep, first_string);
+    }
+
     for (i = 0; i < num_keys; i++) {
         write_int32(statep, FIELD_UDEFAULT);
         write_int32(statep, kv[i].KVLENGTH);
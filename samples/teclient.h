@@ -30,6 +30,7 @@ struct teUpdateState;
 typedef enum {
     TE_SUCCESS=0,
     TE_ERR_ALLOC=1,
+    TE_ERR_ORDER=2,     /* te_set_timestamp after a timestamped event, in version 2 */
     TE_ERR_UNKNOWN=999
 } teErrType;
 
@@ -71,12 +72,35 @@ typedef struct {
 extern const teBufferManager *teFixedBufferManager;
 extern const teBufferManager *teReallocBufferManager;
 
+/* hash slots of a teStringTable; at least twice its strings. */
+#define TE_STRING_TABLE_SLOTS (2 * TE_STRING_TABLE_STRINGS)
+
+/* the string table of a version 2 update: the names and string values
+ * already written to it, which later events refer to by index.  The
+ * caller provides the storage; te_init_update_v2 clears it, and it
+ * belongs to that update until the next one is started with it.
+ */
+typedef struct teStringTable {
+    unsigned count;
+    unsigned used;                              /* bytes of chars in use */
+    uint32_t hash[TE_STRING_TABLE_STRINGS];
+    uint16_t offset[TE_STRING_TABLE_STRINGS];   /* of each string in chars */
+    uint8_t length[TE_STRING_TABLE_STRINGS];
+    uint8_t slot[TE_STRING_TABLE_SLOTS];        /* index + 1, or 0 if free */
+    char chars[TE_STRING_TABLE_BYTES];
+} teStringTable;
+
 typedef struct teUpdateState {
     const teBufferManager *mgr;
     void *buf;
     int32_t buf_size;  /* total current capacity of current buffer. */
     int32_t used;      /* number of bytes in the update so far. */
     int hadError;      /* Available for use by a custom teBufferManager */
+
+    /* version 2 only; strings is NULL in a version 1 update. */
+    teStringTable *strings;
+    int64_t base_timestamp;     /* Update.timestamp, once written */
+    int has_base_timestamp;
 } teUpdateState;
 
 typedef struct teKeyValue {
@@ -93,13 +117,23 @@ typedef struct teKeyValue {
     } value;
 
     /* used internally by the library. */
-    int _scratch[3];
+    int _scratch[5];
 } teKeyValue;
 
 teErrType te_init_update( teUpdateState *statep, const teBufferManager *mgr,
         void *buf, unsigned buf_size,
         int32_t manufacturer_id, const char *model);
 
+/* start a version 2 update instead.  Event names, key names and string
+ * values are written to its string table once and referred to by index
+ * after that, next to an empty name, as name is a required field.  Event
+ * timestamps are written relative to Update.timestamp, which is the
+ * first event's timestamp unless te_set_timestamp is called first.
+ * strings is the table's storage.
+ */
+teErrType te_init_update_v2( teUpdateState *statep, const teBufferManager *mgr,
+        void *buf, unsigned buf_size,
+        int32_t manufacturer_id, const char *model, teStringTable *strings);
 
 teErrType te_set_device_id(teUpdateState *statep, const char *);
 teErrType te_set_modelver(teUpdateState *statep, const char *);
@@ -0,0 +1,380 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#include "tedecode.h"
+
+#include <stddef.h>
+
+/* the update.proto versions this decoder understands. */
+#define PROTOVER 1
+#define PROTOVER_V2 2
+
+#define VARINT 0
+#define FIXED64 1
+#define LENGTHDELIM 2
+#define FIXED32 5
+
+/* a message, or the part of one not yet read. */
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+} teReader;
+
+/* what is known of the update so far, for checking version 2 fields. */
+typedef struct {
+    teDecodeSummary *summary;
+    int has_timestamp;      /* Update.timestamp seen */
+    int v2;                 /* a version 2 field seen */
+} teUpdateContext;
+
+/* one field as read from a message. */
+typedef struct {
+    unsigned number;
+    unsigned wiretype;
+    uint64_t varint;    /* value of a VARINT field */
+    teReader bytes;     /* contents of any other field */
+} teField;
+
+static teDecodeErr read_varint(teReader *r, uint64_t *out)
+{
+    uint64_t value = 0;
+    unsigned shift;
+
+    for (shift = 0; shift < 70; shift += 7) {
+        unsigned char b;
+        if (r->p >= r->end) {
+            return TE_DECODE_TRUNCATED;
+        }
+        b = *r->p++;
+        value |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            *out = value;
+            return TE_DECODE_OK;
+        }
+    }
+    return TE_DECODE_BAD_VARINT;
+}
+
+static teDecodeErr read_bytes(teReader *r, uint64_t n, teReader *out)
+{
+    if (n > (uint64_t)(r->end - r->p)) {
+        return TE_DECODE_TRUNCATED;
+    }
+    out->p = r->p;
+    out->end = r->p + n;
+    r->p += n;
+    return TE_DECODE_OK;
+}
+
+static teDecodeErr read_field(teReader *r, teField *f)
+{
+    uint64_t tag;
+    uint64_t len;
+    teDecodeErr err;
+
+    if ((err = read_varint(r, &tag)) != TE_DECODE_OK) {
+        return err;
+    }
+    f->number = (unsigned)(tag >> 3);
+    f->wiretype = (unsigned)(tag & 7);
+
+    switch (f->wiretype) {
+        case VARINT:
+            return read_varint(r, &f->varint);
+        case FIXED64:
+            return read_bytes(r, 8, &f->bytes);
+        case LENGTHDELIM:
+            if ((err = read_varint(r, &len)) != TE_DECODE_OK) {
+                return err;
+            }
+            return read_bytes(r, len, &f->bytes);
+        case FIXED32:
+            return read_bytes(r, 4, &f->bytes);
+        default:
+            /* groups are deprecated, and never written by teclient.c */
+            return TE_DECODE_BAD_WIRETYPE;
+    }
+}
+
+/* check a string table index, which must refer to an earlier entry. */
+static teDecodeErr check_index(teUpdateContext *ctx, uint64_t index)
+{
+    ctx->v2 = 1;
+    return index < ctx->summary->strings ? TE_DECODE_OK : TE_DECODE_BAD_VALUE;
+}
+
+static teDecodeErr decode_kv(teReader *r, teUpdateContext *ctx)
+{
+    teField f;
+    teDecodeErr err;
+    int have_name = 0;
+    int have_index = 0;
+    int name_empty = 0;
+    int values = 0;
+
+    while (r->p < r->end) {
+        if ((err = read_field(r, &f)) != TE_DECODE_OK) {
+            return err;
+        }
+        switch (f.number) {
+            case 1:
+                if (f.wiretype != LENGTHDELIM) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                have_name = 1;
+                name_empty = (f.bytes.p == f.bytes.end);
+                break;
+            case 2:
+                if (f.wiretype != LENGTHDELIM) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                values++;
+                break;
+            case 3:
+            case 6:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                values++;
+                break;
+            case 4:
+                if (f.wiretype != FIXED32) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                values++;
+                break;
+            case 5:
+                if (f.wiretype != FIXED64) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                values++;
+                break;
+            case 7:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                if ((err = check_index(ctx, f.varint)) != TE_DECODE_OK) {
+                    return err;
+                }
+                have_index = 1;
+                break;
+            case 8:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                if ((err = check_index(ctx, f.varint)) != TE_DECODE_OK) {
+                    return err;
+                }
+                values++;
+                break;
+        }
+    }
+
+    /* name is required in both versions; it is empty when the index stands for it. */
+    if (!have_name) {
+        return TE_DECODE_MISSING_FIELD;
+    }
+    if (have_index && !name_empty) {
+        return TE_DECODE_BAD_VALUE;
+    }
+    return values == 1 ? TE_DECODE_OK : TE_DECODE_BAD_VALUE;
+}
+
+static teDecodeErr decode_event(teReader *r, teUpdateContext *ctx)
+{
+    teField f;
+    teDecodeErr err;
+    int have_name = 0;
+    int have_index = 0;
+    int name_empty = 0;
+
+    while (r->p < r->end) {
+        if ((err = read_field(r, &f)) != TE_DECODE_OK) {
+            return err;
+        }
+        switch (f.number) {
+            case 1:
+                if (f.wiretype != LENGTHDELIM) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                have_name = 1;
+                name_empty = (f.bytes.p == f.bytes.end);
+                break;
+            case 2:
+            case 4:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                break;
+            case 3:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                ctx->v2 = 1;
+                if (!ctx->has_timestamp) {
+                    return TE_DECODE_BAD_VALUE;
+                }
+                break;
+            case 5:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                if ((err = check_index(ctx, f.varint)) != TE_DECODE_OK) {
+                    return err;
+                }
+                have_index = 1;
+                break;
+            case 15:
+                if (f.wiretype != LENGTHDELIM) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                if ((err = decode_kv(&f.bytes, ctx)) != TE_DECODE_OK) {
+                    return err;
+                }
+                ctx->summary->kvs++;
+                break;
+        }
+    }
+
+    if (!have_name) {
+        return TE_DECODE_MISSING_FIELD;
+    }
+    return have_index && !name_empty ? TE_DECODE_BAD_VALUE : TE_DECODE_OK;
+}
+
+teDecodeErr te_decode_update(const void *buf, unsigned len, teDecodeSummary *summary)
+{
+    teReader r;
+    teField f;
+    teDecodeErr err;
+    teUpdateContext ctx;
+    int have_version = 0;
+    int have_mfgid = 0;
+    int have_model = 0;
+
+    r.p = (const unsigned char *)buf;
+    r.end = r.p + len;
+
+    summary->version = 0;
+    summary->manufacturer_id = 0;
+    summary->defaults = 0;
+    summary->events = 0;
+    summary->kvs = 0;
+    summary->strings = 0;
+
+    ctx.summary = summary;
+    ctx.has_timestamp = 0;
+    ctx.v2 = 0;
+
+    while (r.p < r.end) {
+        if ((err = read_field(&r, &f)) != TE_DECODE_OK) {
+            return err;
+        }
+        switch (f.number) {
+            case 1:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                summary->version = (int32_t)f.varint;
+                have_version = 1;
+                break;
+            case 2:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                summary->manufacturer_id = (int32_t)f.varint;
+                have_mfgid = 1;
+                break;
+            case 3:
+                if (f.wiretype != LENGTHDELIM) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                have_model = 1;
+                break;
+            case 4:
+            case 5:
+                if (f.wiretype != LENGTHDELIM) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                break;
+            case 6:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                break;
+            case 15:
+                if (f.wiretype != VARINT) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                ctx.has_timestamp = 1;
+                break;
+            case 7:
+                if (f.wiretype != LENGTHDELIM) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                if ((err = decode_kv(&f.bytes, &ctx)) != TE_DECODE_OK) {
+                    return err;
+                }
+                summary->defaults++;
+                break;
+            case 8:
+                if (f.wiretype != LENGTHDELIM) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                if ((err = decode_event(&f.bytes, &ctx)) != TE_DECODE_OK) {
+                    return err;
+                }
+                summary->events++;
+                break;
+            case 9:
+                if (f.wiretype != LENGTHDELIM) {
+                    return TE_DECODE_BAD_WIRETYPE;
+                }
+                ctx.v2 = 1;
+                summary->strings++;
+                break;
+        }
+    }
+
+    if (!have_version || !have_mfgid || !have_model) {
+        return TE_DECODE_MISSING_FIELD;
+    }
+    if (summary->version == PROTOVER_V2 || (summary->version == PROTOVER && !ctx.v2)) {
+        return TE_DECODE_OK;
+    }
+    return TE_DECODE_BAD_VALUE;
+}
+
+const char *te_decode_error(teDecodeErr err)
+{
+    switch (err) {
+        case TE_DECODE_OK:
+            return "ok";
+        case TE_DECODE_TRUNCATED:
+            return "truncated field";
+        case TE_DECODE_BAD_VARINT:
+            return "bad varint";
+        case TE_DECODE_BAD_WIRETYPE:
+            return "unexpected wire type";
+        case TE_DECODE_MISSING_FIELD:
+            return "missing required field";
+        case TE_DECODE_BAD_VALUE:
+            return "bad version or key/value";
+    }
+    return "unknown error";
+}
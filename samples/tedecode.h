@@ -0,0 +1,68 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#ifndef TEDECODE_H
+#define TEDECODE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/*
+ * Decoder and validator for the Update messages written by teclient.c
+ * (see update.proto), versions 1 and 2, for test servers that stand in
+ * for the Tellient cloud.  Fields unknown to update.proto are skipped, as
+ * protobuf requires; known fields with the wrong wire type, missing
+ * required fields, and KVs without exactly one value are errors.  In
+ * version 2, string table references must be to entries that come
+ * earlier in the update, and timestamp deltas must follow
+ * Update.timestamp, as teclient.c writes them; version 2 fields in a
+ * version 1 update are errors.
+ */
+
+typedef enum {
+    TE_DECODE_OK=0,
+    TE_DECODE_TRUNCATED=1,      /* a field runs past the end of its message */
+    TE_DECODE_BAD_VARINT=2,     /* a varint longer than 10 bytes */
+    TE_DECODE_BAD_WIRETYPE=3,   /* a group, or a known field of the wrong type */
+    TE_DECODE_MISSING_FIELD=4,  /* a required field is absent */
+    TE_DECODE_BAD_VALUE=5       /* unknown version, a KV without one value, or a bad reference */
+} teDecodeErr;
+
+typedef struct teDecodeSummary {
+    int32_t version;
+    int32_t manufacturer_id;
+    unsigned defaults;          /* event_default_value entries */
+    unsigned events;
+    unsigned kvs;               /* key/values of all events */
+    unsigned strings;           /* string table entries, version 2 */
+} teDecodeSummary;
+
+/* validate the len byte Update at buf, summarizing it in *summary. */
+teDecodeErr te_decode_update(const void *buf, unsigned len, teDecodeSummary *summary);
+
+/* a short description of err. */
+const char *te_decode_error(teDecodeErr err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
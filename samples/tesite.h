@@ -52,6 +52,22 @@
  */
 #define TE_INCLUDE_FLOATING 1
 
+/* Version 2 updates: the most strings a string table holds (at most 255;
+ * up to 127 are referred to in one byte), the bytes it holds in all, and
+ * the longest string it takes.  Other strings are written in place.
+ */
+#ifndef TE_STRING_TABLE_STRINGS
+#define TE_STRING_TABLE_STRINGS 96
+#endif
+
+#ifndef TE_STRING_TABLE_BYTES
+#define TE_STRING_TABLE_BYTES 2048
+#endif
+
+#ifndef TE_STRING_TABLE_MAX_LENGTH
+#define TE_STRING_TABLE_MAX_LENGTH 64
+#endif
+
 
 /**************************************
  *
@@ -75,5 +91,20 @@
 /* batch events for up to this long. */
 #define TE_DEVICE_BATCH_MAX_SECONDS 600
 
+/* number of background threads POSTing updates to the cloud service. */
+#ifndef TE_DELIVERY_THREADS
+#define TE_DELIVERY_THREADS 2
+#endif
+
+/* a failed POST is retried this many times before the update is dropped. */
+#ifndef TE_DELIVERY_MAX_RETRIES
+#define TE_DELIVERY_MAX_RETRIES 3
+#endif
+
+/* delivered update buffers kept for reuse by the next updates. */
+#ifndef TE_DELIVERY_SPARE_UPDATES
+#define TE_DELIVERY_SPARE_UPDATES 64
+#endif
+
 
 
@@ -17,37 +17,617 @@
  ******************************************************************************/
 
 #include "Analytics.h"
+#include "AnalyticsTrace.h"
+#include <algorithm>
+#include <assert.h>
 #include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include <qcc/Thread.h>
+#include <qcc/time.h>
 
 using namespace ajn;
 
-AnalyticsDeviceObject *AnalyticsBusObject::MakeOrFindDev(ajn::Message &msg)
+AnalyticsDevicePool::~AnalyticsDevicePool()
 {
-    AnalyticsDeviceObject *dev = devMap[msg->GetSender()];
-    if (dev) {
+    for (size_t i = 0; i < pool.size(); i++) {
+        delete pool[i];
+    }
+}
+
+AnalyticsDeviceObject *AnalyticsDevicePool::Construct()
+{
+    lock.Lock();
+    if (!pool.empty()) {
+        AnalyticsDeviceObject *dev = pool.back();
+        pool.pop_back();
+        lock.Unlock();
         return dev;
     }
+    lock.Unlock();
+
+    return Allocate();
+}
+
+void AnalyticsDevicePool::Destroy(AnalyticsDeviceObject *dev)
+{
+    dev->Reset();
+
+    lock.Lock();
+    if (pool.size() < maxPooled) {
+        pool.push_back(dev);
+        lock.Unlock();
+        return;
+    }
+    lock.Unlock();
+
+    delete dev;
+}
 
-    dev = factory->Construct();
-    devMap[msg->GetSender()] = dev;
+size_t AnalyticsDevicePool::Pooled()
+{
+    lock.Lock();
+    size_t n = pool.size();
+    lock.Unlock();
+    return n;
+}
+
+QStatus AnalyticsDeviceObject::SubmitCompactEvent(const char **errMsg, uint32_t id,
+        size_t count, const MsgArg *values, uint64_t timestamp)
+{
+    const AnalyticsEventSchema *schema;
+    QStatus status = schemas.Check(errMsg, id, count, values, schema);
+    if (ER_OK != status) {
+        return status;
+    }
+
+    std::vector<MsgArg> kvs(count);
+    for (size_t i = 0; i < count; i++) {
+        kvs[i].Set("{sv}", schema->keyNames[i], &values[i]);
+    }
+
+    return SubmitEvent(errMsg, schema->name.c_str(), count,
+            count ? &kvs[0] : NULL, timestamp);
+}
+
+AnalyticsDeviceObject *AnalyticsBusObject::MakeOrFindDev(const char *sender, SessionId sessionId,
+        QStatus &status)
+{
+    uint32_t hash = AnalyticsDeviceTable::Hash(sender);
+
+    status = ER_OK;
+    if (sessionId == 0) {
+        status = ER_BUS_NO_SESSION;
+        return NULL;
+    }
+
+    AnalyticsDeviceObject *dev = devMap.Find(sender, hash);
+    if (!dev) {
+        /*
+         * the call can beat the application's SessionJoined; record the
+         * membership now.  Only names we will see leave get a device.
+         */
+        if (memberships.find(sender) == memberships.end() &&
+                !JoinSession(sessionId, sender)) {
+            status = ER_BUS_NO_SESSION;
+            return NULL;
+        }
+        dev = factory->Construct();
+        if (dev && !devMap.Insert(sender, hash, dev)) {
+            factory->Destroy(dev);
+            dev = NULL;
+        }
+        if (dev) {
+            dev->stats = stats;
+            dev->errorWindowStart = 0;
+            dev->errorsInWindow = 0;
+            dev->errorsSuppressed = 0;
+            dev->handlers = 0;
+        }
+    }
 
     return dev;
 }
 
+void AnalyticsBusObject::Dispatch(DeviceHandler handler,
+        const InterfaceDescription::Member *member, const char *sender,
+        SessionId sessionId, Message &msg, const EventArgs *event)
+{
+    ANALYTICS_TRACE_SCOPE(dispatch);
+
+    uint64_t now = qcc::GetTimestamp64();
+    uint64_t received = stats ? AnalyticsStats::NowMicros() : 0;
+
+    QStatus status;
+    devLock.Lock();
+    AnalyticsDeviceObject *dev = MakeOrFindDev(sender, sessionId, status);
+    if (ER_OK != status) {
+        devLock.Unlock();
+        ReplyStatus(msg, status, "not in an analytics session", member->name.c_str());
+        return;
+    }
+    if (dev) {
+        dev->lastActive = now;
+        dev->idle = false;
+    }
+    if (dev && executor) {
+        /* posted under devLock, so it cannot land behind the ShutdownTask. */
+        qcc::IncrementAndFetch(&pendingTasks);
+        dev->strand.Post(*executor, new DeviceTask(*this, handler, member, msg, event, dev, now, received));
+        devLock.Unlock();
+        return;
+    }
+    if (dev) {
+        /* keeps the drain and CompactIdle off dev until the handler returns. */
+        qcc::IncrementAndFetch(&dev->handlers);
+    }
+    devLock.Unlock();
+
+    RunHandler(handler, dev, member, msg, event, received);
+    if (dev) {
+        qcc::DecrementAndFetch(&dev->handlers);
+    }
+}
+
+void AnalyticsBusObject::RunHandler(DeviceHandler handler, AnalyticsDeviceObject *dev,
+        const InterfaceDescription::Member *member, Message &msg,
+        const EventArgs *event, uint64_t received)
+{
+    ANALYTICS_TRACE_SCOPE(handle);
+
+    uint64_t start = executor ? 0 : qcc::GetTimestamp64();
+    (this->*handler)(dev, member, msg, event);
+    if (!executor) {
+        /* nothing queues the call, so its time in the handler is its latency. */
+        NoteLatency((uint32_t)(qcc::GetTimestamp64() - start));
+    }
+    if (dev) {
+        MeasureDev(dev);
+    }
+
+    if (stats && (handler == &AnalyticsBusObject::DoSubmitEvent ||
+                handler == &AnalyticsBusObject::DoSubmitEvents ||
+                handler == &AnalyticsBusObject::DoSubmitCompactEvent)) {
+        stats->Record(ANALYTICS_SUBMIT_LATENCY, AnalyticsStats::NowMicros() - received);
+    }
+}
+
+void AnalyticsBusObject::NoteLatency(uint32_t latencyMs)
+{
+    if (latencyMs > maxLatencyMs) {
+        /* a lost race only loses one sample. */
+        maxLatencyMs = latencyMs;
+    }
+}
+
+void AnalyticsBusObject::DeviceTask::Run()
+{
+    owner.NoteLatency((uint32_t)(qcc::GetTimestamp64() - posted));
+
+    owner.RunHandler(handler, dev, member, msg, event.name ? &event : NULL, received);
+}
+
+void AnalyticsBusObject::DeviceTask::Release()
+{
+    AnalyticsBusObject &o = owner;
+    delete this;
+    qcc::DecrementAndFetch(&o.pendingTasks);
+}
+
+void AnalyticsBusObject::ShutdownDev(AnalyticsDeviceObject *dev)
+{
+    if (executor) {
+        qcc::IncrementAndFetch(&pendingTasks);
+        dev->strand.Post(*executor, new ShutdownTask(*this, dev), true);
+    } else {
+        drain.Enqueue(dev);
+    }
+}
+
+void AnalyticsBusObject::MeasureDev(AnalyticsDeviceObject *dev)
+{
+    dev->footprint = dev->MemoryFootprint();
+    dev->buffered = dev->BufferedBytes();
+}
+
+void AnalyticsBusObject::ShutdownTask::Release()
+{
+    AnalyticsBusObject &o = owner;
+    delete this;
+    qcc::DecrementAndFetch(&o.pendingTasks);
+}
+
+void AnalyticsBusObject::CompactDev(AnalyticsDeviceObject *dev)
+{
+    dev->RequestDeliveryAsync(NULL);
+    dev->Compact();
+    MeasureDev(dev);
+}
+
+void AnalyticsBusObject::CompactTask::Release()
+{
+    AnalyticsBusObject &o = owner;
+    delete this;
+    qcc::DecrementAndFetch(&o.pendingTasks);
+}
+
+uint32_t AnalyticsBusObject::CompactIdle(uint32_t idleMs)
+{
+    uint64_t now = qcc::GetTimestamp64();
+    uint32_t compacted = 0;
+
+    devLock.Lock();
+    for (size_t i = 0; i < devMap.Capacity(); i++) {
+        AnalyticsDeviceObject *dev = devMap.DeviceAt(i);
+        /*
+         * lastActive is when the last call started, so a slow call still
+         * running on a dispatch thread can look idle; leave it alone.
+         */
+        if (!dev || dev->idle || dev->handlers || now - dev->lastActive < idleMs) {
+            continue;
+        }
+        dev->idle = true;
+        compacted++;
+        if (executor) {
+            qcc::IncrementAndFetch(&pendingTasks);
+            dev->strand.Post(*executor, new CompactTask(*this, dev));
+        } else {
+            /*
+             * no handler is running against dev, and Dispatch needs
+             * devLock to start one, so dev is ours until we unlock.
+             */
+            CompactDev(dev);
+        }
+    }
+    devLock.Unlock();
+
+    return compacted;
+}
+
+void AnalyticsBusObject::GetMemoryStats(MemoryStats &stats)
+{
+    stats.devices = 0;
+    stats.idleDevices = 0;
+    stats.totalBytes = 0;
+    stats.maxBytes = 0;
+
+    devLock.Lock();
+    for (size_t i = 0; i < devMap.Capacity(); i++) {
+        AnalyticsDeviceObject *dev = devMap.DeviceAt(i);
+        if (!dev) {
+            continue;
+        }
+        uint32_t bytes = dev->footprint;
+        stats.devices++;
+        if (dev->idle) {
+            stats.idleDevices++;
+        }
+        stats.totalBytes += bytes;
+        if (bytes > stats.maxBytes) {
+            stats.maxBytes = bytes;
+        }
+    }
+    devLock.Unlock();
+}
+
+uint32_t AnalyticsBusObject::UpdateLoad(LoadStats *stats)
+{
+    uint64_t buffered = factory->DeliveryBytes();
+    uint32_t backlog = factory->DeliveryBacklog();
+    uint32_t latency = maxLatencyMs;
+    maxLatencyMs = 0;
+
+    devLock.Lock();
+    for (size_t i = 0; i < devMap.Capacity(); i++) {
+        AnalyticsDeviceObject *dev = devMap.DeviceAt(i);
+        if (dev) {
+            buffered += dev->buffered;
+        }
+    }
+    devLock.Unlock();
+
+    uint64_t load = buffered * 100 / ANALYTICS_LOAD_MAX_BUFFERED_BYTES;
+    uint64_t l = (uint64_t)backlog * 100 / ANALYTICS_LOAD_MAX_DELIVERY_BACKLOG;
+    if (l > load) {
+        load = l;
+    }
+    l = (uint64_t)latency * 100 / ANALYTICS_LOAD_MAX_LATENCY_MS;
+    if (l > load) {
+        load = l;
+    }
+
+    /* load at which each level starts. */
+    static const uint32_t start[] = { 0, 50, 75, 100 };
+    uint32_t level = loadLevel;
+    uint64_t now = qcc::GetTimestamp64();
+
+    uint32_t target = ANALYTICS_LOAD_NORMAL;
+    while (target < ANALYTICS_LOAD_NO_DELIVERY && load >= start[target + 1]) {
+        target++;
+    }
+    if (target > level) {
+        level = target;
+    } else if (target < level && now - levelChangedAt >= ANALYTICS_LOAD_HOLD_MS) {
+        /* step down only as far as the hysteresis allows. */
+        while (level > target && load + ANALYTICS_LOAD_HYSTERESIS < start[level]) {
+            level--;
+        }
+    }
+
+    if (level != (uint32_t)loadLevel) {
+        loadLevel = level;
+        levelChangedAt = now;
+
+        MsgArg arg("u", level);
+        Signal(NULL, SESSION_ID_ALL_HOSTED, *throttleMember, &arg, 1);
+        EmitPropChanged(ifName.c_str(), "LoadLevel", arg, SESSION_ID_ALL_HOSTED);
+    }
+
+    if (stats) {
+        stats->level = level;
+        stats->load = load > 0xffffffff ? 0xffffffff : (uint32_t)load;
+        stats->bufferedBytes = buffered;
+        stats->deliveryBacklog = backlog;
+        stats->latencyMs = latency;
+    }
+    return level;
+}
+
+QStatus AnalyticsBusObject::Get(const char *ifcName, const char *propName, MsgArg &val)
+{
+    if (ifName == ifcName && 0 == strcmp(propName, "LoadLevel")) {
+        return val.Set("u", (uint32_t)loadLevel);
+    }
+    return ER_BUS_NO_SUCH_PROPERTY;
+}
+
 AnalyticsBusObject::~AnalyticsBusObject()
 {
-    std::map<std::string,AnalyticsDeviceObject *>::iterator it;
-    for (it = devMap.begin(); it != devMap.end(); ++it) {
-        it->second->Shutdown();
+    std::vector<SessionId> ids;
+
+    devLock.Lock();
+    std::map<SessionId, std::vector<qcc::String> >::iterator it;
+    for (it = sessions.begin(); it != sessions.end(); ++it) {
+        ids.push_back(it->first);
+    }
+    devLock.Unlock();
+
+    for (size_t i = 0; i < ids.size(); i++) {
+        bus.SetSessionListener(ids[i], NULL);
+    }
+
+    devLock.Lock();
+    for (size_t i = 0; i < devMap.Capacity(); i++) {
+        AnalyticsDeviceObject *dev = devMap.DeviceAt(i);
+        if (dev) {
+            ShutdownDev(dev);
+        }
+    }
+    devLock.Unlock();
+
+    /* outstanding tasks and deliveries hold a reference to this object. */
+    while (pendingTasks || pendingReplies) {
+        qcc::Sleep(10);
     }
-    bus.UnregisterBusListener(*this);
 }
 
 void AnalyticsBusObject::SetVendorDataOrDeviceData(const ajn::InterfaceDescription::Member *member, Message &msg)
 {
-    AnalyticsDeviceObject *dev= MakeOrFindDev(msg);
+    Dispatch(&AnalyticsBusObject::DoSetVendorDataOrDeviceData, member, msg->GetSender(), msg->GetSessionId(), msg);
+}
+
+void AnalyticsBusObject::RequestDelivery(const InterfaceDescription::Member *, Message &msg)
+{
+    RequestDeliveryFrom(msg->GetSender(), msg->GetSessionId(), msg);
+}
+
+void AnalyticsBusObject::RequestDeliveryFrom(const char *sender, SessionId sessionId, Message &msg)
+{
+    Dispatch(&AnalyticsBusObject::DoRequestDelivery, requestDeliveryMember, sender, sessionId, msg);
+}
+
+void AnalyticsBusObject::SubmitEvent(const InterfaceDescription::Member *, Message &msg)
+{
+    EventArgs event;
+    size_t asize;
+    QStatus status = msg->GetArgs("stua{sv}", &event.name, &event.timestamp,
+            &event.sequence, &asize, &event.kvs);
+    if (ER_OK != status) {
+        ReplyStatus(msg, status, "expecting stua{sv}", "SubmitEvent");
+        return;
+    }
+    event.count = (uint32_t)asize;
+
+    SubmitEventFrom(msg->GetSender(), msg->GetSessionId(), event, msg);
+}
+
+void AnalyticsBusObject::SubmitEventFrom(const char *sender, SessionId sessionId,
+        const EventArgs &event, Message &msg)
+{
+    /*
+     * callers outside a session are left for Dispatch to refuse; for the
+     * rest a dropped event costs no device lookup or task.
+     */
+    if (sessionId != 0) {
+        if (filter && !filter->Keep(sender, event.name, event.sequence, event.count, event.kvs)) {
+            ReplyStatus(msg, ER_OK, NULL);
+            return;
+        }
+        if (sketches) {
+            sketches->Add(sender, event.name, event.count, event.kvs);
+        }
+    }
+
+    Dispatch(&AnalyticsBusObject::DoSubmitEvent, submitEventMember, sender, sessionId, msg, &event);
+}
+
+void AnalyticsBusObject::SubmitEvents(const InterfaceDescription::Member *member, Message &msg)
+{
+    Dispatch(&AnalyticsBusObject::DoSubmitEvents, member, msg->GetSender(), msg->GetSessionId(), msg);
+}
+
+void AnalyticsBusObject::RegisterEventSchema(const InterfaceDescription::Member *member, Message &msg)
+{
+    Dispatch(&AnalyticsBusObject::DoRegisterEventSchema, member, msg->GetSender(), msg->GetSessionId(), msg);
+}
+
+void AnalyticsBusObject::SubmitCompactEvent(const InterfaceDescription::Member *member, Message &msg)
+{
+    Dispatch(&AnalyticsBusObject::DoSubmitCompactEvent, member, msg->GetSender(), msg->GetSessionId(), msg);
+}
+
+void AnalyticsBusObject::GetSketches(const InterfaceDescription::Member *, Message &msg)
+{
+    std::vector<MsgArg> events, devices, keys;
+
+    /* the replies point into top. */
+    AnalyticsTopK top[2];
+    if (sketches) {
+        AnalyticsSketches::KeyCount counts[ANALYTICS_SKETCH_KEYS];
+        size_t nkeys;
+        sketches->Get(top[0], top[1], counts, nkeys);
+
+        for (size_t i = 0; i < top[0].Size(); i++) {
+            events.push_back(MsgArg("(stt)", top[0][i].name, top[0][i].count, top[0][i].error));
+        }
+        for (size_t i = 0; i < top[1].Size(); i++) {
+            devices.push_back(MsgArg("(stt)", top[1][i].name, top[1][i].count, top[1][i].error));
+        }
+        for (size_t i = 0; i < nkeys; i++) {
+            keys.push_back(MsgArg("(st)", counts[i].key, counts[i].distinct));
+        }
+    }
+
+    MsgArg reply[3];
+    reply[0].Set("a(stt)", events.size(), events.empty() ? NULL : &events[0]);
+    reply[1].Set("a(stt)", devices.size(), devices.empty() ? NULL : &devices[0]);
+    reply[2].Set("a(st)", keys.size(), keys.empty() ? NULL : &keys[0]);
+    MethodReply(msg, reply, 3);
+}
+
+/* a histogram as (count, p50, p99, p99.9, max, a(bucket top, count)). */
+static void HistogramArg(const AnalyticsHistogram &h, std::vector<MsgArg> &buckets, MsgArg &arg)
+{
+    for (size_t i = 0; i < ANALYTICS_HIST_BUCKETS; i++) {
+        if (h.Bucket(i)) {
+            buckets.push_back(MsgArg("(tt)", AnalyticsHistogram::High(i), h.Bucket(i)));
+        }
+    }
+    arg.Set("(ttttta(tt))", h.Count(), h.Percentile(0.5), h.Percentile(0.99),
+            h.Percentile(0.999), h.Max(), buckets.size(), buckets.empty() ? NULL : &buckets[0]);
+}
+
+/* orders (buffered bytes, name) pairs largest first. */
+static bool MoreBuffered(const std::pair<uint32_t, qcc::String> &a,
+        const std::pair<uint32_t, qcc::String> &b)
+{
+    return a.first > b.first;
+}
+
+void AnalyticsBusObject::GetStats(const InterfaceDescription::Member *, Message &msg)
+{
+    if (!stats) {
+        MsgArg reply("a{sv}", 0, NULL);
+        MethodReply(msg, &reply, 1);
+        return;
+    }
+
+    /* about 5KB with its histograms; keep it off the dispatch thread's stack. */
+    AnalyticsStats::Snapshot *snap = new AnalyticsStats::Snapshot;
+    stats->Read(*snap);
+
+    uint64_t buffered = 0;
+    std::vector<std::pair<uint32_t, qcc::String> > devices;
+    devLock.Lock();
+    for (size_t i = 0; i < devMap.Capacity(); i++) {
+        AnalyticsDeviceObject *dev = devMap.DeviceAt(i);
+        if (dev && dev->buffered) {
+            buffered += dev->buffered;
+            devices.push_back(std::make_pair((uint32_t)dev->buffered, qcc::String(devMap.NameAt(i))));
+        }
+    }
+    devLock.Unlock();
+
+    if (devices.size() > ANALYTICS_STATS_MAX_DEVICES) {
+        std::partial_sort(devices.begin(), devices.begin() + ANALYTICS_STATS_MAX_DEVICES,
+                devices.end(), MoreBuffered);
+        devices.resize(ANALYTICS_STATS_MAX_DEVICES);
+    } else {
+        std::sort(devices.begin(), devices.end(), MoreBuffered);
+    }
+    std::vector<MsgArg> deviceArgs;
+    for (size_t i = 0; i < devices.size(); i++) {
+        deviceArgs.push_back(MsgArg("(st)", devices[i].second.c_str(), (uint64_t)devices[i].first));
+    }
+
+    uint64_t deliveryBytes = factory->DeliveryBytes();
+    uint32_t backlog = factory->DeliveryBacklog();
+    AnalyticsFilter::Stats filterStats = { 0, 0 };
+    if (filter) {
+        filter->GetStats(filterStats);
+    }
+
+    /* the scalar stats, as ANALYTICS_STAT(key, signature, value). */
+#define ANALYTICS_SCALAR_STATS \
+    ANALYTICS_STAT("uptimeMs", "t", snap->uptimeMs) \
+    ANALYTICS_STAT("events", "t", snap->counters[ANALYTICS_EVENTS]) \
+    ANALYTICS_STAT("eventsFailed", "t", snap->counters[ANALYTICS_EVENTS_FAILED]) \
+    ANALYTICS_STAT("eventsDropped", "t", filterStats.dropped) \
+    ANALYTICS_STAT("eventsPerSec", "d", snap->eventsPerSec) \
+    ANALYTICS_STAT("bytesEncoded", "t", snap->counters[ANALYTICS_BYTES_ENCODED]) \
+    ANALYTICS_STAT("bytesEncodedPerSec", "d", snap->bytesEncodedPerSec) \
+    ANALYTICS_STAT("bufferedBytes", "t", buffered + deliveryBytes) \
+    ANALYTICS_STAT("deviceBufferedBytes", "t", buffered) \
+    ANALYTICS_STAT("deliveryBufferedBytes", "t", deliveryBytes) \
+    ANALYTICS_STAT("deliveryBacklog", "u", backlog) \
+    ANALYTICS_STAT("deliveries", "t", snap->counters[ANALYTICS_DELIVERIES]) \
+    ANALYTICS_STAT("deliveryFailures", "t", snap->counters[ANALYTICS_DELIVERY_FAILURES]) \
+    ANALYTICS_STAT("bytesDelivered", "t", snap->counters[ANALYTICS_BYTES_DELIVERED])
+
+    /* the scalars, then devices, submitLatency and deliveryLatency. */
+#define ANALYTICS_STAT(key, sig, value) + 1
+    enum { STATS_ENTRIES = 0 ANALYTICS_SCALAR_STATS + 3 };
+#undef ANALYTICS_STAT
+
+    MsgArg values[STATS_ENTRIES];
+    MsgArg entries[STATS_ENTRIES];
+    std::vector<MsgArg> buckets[ANALYTICS_LATENCIES];
+    size_t n = 0;
+
+#define ANALYTICS_STAT(key, sig, value) \
+    values[n].Set(sig, value); \
+    entries[n].Set("{sv}", key, &values[n]); \
+    n++;
+
+    ANALYTICS_SCALAR_STATS
+
+#undef ANALYTICS_STAT
+#undef ANALYTICS_SCALAR_STATS
+
+    values[n].Set("a(st)", deviceArgs.size(), deviceArgs.empty() ? NULL : &deviceArgs[0]);
+    entries[n].Set("{sv}", "devices", &values[n]);
+    n++;
+
+    HistogramArg(snap->latency[ANALYTICS_SUBMIT_LATENCY], buckets[ANALYTICS_SUBMIT_LATENCY], values[n]);
+    entries[n].Set("{sv}", "submitLatency", &values[n]);
+    n++;
+    HistogramArg(snap->latency[ANALYTICS_DELIVERY_LATENCY], buckets[ANALYTICS_DELIVERY_LATENCY], values[n]);
+    entries[n].Set("{sv}", "deliveryLatency", &values[n]);
+    n++;
+    assert(n == STATS_ENTRIES);
+
+    MsgArg reply("a{sv}", n, entries);
+    MethodReply(msg, &reply, 1);
+
+    delete snap;
+}
+
+void AnalyticsBusObject::DoSetVendorDataOrDeviceData(AnalyticsDeviceObject *dev,
+        const ajn::InterfaceDescription::Member *member, Message &msg, const EventArgs *)
+{
     if (!dev) {
-        MethodReply(msg, (const MsgArg*)NULL, 0);
+        ReplyStatus(msg, ER_OK, NULL);
         return;
     }
 
@@ -55,7 +635,7 @@ void AnalyticsBusObject::SetVendorDataOrDeviceData(const ajn::InterfaceDescripti
     const MsgArg *entries;
     size_t asize;
     if (!arg0 || ER_OK != arg0->Get("a{sv}", &asize, &entries)) {
-        MethodReply(msg, QCC_StatusText(ER_BAD_ARG_1), "expecting a{sv}");
+        ReplyStatus(msg, ER_BAD_ARG_1, "expecting a{sv}", member->name.c_str());
         return;
     }
 
@@ -67,63 +647,360 @@ void AnalyticsBusObject::SetVendorDataOrDeviceData(const ajn::InterfaceDescripti
         status = dev->SetDeviceData(&err, asize, entries);
     }
 
-    if (status == ER_OK) {
-        MethodReply(msg, (MsgArg*)NULL, 0);
-    } else {
-        MethodReply(msg, QCC_StatusText(status), err);
+    ReplyStatus(msg, status, err, member->name.c_str());
+}
+
+void AnalyticsBusObject::DoRequestDelivery(AnalyticsDeviceObject *dev,
+        const InterfaceDescription::Member *, Message &msg, const EventArgs *)
+{
+    if (!dev) {
+        ReplyStatus(msg, ER_OK, NULL);
+        return;
     }
+
+    if (loadLevel >= ANALYTICS_LOAD_NO_DELIVERY || msg->GetType() != MESSAGE_METHOD_CALL) {
+        /*
+         * don't hold the caller while deliveries are backed up, and
+         * don't wait on a delivery that has no reply to send.
+         */
+        dev->RequestDeliveryAsync(NULL);
+        ReplyStatus(msg, ER_OK, NULL);
+        return;
+    }
+
+    /* the reply is sent by the DeliveryReply once the delivery has finished. */
+    qcc::IncrementAndFetch(&pendingReplies);
+    dev->RequestDeliveryAsync(new DeliveryReply(*this, msg));
 }
 
-void AnalyticsBusObject::RequestDelivery(const InterfaceDescription::Member *, Message &msg)
+void AnalyticsBusObject::DeliveryReply::Complete(QStatus status, const char *errMsg)
+{
+    owner.ReplyStatus(msg, status, errMsg, "RequestDelivery");
+    qcc::DecrementAndFetch(&owner.pendingReplies);
+    delete this;
+}
+
+void AnalyticsBusObject::DoSubmitEvent(AnalyticsDeviceObject *dev,
+        const InterfaceDescription::Member *, Message &msg, const EventArgs *event)
 {
-    AnalyticsDeviceObject *dev= MakeOrFindDev(msg);
     if (!dev) {
-        MethodReply(msg, (MsgArg*)NULL, 0);
+        ReplyStatus(msg, ER_OK, NULL);
         return;
     }
-    dev->RequestDelivery();
-    MethodReply(msg, (MsgArg*)NULL, 0);
+
+    const char *err;
+    QStatus status = dev->SubmitEvent(&err, event->name, event->count, event->kvs,
+            event->timestamp);
+    if (stats) {
+        stats->Add(ER_OK == status ? ANALYTICS_EVENTS : ANALYTICS_EVENTS_FAILED);
+    }
+
+    ReplyStatus(msg, status, err, event->name, event->sequence);
 }
 
-void AnalyticsBusObject::SubmitEvent(const InterfaceDescription::Member *, Message &msg)
+void AnalyticsBusObject::DoRegisterEventSchema(AnalyticsDeviceObject *dev,
+        const InterfaceDescription::Member *, Message &msg, const EventArgs *)
 {
-    AnalyticsDeviceObject *dev = MakeOrFindDev(msg);
     if (!dev) {
-        MethodReply(msg, (MsgArg*)NULL, 0);
+        /* a bare success would not match the u reply signature. */
+        ReplyStatus(msg, ER_OUT_OF_MEMORY, "out of memory", "RegisterEventSchema");
         return;
     }
 
     const char *name;
+    size_t nkeys;
+    const MsgArg *keyArgs;
+    const char *types;
+
+    QStatus status = msg->GetArgs("sass", &name, &nkeys, &keyArgs, &types);
+    if (ER_OK != status) {
+        ReplyStatus(msg, status, "expecting sass", "RegisterEventSchema");
+        return;
+    }
+
+    std::vector<const char *> keys(nkeys);
+    for (size_t i = 0; i < nkeys; i++) {
+        keys[i] = keyArgs[i].v_string.str;
+    }
+
+    const char *err;
+    uint32_t id = 0;
+    status = dev->RegisterEventSchema(&err, name, nkeys,
+            nkeys ? &keys[0] : NULL, types, id);
+
+    if (ER_OK != status || (msg->GetFlags() & ALLJOYN_FLAG_NO_REPLY_EXPECTED)) {
+        ReplyStatus(msg, status, err, name);
+        return;
+    }
+
+    MsgArg reply("u", id);
+    MethodReply(msg, &reply, 1);
+}
+
+void AnalyticsBusObject::DoSubmitCompactEvent(AnalyticsDeviceObject *dev,
+        const InterfaceDescription::Member *, Message &msg, const EventArgs *)
+{
+    if (!dev) {
+        ReplyStatus(msg, ER_OK, NULL);
+        return;
+    }
+
+    uint32_t id;
     uint64_t timestamp;
     uint32_t sequence;
-    size_t asize;
-    const MsgArg *kvs;
+    size_t count;
+    const MsgArg *values;
 
-    QStatus status = msg->GetArgs("stua{sv}", &name, &timestamp,
-            &sequence, &asize, &kvs);
+    QStatus status = msg->GetArgs("utuav", &id, &timestamp,
+            &sequence, &count, &values);
     if (ER_OK != status) {
-        MethodReply(msg, status);
+        ReplyStatus(msg, status, "expecting utuav", "SubmitCompactEvent");
         return;
     }
 
-    const char *err;
-    status = dev->SubmitEvent(&err, name, asize, kvs, timestamp);
+    const AnalyticsEventSchema *schema = dev->FindEventSchema(id);
+    if (schema && schema->keys.size() == count && (filter || sketches)) {
+        const char *const *keys = count ? &schema->keyNames[0] : NULL;
+        if (filter && !filter->Keep(msg->GetSender(), schema->name.c_str(), sequence,
+                    count, values, keys)) {
+            ReplyStatus(msg, ER_OK, NULL);
+            return;
+        }
+        if (sketches) {
+            sketches->Add(msg->GetSender(), schema->name.c_str(), count, values, keys);
+        }
+    }
 
-    if (status == ER_OK) {
-        MethodReply(msg, (MsgArg*)NULL, 0);
-    } else {
-        MethodReply(msg, QCC_StatusText(status), err);
+    const char *err;
+    status = dev->SubmitCompactEvent(&err, id, count, values, timestamp);
+    if (stats) {
+        stats->Add(ER_OK == status ? ANALYTICS_EVENTS : ANALYTICS_EVENTS_FAILED);
     }
+
+    ReplyStatus(msg, status, err, schema ? schema->name.c_str() : "SubmitCompactEvent", sequence);
 }
 
-void AnalyticsBusObject::NameOwnerChanged(const char *busName,
-        const char *previousOwner, const char *newOwner)
+void AnalyticsBusObject::DoSubmitEvents(AnalyticsDeviceObject *dev,
+        const InterfaceDescription::Member *, Message &msg, const EventArgs *)
 {
-    AnalyticsDeviceObject *dev = devMap[busName];
     if (!dev) {
+        /* a bare success would not match the a(uss) reply signature. */
+        ReplyStatus(msg, ER_OUT_OF_MEMORY, "out of memory", "SubmitEvents");
+        return;
+    }
+
+    size_t count;
+    const MsgArg *records;
+
+    QStatus status = msg->GetArgs("a(stua{sv})", &count, &records);
+    if (ER_OK != status) {
+        ReplyStatus(msg, status, "expecting a(stua{sv})", "SubmitEvents");
+        return;
+    }
+
+    bool noReply = (msg->GetFlags() & ALLJOYN_FLAG_NO_REPLY_EXPECTED) != 0;
+    std::vector<MsgArg> failures;
+
+    for (size_t i = 0; i < count; i++) {
+        const char *name;
+        uint64_t timestamp;
+        uint32_t sequence;
+        size_t asize;
+        const MsgArg *kvs;
+        const char *err;
+
+        status = records[i].Get("(stua{sv})", &name, &timestamp,
+                &sequence, &asize, &kvs);
+        if (ER_OK == status) {
+            if (filter && !filter->Keep(msg->GetSender(), name, sequence, asize, kvs)) {
+                continue;
+            }
+            if (sketches) {
+                sketches->Add(msg->GetSender(), name, asize, kvs);
+            }
+            status = dev->SubmitEvent(&err, name, asize, kvs, timestamp);
+            if (stats) {
+                stats->Add(ER_OK == status ? ANALYTICS_EVENTS : ANALYTICS_EVENTS_FAILED);
+            }
+        } else {
+            name = "SubmitEvents";
+            sequence = 0;
+            err = "expecting (stua{sv})";
+        }
+
+        if (status == ER_OK) {
+            continue;
+        }
+        if (noReply) {
+            SignalError(msg, name, sequence, status, err);
+        } else {
+            failures.push_back(MsgArg("(uss)", (uint32_t)i, QCC_StatusText(status), err));
+        }
+    }
+
+    if (noReply) {
+        return;
+    }
+
+    MsgArg reply("a(uss)", failures.size(), failures.empty() ? NULL : &failures[0]);
+    MethodReply(msg, &reply, 1);
+}
+
+void AnalyticsBusObject::ReplyStatus(Message &msg, QStatus status,
+        const char *err, const char *name, uint32_t sequence)
+{
+    if (msg->GetType() != MESSAGE_METHOD_CALL) {
+        /* a local call, from SubmitEventFrom or RequestDeliveryFrom. */
+        return;
+    }
+
+    if (!(msg->GetFlags() & ALLJOYN_FLAG_NO_REPLY_EXPECTED)) {
+        if (status == ER_OK) {
+            MethodReply(msg, (MsgArg*)NULL, 0);
+        } else {
+            MethodReply(msg, QCC_StatusText(status), err);
+        }
+        return;
+    }
+
+    if (status != ER_OK) {
+        SignalError(msg, name ? name : "", sequence, status, err);
+    }
+}
+
+void AnalyticsBusObject::SignalError(Message &msg, const char *name,
+        uint32_t sequence, QStatus status, const char *err)
+{
+    const char *sender = msg->GetSender();
+    uint32_t suppressed;
+
+    /*
+     * looked up rather than passed in: a DeliveryReply can complete after
+     * its device has gone.
+     */
+    devLock.Lock();
+    AnalyticsDeviceObject *dev = devMap.Find(sender, AnalyticsDeviceTable::Hash(sender));
+    uint64_t &windowStart = dev ? dev->errorWindowStart : errorWindowStart;
+    uint32_t &inWindow = dev ? dev->errorsInWindow : errorsInWindow;
+    uint32_t &suppressedSoFar = dev ? dev->errorsSuppressed : errorsSuppressed;
+
+    uint64_t now = qcc::GetTimestamp64();
+    if (now - windowStart >= 1000) {
+        windowStart = now;
+        inWindow = 0;
+    }
+    if (inWindow >= ANALYTICS_ERROR_SIGNALS_PER_SECOND) {
+        suppressedSoFar++;
+        devLock.Unlock();
         return;
     }
+    inWindow++;
+    suppressed = suppressedSoFar;
+    suppressedSoFar = 0;
+    devLock.Unlock();
+
+    MsgArg args[5];
+    args[0].Set("s", name);
+    args[1].Set("u", sequence);
+    args[2].Set("s", QCC_StatusText(status));
+    args[3].Set("s", err ? err : "");
+    args[4].Set("u", suppressed);
+    Signal(msg->GetSender(), msg->GetSessionId(), *submitErrorMember, args, 5);
+}
+
+void AnalyticsBusObject::AddMember(SessionId id, const char *name)
+{
+    std::vector<qcc::String> &members = sessions[id];
+    for (size_t i = 0; i < members.size(); i++) {
+        if (members[i] == name) {
+            return;
+        }
+    }
+    members.push_back(name);
+    memberships[name]++;
+}
+
+AnalyticsDeviceObject *AnalyticsBusObject::RemoveMember(const qcc::String &name)
+{
+    std::map<qcc::String, uint32_t>::iterator it = memberships.find(name);
+    if (it == memberships.end()) {
+        return NULL;
+    }
+    if (--it->second > 0) {
+        return NULL;
+    }
+    memberships.erase(it);
+    return devMap.Remove(name.c_str(), AnalyticsDeviceTable::Hash(name.c_str()));
+}
+
+bool AnalyticsBusObject::JoinSession(SessionId id, const char *name)
+{
+    if (sessions.find(id) == sessions.end() &&
+            ER_OK != bus.SetSessionListener(id, this)) {
+        /* the session is already gone, or not ours to watch. */
+        return false;
+    }
+    AddMember(id, name);
+    return true;
+}
+
+void AnalyticsBusObject::SessionJoined(SessionId id, const char *joiner)
+{
+    devLock.Lock();
+    JoinSession(id, joiner);
+    devLock.Unlock();
+}
+
+void AnalyticsBusObject::SessionMemberAdded(SessionId id, const char *uniqueName)
+{
+    devLock.Lock();
+    AddMember(id, uniqueName);
+    devLock.Unlock();
+}
+
+void AnalyticsBusObject::SessionMemberRemoved(SessionId id, const char *uniqueName)
+{
+    AnalyticsDeviceObject *dev = NULL;
+
+    devLock.Lock();
+    std::map<SessionId, std::vector<qcc::String> >::iterator it = sessions.find(id);
+    if (it != sessions.end()) {
+        std::vector<qcc::String> &members = it->second;
+        for (size_t i = 0; i < members.size(); i++) {
+            if (members[i] == uniqueName) {
+                dev = RemoveMember(members[i]);
+                members[i] = members.back();
+                members.pop_back();
+                break;
+            }
+        }
+    }
+    devLock.Unlock();
 
-    dev->Shutdown();
-    devMap.erase(busName);
+    if (dev) {
+        ShutdownDev(dev);
+    }
+}
+
+void AnalyticsBusObject::SessionLost(SessionId id, SessionLostReason reason)
+{
+    std::vector<AnalyticsDeviceObject *> gone;
+
+    devLock.Lock();
+    std::map<SessionId, std::vector<qcc::String> >::iterator it = sessions.find(id);
+    if (it != sessions.end()) {
+        std::vector<qcc::String> &members = it->second;
+        for (size_t i = 0; i < members.size(); i++) {
+            AnalyticsDeviceObject *dev = RemoveMember(members[i]);
+            if (dev) {
+                gone.push_back(dev);
+            }
+        }
+        sessions.erase(it);
+    }
+    devLock.Unlock();
+
+    for (size_t i = 0; i < gone.size(); i++) {
+        ShutdownDev(gone[i]);
+    }
 }
@@ -0,0 +1,439 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#include "AnalyticsClient.h"
+#include "Analytics.h"
+
+#include <qcc/time.h>
+
+#include <string.h>
+
+using namespace qcc;
+using namespace ajn;
+
+AnalyticsClient::AnalyticsClient(BusAttachment &bus, const char *ifname,
+        size_t capacity, size_t batch, uint32_t flushMs, unsigned window) :
+    bus(bus),
+    ifname(ifname),
+    batch(batch),
+    flushMs(flushMs),
+    window(window ? window : 1),
+    ring(capacity ? capacity : 1),
+    submittedAt(ring.size()),
+    head(0),
+    queued(0),
+    sequence(0),
+    flushing(false),
+    haveService(false),
+    setupSent(false),
+    deviceDue(false),
+    setupDone(false),
+    setupEpoch(0),
+    setupRetryAt(0),
+    inFlight(0),
+    sender(NULL),
+    stopping(false)
+{
+    if (this->batch == 0) {
+        this->batch = 1;
+    }
+    if (this->batch > ring.size()) {
+        this->batch = ring.size();
+    }
+    memset(&stats, 0, sizeof(stats));
+}
+
+AnalyticsClient::~AnalyticsClient()
+{
+    Stop();
+
+    /* replies still to come refer to this object; each call times out. */
+    lock.Lock();
+    while (inFlight) {
+        idle.Wait(lock);
+    }
+    lock.Unlock();
+}
+
+QStatus AnalyticsClient::Start()
+{
+    QStatus status = AnalyticsBusObject::CreateInterface(bus, ifname.c_str());
+    if (ER_OK != status) {
+        return status;
+    }
+
+    lock.Lock();
+    if (!sender) {
+        stopping = false;
+        sender = new Sender(*this);
+        status = sender->Start();
+        if (ER_OK != status) {
+            delete sender;
+            sender = NULL;
+        }
+    }
+    lock.Unlock();
+    return status;
+}
+
+void AnalyticsClient::Stop(uint32_t timeoutMs)
+{
+    lock.Lock();
+    Sender *s = sender;
+    sender = NULL;
+    stopping = true;
+    wake.Signal();
+    lock.Unlock();
+
+    if (!s) {
+        return;
+    }
+    s->Join();
+    delete s;
+
+    WaitIdle(timeoutMs);
+
+    lock.Lock();
+    while (queued) {
+        ring[head].Clear();
+        head = (head + 1) % ring.size();
+        queued--;
+        stats.dropped++;
+    }
+    lock.Unlock();
+}
+
+QStatus AnalyticsClient::SetService(const char *busName, const char *path, SessionId sessionId)
+{
+    const InterfaceDescription *iface = bus.GetInterface(ifname.c_str());
+    if (!iface) {
+        return ER_BUS_NO_SUCH_INTERFACE;
+    }
+
+    ProxyBusObject service(bus, busName, path, sessionId);
+    QStatus status = service.AddInterface(*iface);
+    if (ER_OK != status) {
+        return status;
+    }
+
+    lock.Lock();
+    proxy = service;
+    haveService = true;
+    RestartSetup();
+    setupRetryAt = 0;
+    wake.Signal();
+    lock.Unlock();
+    return ER_OK;
+}
+
+void AnalyticsClient::ClearService()
+{
+    lock.Lock();
+    proxy = ProxyBusObject();
+    haveService = false;
+    lock.Unlock();
+}
+
+void AnalyticsClient::CopyKVs(std::vector<MsgArg> &to, size_t count, const MsgArg *kvs)
+{
+    to.assign(kvs, kvs + count);
+    for (size_t i = 0; i < to.size(); i++) {
+        to[i].Stabilize();
+    }
+}
+
+void AnalyticsClient::SetVendorData(size_t count, const MsgArg *kvs)
+{
+    lock.Lock();
+    CopyKVs(vendorData, count, kvs);
+    RestartSetup();
+    wake.Signal();
+    lock.Unlock();
+}
+
+void AnalyticsClient::SetDeviceData(size_t count, const MsgArg *kvs)
+{
+    lock.Lock();
+    CopyKVs(deviceData, count, kvs);
+    RestartSetup();
+    wake.Signal();
+    lock.Unlock();
+}
+
+QStatus AnalyticsClient::Submit(const char *name, uint64_t timestamp, size_t count, const MsgArg *kvs)
+{
+    lock.Lock();
+    if (queued == ring.size()) {
+        stats.dropped++;
+        lock.Unlock();
+        return ER_WOULDBLOCK;
+    }
+
+    size_t slot = (head + queued) % ring.size();
+    QStatus status = ring[slot].Set("(stua{sv})", name, timestamp, sequence, count, kvs);
+    if (ER_OK == status) {
+        /* the caller's strings and values may go as soon as we return. */
+        ring[slot].Stabilize();
+        submittedAt[slot] = GetTimestamp64();
+        sequence++;
+        queued++;
+        stats.submitted++;
+        /*
+         * the first event starts the flush timer of a sender waiting with
+         * nothing queued; a full batch goes at once.
+         */
+        if (queued == 1 || queued == batch) {
+            wake.Signal();
+        }
+    }
+    lock.Unlock();
+    return status;
+}
+
+void AnalyticsClient::Flush()
+{
+    lock.Lock();
+    flushing = queued > 0;
+    wake.Signal();
+    lock.Unlock();
+}
+
+bool AnalyticsClient::WaitIdle(uint32_t timeoutMs)
+{
+    uint64_t deadline = GetTimestamp64() + timeoutMs;
+
+    lock.Lock();
+    while (queued || inFlight) {
+        uint64_t now = GetTimestamp64();
+        if (now >= deadline) {
+            break;
+        }
+        idle.TimedWait(lock, (uint32_t)(deadline - now));
+    }
+    bool done = !queued && !inFlight;
+    lock.Unlock();
+    return done;
+}
+
+void AnalyticsClient::GetStats(Stats &out)
+{
+    lock.Lock();
+    out = stats;
+    out.queued = queued;
+    out.inFlight = inFlight;
+    lock.Unlock();
+}
+
+size_t AnalyticsClient::Due(uint64_t now)
+{
+    if (!haveService || !setupDone || !queued || inFlight >= window) {
+        return 0;
+    }
+    if (queued < batch && !flushing && !stopping && now - submittedAt[head] < flushMs) {
+        return 0;
+    }
+
+    /* a call takes a contiguous run of slots; a wrapped ring takes two. */
+    size_t n = queued < batch ? queued : batch;
+    if (n > ring.size() - head) {
+        n = ring.size() - head;
+    }
+    return n;
+}
+
+void AnalyticsClient::RestartSetup()
+{
+    setupSent = false;
+    deviceDue = false;
+    setupDone = false;
+    setupEpoch++;
+}
+
+void AnalyticsClient::SendSetup()
+{
+    bool vendor = !setupSent;
+    std::vector<MsgArg> &data = vendor ? vendorData : deviceData;
+    setupSent = true;
+    deviceDue = false;
+    if (data.empty()) {
+        /* nothing to send for this step; go on to the next. */
+        if (vendor) {
+            deviceDue = true;
+        } else {
+            setupDone = true;
+        }
+        return;
+    }
+
+    ProxyBusObject service = proxy;
+    const char *method = vendor ? "SetVendorData" : "SetDeviceData";
+    uint32_t epoch = setupEpoch;
+    MsgArg arg("a{sv}", data.size(), &data[0]);
+    arg.Stabilize();
+
+    /* counted before the call, since a reply can beat MethodCallAsync back. */
+    inFlight++;
+    lock.Unlock();
+
+    /* the reply handler learns the step, and which setup it was, from the context. */
+    QStatus status = service.MethodCallAsync(ifname.c_str(), method, this,
+            static_cast<MessageReceiver::ReplyHandler>(&AnalyticsClient::SetupReply),
+            &arg, 1, (void *)((uintptr_t)epoch << 1 | (vendor ? 0 : 1)),
+            ANALYTICS_CLIENT_CALL_TIMEOUT);
+
+    lock.Lock();
+    if (ER_OK != status) {
+        QCC_LogError(status, ("Could not send %s", method));
+        inFlight--;
+        /* try again later, unless the service or the data changed meanwhile. */
+        if (epoch == setupEpoch) {
+            RestartSetup();
+            setupRetryAt = GetTimestamp64() + flushMs;
+        }
+        idle.Broadcast();
+    }
+}
+
+void AnalyticsClient::SendLoop()
+{
+    lock.Lock();
+    for (;;) {
+        uint64_t now = GetTimestamp64();
+        if (haveService && (!setupSent || deviceDue)) {
+            if (now < setupRetryAt && stopping) {
+                /* the setup failed; Stop() drops what is still queued. */
+                break;
+            }
+            if (now < setupRetryAt) {
+                wake.TimedWait(lock, (uint32_t)(setupRetryAt - now));
+            } else {
+                SendSetup();
+            }
+            continue;
+        }
+
+        size_t n = Due(now);
+        if (n) {
+            ProxyBusObject service = proxy;
+            size_t first = head;
+            inFlight++;
+            lock.Unlock();
+
+            /* the slots from first are ours until head moves past them. */
+            MsgArg events;
+            QStatus status = events.Set("a(stua{sv})", n, &ring[first]);
+            if (ER_OK == status) {
+                status = service.MethodCallAsync(ifname.c_str(), "SubmitEvents", this,
+                        static_cast<MessageReceiver::ReplyHandler>(&AnalyticsClient::SubmitEventsReply),
+                        &events, 1, (void *)(uintptr_t)n, ANALYTICS_CLIENT_CALL_TIMEOUT);
+            }
+            if (ER_OK == status) {
+                for (size_t i = 0; i < n; i++) {
+                    ring[first + i].Clear();
+                }
+            }
+
+            lock.Lock();
+            if (ER_OK == status) {
+                head = (head + n) % ring.size();
+                queued -= n;
+                if (!queued) {
+                    flushing = false;
+                }
+                stats.calls++;
+                idle.Broadcast();
+            } else {
+                /* the events stay queued; the session may be going away. */
+                QCC_LogError(status, ("SubmitEvents call failed"));
+                inFlight--;
+                wake.TimedWait(lock, flushMs);
+            }
+            continue;
+        }
+
+        if (stopping && (!queued || !haveService)) {
+            break;
+        }
+
+        if (queued && haveService && setupDone && inFlight < window) {
+            uint64_t due = submittedAt[head] + flushMs;
+            wake.TimedWait(lock, due > now ? (uint32_t)(due - now) : 1);
+        } else {
+            wake.Wait(lock);
+        }
+    }
+    lock.Unlock();
+}
+
+ThreadReturn STDCALL AnalyticsClient::Sender::Run(void *arg)
+{
+    client.SendLoop();
+    return 0;
+}
+
+void AnalyticsClient::SubmitEventsReply(Message &reply, void *context)
+{
+    size_t n = (uintptr_t)context;
+    size_t nfailures = 0;
+    const MsgArg *failures;
+    bool ok = reply->GetType() == MESSAGE_METHOD_RET &&
+        ER_OK == reply->GetArgs("a(uss)", &nfailures, &failures);
+
+    if (!ok) {
+        QCC_LogError(ER_FAIL, ("SubmitEvents failed: %s", reply->GetErrorName()));
+    }
+
+    lock.Lock();
+    inFlight--;
+    if (ok) {
+        stats.accepted += n - nfailures;
+        stats.rejected += nfailures;
+    } else {
+        stats.failed += n;
+    }
+    wake.Signal();
+    idle.Broadcast();
+    lock.Unlock();
+}
+
+void AnalyticsClient::SetupReply(Message &reply, void *context)
+{
+    uint32_t epoch = (uint32_t)((uintptr_t)context >> 1);
+    bool vendor = ((uintptr_t)context & 1) == 0;
+    bool ok = reply->GetType() == MESSAGE_METHOD_RET;
+    if (!ok) {
+        QCC_LogError(ER_FAIL, ("%s failed: %s", vendor ? "SetVendorData" : "SetDeviceData",
+                reply->GetErrorName()));
+    }
+
+    lock.Lock();
+    inFlight--;
+    if (epoch == setupEpoch) {
+        if (!ok) {
+            /* events wait while the setup is sent again. */
+            RestartSetup();
+            setupRetryAt = GetTimestamp64() + flushMs;
+        } else if (vendor) {
+            deviceDue = true;
+        } else {
+            setupDone = true;
+        }
+    }
+    wake.Signal();
+    idle.Broadcast();
+    lock.Unlock();
+}
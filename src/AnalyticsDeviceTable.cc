@@ -0,0 +1,170 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#include "AnalyticsDeviceTable.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* initial number of slots; must be a power of two. */
+#define INITIAL_CAPACITY 64
+
+/* grow when the table would become more than 70% full. */
+#define OVERLOADED(count, capacity) ((count) * 10 > (capacity) * 7)
+
+AnalyticsDeviceTable::AnalyticsDeviceTable() :
+    slots(NULL),
+    capacity(0),
+    count(0)
+{
+}
+
+AnalyticsDeviceTable::~AnalyticsDeviceTable()
+{
+    for (size_t i = 0; i < capacity; i++) {
+        free(slots[i].name);
+    }
+    free(slots);
+}
+
+uint32_t AnalyticsDeviceTable::Hash(const char *name)
+{
+    /* FNV-1a, followed by a finalizer so the low bits are well mixed. */
+    uint32_t h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+size_t AnalyticsDeviceTable::Probe(const char *name, uint32_t hash) const
+{
+    size_t mask = capacity - 1;
+    size_t i = hash & mask;
+
+    while (slots[i].dev) {
+        if (slots[i].hash == hash && 0 == strcmp(slots[i].name, name)) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+AnalyticsDeviceObject *AnalyticsDeviceTable::Find(const char *name, uint32_t hash) const
+{
+    if (!count) {
+        return NULL;
+    }
+    return slots[Probe(name, hash)].dev;
+}
+
+bool AnalyticsDeviceTable::Grow()
+{
+    size_t newCapacity = capacity ? capacity << 1 : INITIAL_CAPACITY;
+    Slot *newSlots = (Slot *) calloc(newCapacity, sizeof(Slot));
+    if (!newSlots) {
+        return false;
+    }
+
+    size_t mask = newCapacity - 1;
+    for (size_t i = 0; i < capacity; i++) {
+        if (!slots[i].dev) {
+            continue;
+        }
+        size_t j = slots[i].hash & mask;
+        while (newSlots[j].dev) {
+            j = (j + 1) & mask;
+        }
+        newSlots[j] = slots[i];
+    }
+
+    free(slots);
+    slots = newSlots;
+    capacity = newCapacity;
+    return true;
+}
+
+bool AnalyticsDeviceTable::Insert(const char *name, uint32_t hash, AnalyticsDeviceObject *dev)
+{
+    if (!dev) {
+        return false;
+    }
+    if ((!capacity || OVERLOADED(count + 1, capacity)) && !Grow()) {
+        return false;
+    }
+
+    size_t len = strlen(name);
+    char *interned = (char *) malloc(len + 1);
+    if (!interned) {
+        return false;
+    }
+    memcpy(interned, name, len + 1);
+
+    size_t i = Probe(name, hash);
+    slots[i].hash = hash;
+    slots[i].name = interned;
+    slots[i].dev = dev;
+    count++;
+    return true;
+}
+
+AnalyticsDeviceObject *AnalyticsDeviceTable::Remove(const char *name, uint32_t hash)
+{
+    if (!count) {
+        return NULL;
+    }
+
+    size_t mask = capacity - 1;
+    size_t i = Probe(name, hash);
+    AnalyticsDeviceObject *dev = slots[i].dev;
+    if (!dev) {
+        return NULL;
+    }
+    free(slots[i].name);
+
+    /*
+     * backward-shift deletion: move later members of the probe run into
+     * the hole unless they already sit at or after their home slot,
+     * so no tombstones are needed.
+     */
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!slots[j].dev) {
+            break;
+        }
+        size_t home = slots[j].hash & mask;
+        bool movable = (i <= j) ? (home <= i || home > j) : (home <= i && home > j);
+        if (movable) {
+            slots[i] = slots[j];
+            i = j;
+        }
+    }
+
+    slots[i].hash = 0;
+    slots[i].name = NULL;
+    slots[i].dev = NULL;
+    count--;
+    return dev;
+}
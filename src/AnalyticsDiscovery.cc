@@ -0,0 +1,393 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#include "AnalyticsDiscovery.h"
+#include "Analytics.h"
+
+#include <qcc/time.h>
+
+#include <vector>
+
+using namespace qcc;
+using namespace ajn;
+
+AnalyticsDiscovery::AnalyticsDiscovery(BusAttachment &bus, AnalyticsClient &client,
+        const char *ifname) :
+    bus(bus),
+    client(client),
+    ifname(ifname),
+    sessionId(0),
+    retired(0),
+    retiredAt(0),
+    joining(false),
+    joiner(NULL),
+    stopping(false)
+{
+}
+
+AnalyticsDiscovery::~AnalyticsDiscovery()
+{
+    Stop();
+}
+
+QStatus AnalyticsDiscovery::Start()
+{
+    QStatus status = AnalyticsBusObject::CreateInterface(bus, ifname.c_str());
+    if (ER_OK != status) {
+        return status;
+    }
+
+    lock.Lock();
+    if (joiner) {
+        lock.Unlock();
+        return ER_OK;
+    }
+    key = bus.GetUniqueName();
+    stopping = false;
+    lock.Unlock();
+
+    const InterfaceDescription *iface = bus.GetInterface(ifname.c_str());
+    status = bus.RegisterSignalHandler(this,
+            static_cast<MessageReceiver::SignalHandler>(&AnalyticsDiscovery::Throttle),
+            iface->GetMember("Throttle"), NULL);
+    if (ER_OK != status) {
+        return status;
+    }
+    bus.RegisterAboutListener(*this);
+
+    lock.Lock();
+    joiner = new Joiner(*this);
+    status = joiner->Start();
+    if (ER_OK != status) {
+        delete joiner;
+        joiner = NULL;
+    }
+    lock.Unlock();
+
+    if (ER_OK != status) {
+        bus.UnregisterAboutListener(*this);
+        bus.UnregisterSignalHandler(this,
+                static_cast<MessageReceiver::SignalHandler>(&AnalyticsDiscovery::Throttle),
+                iface->GetMember("Throttle"), NULL);
+        return status;
+    }
+
+    const char *interfaces[] = { ifname.c_str() };
+    status = bus.WhoImplements(interfaces, 1);
+    if (ER_OK != status) {
+        Stop();
+    }
+    return status;
+}
+
+void AnalyticsDiscovery::Stop()
+{
+    lock.Lock();
+    Joiner *j = joiner;
+    joiner = NULL;
+    stopping = true;
+    wake.Signal();
+    lock.Unlock();
+
+    if (!j) {
+        return;
+    }
+    j->Join();
+    delete j;
+
+    const char *interfaces[] = { ifname.c_str() };
+    bus.CancelWhoImplements(interfaces, 1);
+    bus.UnregisterAboutListener(*this);
+    const InterfaceDescription *iface = bus.GetInterface(ifname.c_str());
+    bus.UnregisterSignalHandler(this,
+            static_cast<MessageReceiver::SignalHandler>(&AnalyticsDiscovery::Throttle),
+            iface->GetMember("Throttle"), NULL);
+
+    lock.Lock();
+    SessionId id = sessionId;
+    SessionId old = retired;
+    sessionId = 0;
+    retired = 0;
+    current.clear();
+    client.ClearService();
+    lock.Unlock();
+
+    if (old) {
+        bus.LeaveSession(old);
+    }
+    if (id) {
+        bus.LeaveSession(id);
+    }
+}
+
+qcc::String AnalyticsDiscovery::Current()
+{
+    qcc::String name;
+    lock.Lock();
+    std::map<qcc::String, Service>::iterator it = services.find(current);
+    if (it != services.end()) {
+        name = it->second.busName;
+    }
+    lock.Unlock();
+    return name;
+}
+
+size_t AnalyticsDiscovery::Services()
+{
+    lock.Lock();
+    size_t n = services.size();
+    lock.Unlock();
+    return n;
+}
+
+void AnalyticsDiscovery::Announced(const char *busName, uint16_t version, SessionPort port,
+        const MsgArg &objectDescriptionArg, const MsgArg &aboutDataArg)
+{
+    AboutObjectDescription aod(objectDescriptionArg);
+    std::vector<const char *> paths(aod.GetPaths(NULL, 0));
+    if (paths.empty()) {
+        return;
+    }
+    aod.GetPaths(&paths[0], paths.size());
+
+    const char *path = NULL;
+    for (size_t i = 0; i < paths.size() && !path; i++) {
+        if (aod.HasInterface(paths[i], ifname.c_str())) {
+            path = paths[i];
+        }
+    }
+    if (!path) {
+        return;
+    }
+
+    /* services that do not announce a load level are taken to be unloaded. */
+    uint32_t level = ANALYTICS_LOAD_NORMAL;
+    MsgArg *value;
+    if (ER_OK == aboutDataArg.GetElement("{sv}", ANALYTICS_ABOUT_LOAD_LEVEL, &value)) {
+        value->Get("u", &level);
+    }
+
+    /* shards go on the ring by shard name, as AnalyticsShards places them. */
+    const char *name = busName;
+    uint32_t capacity = 1;
+    if (ER_OK == aboutDataArg.GetElement("{sv}", ANALYTICS_ABOUT_SHARD, &value)) {
+        value->Get("s", &name);
+        if (ER_OK == aboutDataArg.GetElement("{sv}", ANALYTICS_ABOUT_CAPACITY, &value)) {
+            value->Get("u", &capacity);
+            /* announced by the service, so not trusted. */
+            capacity = AnalyticsHashRing::ClampWeight(capacity);
+        }
+    }
+
+    lock.Lock();
+    std::map<qcc::String, Service>::iterator it;
+    for (it = services.begin(); it != services.end(); ++it) {
+        if (it->second.busName == busName && it->first != name) {
+            /* restarted under another name. */
+            ring.Remove(it->first.c_str());
+            services.erase(it);
+            break;
+        }
+    }
+    it = services.find(name);
+    if (it == services.end()) {
+        it = services.insert(std::make_pair(qcc::String(name), Service())).first;
+    }
+    ring.Add(name, capacity);
+    Service &service = it->second;
+    service.busName = busName;
+    service.path = path;
+    service.port = port;
+    service.level = level;
+    /* it is up, or it could not announce; try it again. */
+    service.failures = 0;
+    service.retryAt = 0;
+    wake.Signal();
+    lock.Unlock();
+}
+
+void AnalyticsDiscovery::SessionLost(SessionId lost, SessionLostReason reason)
+{
+    lock.Lock();
+    if (lost == sessionId) {
+        QCC_DbgPrintf(("Lost session to analytics service %s", current.c_str()));
+        qcc::String name = current;
+        current.clear();
+        sessionId = 0;
+        /* a join under way sets the client's service itself. */
+        if (!joining) {
+            client.ClearService();
+        }
+        Failed(name, GetTimestamp64());
+        wake.Signal();
+    } else if (lost == retired) {
+        retired = 0;
+    }
+    lock.Unlock();
+}
+
+void AnalyticsDiscovery::Throttle(const InterfaceDescription::Member *member,
+        const char *srcPath, Message &msg)
+{
+    uint32_t level;
+    if (ER_OK != msg->GetArgs("u", &level)) {
+        return;
+    }
+
+    const char *sender = msg->GetSender();
+    lock.Lock();
+    for (std::map<qcc::String, Service>::iterator it = services.begin(); it != services.end(); ++it) {
+        if (it->second.busName == sender && it->second.level != level) {
+            it->second.level = level;
+            wake.Signal();
+        }
+    }
+    lock.Unlock();
+}
+
+const char *AnalyticsDiscovery::Choose(uint64_t now)
+{
+    std::vector<const char *> order(ring.Size());
+    if (order.empty()) {
+        return NULL;
+    }
+    size_t n = ring.Lookup(key.c_str(), &order[0], order.size());
+
+    const char *best = NULL;
+    uint32_t bestLevel = 0;
+    bool haveCurrent = false;
+    uint32_t currentLevel = 0;
+    unsigned considered = 0;
+    for (size_t i = 0; i < n && considered < ANALYTICS_DISCOVERY_CHOICES; i++) {
+        const Service &service = services[order[i]];
+        if (service.retryAt > now) {
+            continue;
+        }
+        considered++;
+        if (current == order[i]) {
+            haveCurrent = true;
+            currentLevel = service.level;
+        }
+        if (!best || service.level < bestLevel) {
+            best = order[i];
+            bestLevel = service.level;
+        }
+    }
+
+    if (haveCurrent && currentLevel <= bestLevel + 1) {
+        return current.c_str();
+    }
+    return best;
+}
+
+void AnalyticsDiscovery::Failed(const qcc::String &name, uint64_t now)
+{
+    std::map<qcc::String, Service>::iterator it = services.find(name);
+    if (it == services.end()) {
+        return;
+    }
+    if (++it->second.failures >= ANALYTICS_DISCOVERY_MAX_FAILURES) {
+        ring.Remove(name.c_str());
+        services.erase(it);
+        return;
+    }
+    it->second.retryAt = now + ANALYTICS_DISCOVERY_RETRY_MS;
+}
+
+void AnalyticsDiscovery::JoinLoop()
+{
+    lock.Lock();
+    while (!stopping) {
+        uint64_t now = GetTimestamp64();
+
+        if (retired && now - retiredAt >= ANALYTICS_DISCOVERY_LINGER_MS) {
+            SessionId id = retired;
+            retired = 0;
+            lock.Unlock();
+            bus.LeaveSession(id);
+            lock.Lock();
+            continue;
+        }
+
+        const char *choice = Choose(now);
+        if (choice && current != choice) {
+            qcc::String name = choice;
+            Service service = services[name];
+            joining = true;
+            lock.Unlock();
+
+            SessionOpts opts(SessionOpts::TRAFFIC_MESSAGES, false, SessionOpts::PROXIMITY_ANY, TRANSPORT_ANY);
+            SessionId id = 0;
+            QStatus status = bus.JoinSession(service.busName.c_str(), service.port, this, id, opts);
+            if (ER_OK == status) {
+                status = client.SetService(service.busName.c_str(), service.path.c_str(), id);
+                if (ER_OK != status) {
+                    bus.LeaveSession(id);
+                }
+            }
+
+            lock.Lock();
+            joining = false;
+            if (ER_OK != status) {
+                QCC_LogError(status, ("Could not join analytics service %s", service.busName.c_str()));
+                if (current.empty()) {
+                    client.ClearService();
+                }
+                Failed(name, now);
+                continue;
+            }
+
+            /* calls made over the old session may still be answered there. */
+            SessionId old = retired;
+            retired = sessionId;
+            retiredAt = now;
+            sessionId = id;
+            current = name;
+            std::map<qcc::String, Service>::iterator it = services.find(name);
+            if (it != services.end()) {
+                it->second.failures = 0;
+            }
+            if (old) {
+                lock.Unlock();
+                bus.LeaveSession(old);
+                lock.Lock();
+            }
+            continue;
+        }
+
+        /* sleep until a lingering session is due to go or a service may be retried. */
+        uint64_t until = retired ? retiredAt + ANALYTICS_DISCOVERY_LINGER_MS : 0;
+        for (std::map<qcc::String, Service>::iterator it = services.begin(); it != services.end(); ++it) {
+            if (it->second.retryAt > now && (!until || it->second.retryAt < until)) {
+                until = it->second.retryAt;
+            }
+        }
+        if (until) {
+            wake.TimedWait(lock, (uint32_t)(until - now));
+        } else {
+            wake.Wait(lock);
+        }
+    }
+    lock.Unlock();
+}
+
+ThreadReturn STDCALL AnalyticsDiscovery::Joiner::Run(void *arg)
+{
+    discovery.JoinLoop();
+    return 0;
+}
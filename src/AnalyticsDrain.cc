@@ -0,0 +1,142 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#include "Analytics.h"
+
+#include <qcc/time.h>
+
+using namespace qcc;
+
+AnalyticsDrainQueue::AnalyticsDrainQueue(AnalyticsDeviceObject::Factory *factory,
+        unsigned threads, uint32_t timeoutMs) :
+    factory(factory),
+    timeoutMs(timeoutMs),
+    inFlight(0),
+    stopping(false),
+    expired(0)
+{
+    if (threads == 0) {
+        threads = 1;
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        Worker *worker = new Worker(*this);
+        if (ER_OK == worker->Start()) {
+            workers.push_back(worker);
+        } else {
+            delete worker;
+        }
+    }
+}
+
+AnalyticsDrainQueue::~AnalyticsDrainQueue()
+{
+    lock.Lock();
+    stopping = true;
+    ready.Broadcast();
+    lock.Unlock();
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->Join();
+        delete workers[i];
+    }
+
+    /* nothing could be started; tear down whatever is left from here. */
+    while (!jobs.empty()) {
+        Job job = jobs.front();
+        jobs.pop_front();
+        Retire(job);
+    }
+}
+
+void AnalyticsDrainQueue::Enqueue(AnalyticsDeviceObject *dev)
+{
+    Job job;
+    job.dev = dev;
+    job.deadline = GetTimestamp64() + timeoutMs;
+
+    lock.Lock();
+    jobs.push_back(job);
+    ready.Signal();
+    lock.Unlock();
+}
+
+size_t AnalyticsDrainQueue::Depth()
+{
+    lock.Lock();
+    size_t depth = jobs.size() + inFlight;
+    lock.Unlock();
+    return depth;
+}
+
+bool AnalyticsDrainQueue::Next(Job &job)
+{
+    lock.Lock();
+    while (jobs.empty() && !stopping) {
+        ready.Wait(lock);
+    }
+    if (jobs.empty()) {
+        lock.Unlock();
+        return false;
+    }
+    job = jobs.front();
+    jobs.pop_front();
+    inFlight++;
+    lock.Unlock();
+    return true;
+}
+
+void AnalyticsDrainQueue::Retire(Job &job)
+{
+    AnalyticsDeviceObject *dev = job.dev;
+
+    /*
+     * without an executor a handler may still be running on a dispatch
+     * thread; the device is out of the table, so none can start.
+     */
+    while (dev->handlers) {
+        Sleep(1);
+    }
+
+    uint64_t now = GetTimestamp64();
+
+    if (now < job.deadline) {
+        dev->SetDeliveryTimeout((uint32_t)(job.deadline - now));
+        dev->Shutdown();
+    } else {
+        IncrementAndFetch(&expired);
+        QCC_LogError(ER_TIMEOUT, ("Device torn down without a flush; drain deadline passed"));
+    }
+
+    /* the executor is done with the strand; ready it for the next user. */
+    dev->strand.Reset();
+    factory->Destroy(dev);
+}
+
+ThreadReturn STDCALL AnalyticsDrainQueue::Worker::Run(void *arg)
+{
+    Job job;
+    while (queue.Next(job)) {
+        queue.Retire(job);
+
+        queue.lock.Lock();
+        queue.inFlight--;
+        queue.lock.Unlock();
+    }
+    return 0;
+}
@@ -0,0 +1,333 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#include "AnalyticsExecutor.h"
+
+using namespace qcc;
+
+/*
+ * free task storage, each block ANALYTICS_TASK_BYTES long.  A function
+ * static, so tasks can be made during static initialization.
+ */
+struct AnalyticsTaskPool {
+    AnalyticsTaskPool() : free(NULL), count(0) {}
+
+    struct Block {
+        Block *next;
+    };
+
+    qcc::Mutex lock;
+    Block *free;
+    size_t count;
+};
+
+static AnalyticsTaskPool &TaskPool()
+{
+    static AnalyticsTaskPool pool;
+    return pool;
+}
+
+void *AnalyticsTask::operator new(size_t size)
+{
+    if (size > ANALYTICS_TASK_BYTES) {
+        return ::operator new(size);
+    }
+
+    AnalyticsTaskPool &pool = TaskPool();
+    pool.lock.Lock();
+    AnalyticsTaskPool::Block *block = pool.free;
+    if (block) {
+        pool.free = block->next;
+        pool.count--;
+    }
+    pool.lock.Unlock();
+
+    return block ? (void *)block : ::operator new(ANALYTICS_TASK_BYTES);
+}
+
+void AnalyticsTask::operator delete(void *p, size_t size)
+{
+    if (!p) {
+        return;
+    }
+    if (size > ANALYTICS_TASK_BYTES) {
+        ::operator delete(p);
+        return;
+    }
+
+    AnalyticsTaskPool &pool = TaskPool();
+    pool.lock.Lock();
+    if (pool.count < ANALYTICS_TASK_POOL) {
+        AnalyticsTaskPool::Block *block = (AnalyticsTaskPool::Block *)p;
+        block->next = pool.free;
+        pool.free = block;
+        pool.count++;
+        p = NULL;
+    }
+    pool.lock.Unlock();
+
+    if (p) {
+        ::operator delete(p);
+    }
+}
+
+void AnalyticsStrand::Post(AnalyticsExecutor &executor, AnalyticsTask *task, bool final)
+{
+    task->next = NULL;
+    task->final = final;
+
+    IncrementAndFetch(&depth);
+    IncrementAndFetch(&executor.queuedTasks);
+
+    lock.Lock();
+    if (tail) {
+        tail->next = task;
+    } else {
+        head = task;
+    }
+    tail = task;
+    bool schedule = !scheduled;
+    scheduled = true;
+    lock.Unlock();
+
+    if (schedule) {
+        executor.Schedule(this);
+    }
+}
+
+bool AnalyticsStrand::RunSome(AnalyticsExecutor &executor, unsigned budget, unsigned &ran)
+{
+    ran = 0;
+    for (unsigned n = 0; n < budget; n++) {
+        lock.Lock();
+        AnalyticsTask *task = head;
+        if (!task) {
+            scheduled = false;
+            lock.Unlock();
+            return false;
+        }
+        head = task->next;
+        if (!head) {
+            tail = NULL;
+        }
+        lock.Unlock();
+
+        DecrementAndFetch(&depth);
+        DecrementAndFetch(&executor.queuedTasks);
+
+        bool final = task->final;
+        task->Run();
+        task->Release();
+        ran++;
+        if (final) {
+            /* the strand may no longer exist. */
+            return false;
+        }
+    }
+
+    lock.Lock();
+    bool more = (head != NULL);
+    if (!more) {
+        scheduled = false;
+    }
+    lock.Unlock();
+    return more;
+}
+
+void AnalyticsStrand::Reset()
+{
+    /* after a final task RunSome leaves the strand marked as scheduled. */
+    lock.Lock();
+    head = NULL;
+    tail = NULL;
+    scheduled = false;
+    lock.Unlock();
+}
+
+AnalyticsExecutor::AnalyticsExecutor(unsigned threads) :
+    readyCount(0),
+    queuedTasks(0),
+    nextWorker(0),
+    idleWaiters(0),
+    stopping(false)
+{
+    if (threads == 0) {
+        threads = 1;
+    }
+
+    /* all workers must exist before any of them looks for work to steal. */
+    for (unsigned i = 0; i < threads; i++) {
+        workers.push_back(new Worker(*this, i));
+    }
+    for (unsigned i = 0; i < threads; i++) {
+        workers[i]->Start();
+    }
+}
+
+AnalyticsExecutor::~AnalyticsExecutor()
+{
+    idleLock.Lock();
+    stopping = true;
+    idle.Broadcast();
+    idleLock.Unlock();
+
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i]->Join();
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        delete workers[i];
+    }
+}
+
+void AnalyticsExecutor::Schedule(AnalyticsStrand *strand)
+{
+    uint32_t n = (uint32_t) IncrementAndFetch(&nextWorker);
+    MakeReady(workers[n % workers.size()], strand);
+}
+
+void AnalyticsExecutor::MakeReady(Worker *worker, AnalyticsStrand *strand)
+{
+    worker->lock.Lock();
+    worker->PushBack(strand);
+    worker->lock.Unlock();
+
+    /*
+     * pairs with the idleWaiters increment in NextStrand: either that
+     * worker sees readyCount go up, or we see it waiting and wake it.
+     */
+    IncrementAndFetch(&readyCount);
+    if (idleWaiters) {
+        idleLock.Lock();
+        idle.Signal();
+        idleLock.Unlock();
+    }
+}
+
+AnalyticsStrand *AnalyticsExecutor::Steal(Worker &self)
+{
+    size_t n = workers.size();
+    for (size_t i = 1; i < n; i++) {
+        Worker *victim = workers[(self.index + i) % n];
+        victim->lock.Lock();
+        AnalyticsStrand *strand = victim->PopBack();
+        victim->lock.Unlock();
+        if (strand) {
+            self.steals++;
+            return strand;
+        }
+    }
+    return NULL;
+}
+
+AnalyticsStrand *AnalyticsExecutor::NextStrand(Worker &self)
+{
+    for (;;) {
+        self.lock.Lock();
+        AnalyticsStrand *strand = self.PopFront();
+        self.lock.Unlock();
+
+        if (!strand) {
+            strand = Steal(self);
+        }
+        if (strand) {
+            DecrementAndFetch(&readyCount);
+            return strand;
+        }
+
+        idleLock.Lock();
+        IncrementAndFetch(&idleWaiters);
+        while (readyCount <= 0 && !stopping) {
+            idle.Wait(idleLock);
+        }
+        DecrementAndFetch(&idleWaiters);
+        bool done = stopping && readyCount <= 0;
+        idleLock.Unlock();
+
+        if (done) {
+            return NULL;
+        }
+    }
+}
+
+void AnalyticsExecutor::Worker::PushBack(AnalyticsStrand *strand)
+{
+    strand->readyNext = NULL;
+    strand->readyPrev = readyTail;
+    if (readyTail) {
+        readyTail->readyNext = strand;
+    } else {
+        readyHead = strand;
+    }
+    readyTail = strand;
+}
+
+AnalyticsStrand *AnalyticsExecutor::Worker::PopFront()
+{
+    AnalyticsStrand *strand = readyHead;
+    if (strand) {
+        readyHead = strand->readyNext;
+        if (readyHead) {
+            readyHead->readyPrev = NULL;
+        } else {
+            readyTail = NULL;
+        }
+    }
+    return strand;
+}
+
+AnalyticsStrand *AnalyticsExecutor::Worker::PopBack()
+{
+    AnalyticsStrand *strand = readyTail;
+    if (strand) {
+        readyTail = strand->readyPrev;
+        if (readyTail) {
+            readyTail->readyNext = NULL;
+        } else {
+            readyHead = NULL;
+        }
+    }
+    return strand;
+}
+
+ThreadReturn STDCALL AnalyticsExecutor::Worker::Run(void *arg)
+{
+    AnalyticsStrand *strand;
+    while ((strand = executor.NextStrand(*this)) != NULL) {
+        unsigned ran;
+        bool more = strand->RunSome(executor, ANALYTICS_STRAND_BUDGET, ran);
+        executed += ran;
+        if (more) {
+            /* budget exhausted; let other strands run before this one continues. */
+            executor.MakeReady(this, strand);
+        }
+    }
+    return 0;
+}
+
+void AnalyticsExecutor::GetStats(Stats &stats)
+{
+    stats.threads = workers.size();
+    stats.readyStrands = readyCount > 0 ? readyCount : 0;
+    stats.queuedTasks = queuedTasks > 0 ? queuedTasks : 0;
+    stats.executed = 0;
+    stats.steals = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        stats.executed += workers[i]->executed;
+        stats.steals += workers[i]->steals;
+    }
+}
@@ -0,0 +1,407 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#include "AnalyticsFilter.h"
+#include "AnalyticsKV.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ajn;
+
+/* perfect hash seeds tried at each table size before the table grows. */
+#define FILTER_SEED_TRIES 32
+
+/* longest line Load() accepts. */
+#define FILTER_MAX_LINE 1024
+
+AnalyticsFilter::AnalyticsFilter() :
+    seed(0),
+    compiled(true),
+    matched(0),
+    dropped(0)
+{
+}
+
+bool AnalyticsFilter::AddRule(const char *pattern, double rate,
+        const char *key, const char *value)
+{
+    size_t len = pattern ? strlen(pattern) : 0;
+    if (len == 0 || rate < 0 || rate > 1) {
+        return false;
+    }
+    const char *star = strchr(pattern, '*');
+    if (star && star != pattern + len - 1) {
+        return false;
+    }
+    if (value && !key) {
+        return false;
+    }
+
+    bool prefix = (star != NULL);
+    qcc::String name(pattern, prefix ? len - 1 : len);
+
+    Rule rule;
+    rule.hasKey = (key != NULL);
+    rule.hasValue = (value != NULL);
+    rule.intValue = false;
+    rule.ivalue = 0;
+    if (key) {
+        rule.key = key;
+    }
+    if (value) {
+        rule.value = value;
+        char *end;
+        rule.ivalue = strtoll(value, &end, 0);
+        rule.intValue = (*value && !*end);
+    }
+    rule.rate = (uint32_t)(rate * ANALYTICS_FILTER_RATE_SCALE + 0.5);
+
+    /* only done while configuring, so a linear search is fine. */
+    size_t g;
+    for (g = 0; g < groups.size(); g++) {
+        if (groups[g].prefix == prefix && groups[g].name == name) {
+            break;
+        }
+    }
+    if (g == groups.size()) {
+        Group group;
+        group.name = name;
+        group.prefix = prefix;
+        group.parent = -1;
+        groups.push_back(group);
+    }
+
+    groups[g].rules.push_back(rules.size());
+    rules.push_back(rule);
+    compiled = false;
+    return true;
+}
+
+QStatus AnalyticsFilter::Load(const char *path, const char **errMsg, unsigned *line)
+{
+    *line = 0;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        *errMsg = "cannot open file";
+        return ER_OPEN_FAILED;
+    }
+
+    QStatus status = ER_OK;
+    char buf[FILTER_MAX_LINE];
+    while (status == ER_OK && fgets(buf, sizeof(buf), f)) {
+        (*line)++;
+
+        char *tok[5];
+        size_t n = 0;
+        char *p = buf;
+        while (n < 5) {
+            p += strspn(p, " \t\r\n");
+            if (!*p || *p == '#') {
+                break;
+            }
+            tok[n++] = p;
+            p += strcspn(p, " \t\r\n");
+            if (*p) {
+                *p++ = '\0';
+            }
+        }
+        p += strspn(p, " \t\r\n");
+        if (n == 0) {
+            continue;
+        }
+
+        size_t next = 2;
+        double rate;
+        if (0 == strcmp(tok[0], "drop")) {
+            rate = 0;
+        } else if (0 == strcmp(tok[0], "keep")) {
+            rate = 1;
+        } else if (0 == strcmp(tok[0], "sample")) {
+            char *end;
+            rate = n > 2 ? strtod(tok[2], &end) : -1;
+            if (n <= 2 || *end || rate < 0 || rate > 1) {
+                *errMsg = "expecting a rate from 0 to 1";
+                status = ER_FAIL;
+                break;
+            }
+            next = 3;
+        } else {
+            *errMsg = "unknown action (not drop, sample or keep)";
+            status = ER_FAIL;
+            break;
+        }
+
+        if (n < 2) {
+            *errMsg = "missing event pattern";
+            status = ER_FAIL;
+            break;
+        }
+        if (n > next + 1 || (*p && *p != '#')) {
+            *errMsg = "too many fields";
+            status = ER_FAIL;
+            break;
+        }
+
+        const char *key = NULL;
+        const char *value = NULL;
+        if (n > next) {
+            key = tok[next];
+            char *eq = strchr(tok[next], '=');
+            if (eq) {
+                *eq = '\0';
+                value = eq + 1;
+            }
+        }
+
+        if (!AddRule(tok[1], rate, key, value)) {
+            *errMsg = "invalid pattern ('*' is allowed only at the end)";
+            status = ER_FAIL;
+        }
+    }
+
+    fclose(f);
+    if (status == ER_OK) {
+        Compile();
+    }
+    return status;
+}
+
+/* FNV-1a, seeded, with a final mix so that each seed spreads differently. */
+uint32_t AnalyticsFilter::Hash(uint32_t seed, const char *s)
+{
+    uint32_t h = 2166136261U ^ (seed * 0x9e3779b9U);
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 16777619U;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+void AnalyticsFilter::Compile()
+{
+    compiled = true;
+
+    /* the prefix trie. */
+    trie.assign(1, TrieNode());
+    for (size_t g = 0; g < groups.size(); g++) {
+        if (!groups[g].prefix) {
+            continue;
+        }
+        uint32_t node = 0;
+        const char *s = groups[g].name.c_str();
+        for (; *s; s++) {
+            unsigned char c = *s;
+            size_t i;
+            for (i = 0; i < trie[node].children.size(); i++) {
+                if (trie[node].children[i].first == c) {
+                    break;
+                }
+            }
+            if (i == trie[node].children.size()) {
+                trie[node].children.push_back(std::make_pair(c, (uint32_t)trie.size()));
+                trie.push_back(TrieNode());
+            }
+            node = trie[node].children[i].second;
+        }
+        trie[node].group = g;
+    }
+
+    /*
+     * an exact name falls back to its longest prefix; a prefix falls back
+     * to the longest prefix shorter than itself.
+     */
+    for (size_t g = 0; g < groups.size(); g++) {
+        Group &group = groups[g];
+        if (!group.prefix) {
+            group.parent = FindPrefix(group.name.c_str());
+            continue;
+        }
+        group.parent = -1;
+        uint32_t node = 0;
+        const char *s = group.name.c_str();
+        for (; *s; s++) {
+            if (trie[node].group >= 0) {
+                group.parent = trie[node].group;
+            }
+            unsigned char c = *s;
+            for (size_t i = 0; i < trie[node].children.size(); i++) {
+                if (trie[node].children[i].first == c) {
+                    node = trie[node].children[i].second;
+                    break;
+                }
+            }
+        }
+    }
+
+    /*
+     * a perfect hash of the exact names: try seeds until every name has
+     * its own slot, growing the table if that takes too long.
+     */
+    size_t exact = 0;
+    for (size_t g = 0; g < groups.size(); g++) {
+        exact += groups[g].prefix ? 0 : 1;
+    }
+    slots.clear();
+    seed = 0;
+    if (exact == 0) {
+        return;
+    }
+
+    size_t size = 1;
+    while (size < 2 * exact) {
+        size <<= 1;
+    }
+    for (;;) {
+        for (uint32_t tries = 0; tries < FILTER_SEED_TRIES; tries++, seed++) {
+            slots.assign(size, -1);
+            bool ok = true;
+            for (size_t g = 0; ok && g < groups.size(); g++) {
+                if (groups[g].prefix) {
+                    continue;
+                }
+                int32_t &slot = slots[Hash(seed, groups[g].name.c_str()) & (size - 1)];
+                ok = (slot < 0);
+                slot = g;
+            }
+            if (ok) {
+                return;
+            }
+        }
+        size <<= 1;
+    }
+}
+
+int32_t AnalyticsFilter::FindPrefix(const char *name) const
+{
+    if (trie.empty()) {
+        return -1;
+    }
+    uint32_t node = 0;
+    int32_t best = trie[0].group;
+    for (; *name; name++) {
+        unsigned char c = *name;
+        const std::vector<std::pair<unsigned char, uint32_t> > &children = trie[node].children;
+        size_t i;
+        for (i = 0; i < children.size(); i++) {
+            if (children[i].first == c) {
+                break;
+            }
+        }
+        if (i == children.size()) {
+            break;
+        }
+        node = children[i].second;
+        if (trie[node].group >= 0) {
+            best = trie[node].group;
+        }
+    }
+    return best;
+}
+
+bool AnalyticsFilter::KeyMatches(const Rule &rule, size_t count,
+        const MsgArg *kvs, const char *const *keys)
+{
+    if (!rule.hasKey) {
+        return true;
+    }
+    for (size_t i = 0; i < count; i++) {
+        AnalyticsKV kv;
+        if (keys) {
+            const MsgArg *v = &kvs[i];
+            while (v && v->typeId == ALLJOYN_VARIANT) {
+                v = v->v_variant.val;
+            }
+            if (!v) {
+                continue;
+            }
+            kv.key = keys[i];
+            kv.type = v->typeId;
+            kv.value = v;
+        } else if (!kv.Parse(kvs[i])) {
+            continue;
+        }
+
+        if (rule.key != kv.key) {
+            continue;
+        }
+        if (!rule.hasValue) {
+            return true;
+        }
+        const char *s = kv.GetString();
+        if (s) {
+            return rule.value == s;
+        }
+        int64_t x;
+        return rule.intValue && kv.GetInt64(x) && x == rule.ivalue;
+    }
+    return false;
+}
+
+bool AnalyticsFilter::Keep(const char *sender, const char *name, uint32_t sequence,
+        size_t count, const MsgArg *kvs, const char *const *keys)
+{
+    /* a rule added without Compile() would be matched by some paths only. */
+    assert(compiled);
+
+    int32_t g = -1;
+    if (!slots.empty()) {
+        int32_t slot = slots[Hash(seed, name) & (slots.size() - 1)];
+        if (slot >= 0 && groups[slot].name == name) {
+            g = slot;
+        }
+    }
+    if (g < 0) {
+        g = FindPrefix(name);
+    }
+
+    for (; g >= 0; g = groups[g].parent) {
+        const std::vector<uint32_t> &r = groups[g].rules;
+        for (size_t i = 0; i < r.size(); i++) {
+            const Rule &rule = rules[r[i]];
+            if (!KeyMatches(rule, count, kvs, keys)) {
+                continue;
+            }
+
+            /* racy counters; a lost update only skews the stats. */
+            matched++;
+            bool keep = rule.rate >= ANALYTICS_FILTER_RATE_SCALE ||
+                (rule.rate && Hash(Hash(sequence, name), sender ? sender : "") %
+                    ANALYTICS_FILTER_RATE_SCALE < rule.rate);
+            if (!keep) {
+                dropped++;
+            }
+            return keep;
+        }
+    }
+    return true;
+}
+
+void AnalyticsFilter::GetStats(Stats &stats) const
+{
+    stats.matched = matched;
+    stats.dropped = dropped;
+}
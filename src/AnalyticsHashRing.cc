@@ -0,0 +1,123 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+#include "AnalyticsHashRing.h"
+#include "AnalyticsDeviceTable.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+int AnalyticsHashRing::Find(const char *member) const
+{
+    size_t lo = 0, hi = members.size();
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = strcmp(members[mid].name.c_str(), member);
+        if (c == 0) {
+            return (int)mid;
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+void AnalyticsHashRing::Add(const char *member, uint32_t weight)
+{
+    weight = ClampWeight(weight);
+
+    int i = Find(member);
+    if (i >= 0) {
+        if (members[i].weight == weight) {
+            return;
+        }
+        members[i].weight = weight;
+    } else {
+        Member m;
+        m.name = member;
+        m.weight = weight;
+        std::vector<Member>::iterator it = members.begin();
+        while (it != members.end() && strcmp(it->name.c_str(), member) < 0) {
+            ++it;
+        }
+        members.insert(it, m);
+    }
+    Rebuild();
+}
+
+bool AnalyticsHashRing::Remove(const char *member)
+{
+    int i = Find(member);
+    if (i < 0) {
+        return false;
+    }
+    members.erase(members.begin() + i);
+    Rebuild();
+    return true;
+}
+
+void AnalyticsHashRing::Rebuild()
+{
+    points.clear();
+    for (size_t m = 0; m < members.size(); m++) {
+        const qcc::String &name = members[m].name;
+        uint32_t n = members[m].weight * ANALYTICS_HASH_VNODES;
+        for (uint32_t v = 0; v < n; v++) {
+            char suffix[16];
+            snprintf(suffix, sizeof(suffix), "#%u", v);
+            Point p;
+            p.hash = AnalyticsDeviceTable::Hash((name + suffix).c_str());
+            p.member = m;
+            points.push_back(p);
+        }
+    }
+    std::sort(points.begin(), points.end());
+}
+
+size_t AnalyticsHashRing::Lookup(const char *key, const char **out, size_t max) const
+{
+    if (points.empty() || max == 0) {
+        return 0;
+    }
+
+    Point k;
+    k.hash = AnalyticsDeviceTable::Hash(key);
+    k.member = 0;
+    size_t start = std::lower_bound(points.begin(), points.end(), k) - points.begin();
+
+    if (max > members.size()) {
+        max = members.size();
+    }
+
+    size_t found = 0;
+    for (size_t i = 0; i < points.size() && found < max; i++) {
+        uint32_t m = points[(start + i) % points.size()].member;
+        const char *name = members[m].name.c_str();
+        size_t j = 0;
+        while (j < found && out[j] != name) {
+            j++;
+        }
+        if (j == found) {
+            out[found++] = name;
+        }
+    }
+    return found;
+}
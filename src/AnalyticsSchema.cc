@@ -0,0 +1,129 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#include "AnalyticsSchema.h"
+#include <string.h>
+
+using namespace ajn;
+
+/* value types a schema may use. */
+static const char schemaTypes[] = "bynqiuxtsd";
+
+static bool SameSchema(const AnalyticsEventSchema *s, const char *name,
+        size_t count, const char *const *keys, const char *types)
+{
+    if (s->name != name || s->types != types || s->keys.size() != count) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (s->keys[i] != keys[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QStatus AnalyticsSchemaTable::Register(const char **errMsg, const char *name,
+        size_t count, const char *const *keys, const char *types, uint32_t &id)
+{
+    if (!name || !*name) {
+        *errMsg = "missing event name";
+        return ER_BAD_ARG_1;
+    }
+    if (count > ANALYTICS_MAX_SCHEMA_KEYS) {
+        *errMsg = "too many schema keys";
+        return ER_BAD_ARG_2;
+    }
+    if (strlen(types) != count) {
+        *errMsg = "need one type per key";
+        return ER_BAD_ARG_3;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (!strchr(schemaTypes, types[i])) {
+            *errMsg = "invalid key type (not b,y,n,q,i,u,x,t,s,d)";
+            return ER_BAD_ARG_3;
+        }
+    }
+
+    for (size_t i = 0; i < schemas.size(); i++) {
+        if (SameSchema(schemas[i], name, count, keys, types)) {
+            id = i;
+            return ER_OK;
+        }
+    }
+
+    if (schemas.size() >= ANALYTICS_MAX_SCHEMAS) {
+        *errMsg = "too many schemas";
+        return ER_OUT_OF_MEMORY;
+    }
+
+    AnalyticsEventSchema *s = new AnalyticsEventSchema();
+    if (!s) {
+        *errMsg = "out of memory";
+        return ER_OUT_OF_MEMORY;
+    }
+    s->name = name;
+    s->types = types;
+    s->keys.assign(keys, keys + count);
+    s->keyNames.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        s->keyNames[i] = s->keys[i].c_str();
+    }
+
+    bytes += sizeof(*s) + s->name.size() + s->types.size() +
+        count * (sizeof(qcc::String) + sizeof(const char *));
+    for (size_t i = 0; i < count; i++) {
+        bytes += s->keys[i].size();
+    }
+
+    id = schemas.size();
+    schemas.push_back(s);
+    return ER_OK;
+}
+
+QStatus AnalyticsSchemaTable::Check(const char **errMsg, uint32_t id,
+        size_t count, const MsgArg *values, const AnalyticsEventSchema *&schema) const
+{
+    schema = Find(id);
+    if (!schema) {
+        *errMsg = "unknown schema id";
+        return ER_BAD_ARG_1;
+    }
+    if (count != schema->keys.size()) {
+        *errMsg = "value count does not match schema";
+        return ER_BAD_ARG_4;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const MsgArg *v = Unwrap(&values[i]);
+        if (!v || (char)v->typeId != schema->types[i]) {
+            *errMsg = "value type does not match schema";
+            return ER_BAD_ARG_4;
+        }
+    }
+    return ER_OK;
+}
+
+void AnalyticsSchemaTable::Clear()
+{
+    for (size_t i = 0; i < schemas.size(); i++) {
+        delete schemas[i];
+    }
+    schemas.clear();
+    bytes = 0;
+}
@@ -0,0 +1,164 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+#include "AnalyticsShards.h"
+#include "Analytics.h"
+
+using namespace qcc;
+using namespace ajn;
+
+AnalyticsShards::AnalyticsShards(BusAttachment &bus, const char *shard, uint32_t capacity,
+        const char *ifname) :
+    bus(bus),
+    shard(shard),
+    ifname(ifname),
+    started(false)
+{
+    ring.Add(shard, AnalyticsHashRing::ClampWeight(capacity));
+}
+
+AnalyticsShards::~AnalyticsShards()
+{
+    Stop();
+}
+
+QStatus AnalyticsShards::Start()
+{
+    lock.Lock();
+    bool wasStarted = started;
+    started = true;
+    lock.Unlock();
+    if (wasStarted) {
+        return ER_OK;
+    }
+
+    bus.RegisterBusListener(*this);
+    bus.RegisterAboutListener(*this);
+
+    const char *interfaces[] = { ifname.c_str() };
+    QStatus status = bus.WhoImplements(interfaces, 1);
+    if (ER_OK != status) {
+        Stop();
+    }
+    return status;
+}
+
+void AnalyticsShards::Stop()
+{
+    lock.Lock();
+    bool wasStarted = started;
+    started = false;
+    lock.Unlock();
+    if (!wasStarted) {
+        return;
+    }
+
+    const char *interfaces[] = { ifname.c_str() };
+    bus.CancelWhoImplements(interfaces, 1);
+    bus.UnregisterAboutListener(*this);
+    bus.UnregisterBusListener(*this);
+}
+
+bool AnalyticsShards::Owns(const char *device, qcc::String *owner)
+{
+    const char *first[ANALYTICS_DISCOVERY_CHOICES];
+
+    lock.Lock();
+    size_t n = ring.Lookup(device, first, ANALYTICS_DISCOVERY_CHOICES);
+    bool owns = false;
+    for (size_t i = 0; i < n && !owns; i++) {
+        owns = shard == first[i];
+    }
+    if (!owns && owner && n) {
+        *owner = first[0];
+    }
+    lock.Unlock();
+    return owns;
+}
+
+size_t AnalyticsShards::Shards()
+{
+    lock.Lock();
+    size_t n = ring.Size();
+    lock.Unlock();
+    return n;
+}
+
+void AnalyticsShards::Announced(const char *busName, uint16_t version, SessionPort port,
+        const MsgArg &objectDescriptionArg, const MsgArg &aboutDataArg)
+{
+    AboutObjectDescription aod(objectDescriptionArg);
+    if (!aod.HasInterface(ifname.c_str())) {
+        return;
+    }
+
+    MsgArg *value;
+    const char *name = NULL;
+    uint32_t capacity = 1;
+    if (ER_OK != aboutDataArg.GetElement("{sv}", ANALYTICS_ABOUT_SHARD, &value) ||
+            ER_OK != value->Get("s", &name)) {
+        return;
+    }
+    if (ER_OK == aboutDataArg.GetElement("{sv}", ANALYTICS_ABOUT_CAPACITY, &value)) {
+        value->Get("u", &capacity);
+        /* announced by a peer, so not trusted. */
+        capacity = AnalyticsHashRing::ClampWeight(capacity);
+    }
+    if (shard == name) {
+        /* ourselves, or a copy started with the same name. */
+        return;
+    }
+
+    lock.Lock();
+    std::map<qcc::String, qcc::String>::iterator it = peers.find(busName);
+    if (it != peers.end() && it->second != name) {
+        Forget(busName);
+    }
+    peers[busName] = name;
+    ring.Add(name, capacity);
+    lock.Unlock();
+}
+
+void AnalyticsShards::NameOwnerChanged(const char *busName, const char *previousOwner,
+        const char *newOwner)
+{
+    if (newOwner) {
+        return;
+    }
+
+    lock.Lock();
+    if (peers.find(busName) != peers.end()) {
+        Forget(busName);
+    }
+    lock.Unlock();
+}
+
+void AnalyticsShards::Forget(const char *busName)
+{
+    std::map<qcc::String, qcc::String>::iterator it = peers.find(busName);
+    qcc::String name = it->second;
+    peers.erase(it);
+
+    for (it = peers.begin(); it != peers.end(); ++it) {
+        if (it->second == name) {
+            return;
+        }
+    }
+    QCC_DbgPrintf(("Shard %s left", name.c_str()));
+    ring.Remove(name.c_str());
+}
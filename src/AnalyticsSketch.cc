@@ -0,0 +1,319 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#include "AnalyticsSketch.h"
+#include "AnalyticsDeviceTable.h"
+#include "AnalyticsKV.h"
+
+#include <qcc/atomic.h>
+
+#include <math.h>
+#include <string.h>
+
+using namespace ajn;
+
+void AnalyticsTopK::Add(const char *name, uint32_t hash, uint64_t n, uint64_t error)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (entries[i].hash == hash &&
+                0 == strncmp(entries[i].name, name, ANALYTICS_SKETCH_NAME_MAX - 1)) {
+            entries[i].count += n;
+            entries[i].error += error;
+            return;
+        }
+    }
+
+    Entry *e;
+    if (size < ANALYTICS_SKETCH_TOPK) {
+        e = &entries[size++];
+        e->count = 0;
+        e->error = 0;
+    } else {
+        /* evict the smallest; the newcomer inherits its count as error. */
+        e = &entries[0];
+        for (size_t i = 1; i < size; i++) {
+            if (entries[i].count < e->count) {
+                e = &entries[i];
+            }
+        }
+        e->error = e->count;
+    }
+
+    strncpy(e->name, name, ANALYTICS_SKETCH_NAME_MAX - 1);
+    e->name[ANALYTICS_SKETCH_NAME_MAX - 1] = '\0';
+    e->hash = hash;
+    e->count += n;
+    e->error += error;
+}
+
+void AnalyticsTopK::Merge(const AnalyticsTopK &other)
+{
+    for (size_t i = 0; i < other.size; i++) {
+        const Entry &e = other.entries[i];
+        Add(e.name, e.hash, e.count, e.error);
+    }
+}
+
+void AnalyticsTopK::Sort()
+{
+    /* at most ANALYTICS_SKETCH_TOPK entries. */
+    for (size_t i = 1; i < size; i++) {
+        Entry e = entries[i];
+        size_t j = i;
+        for (; j > 0 && entries[j - 1].count < e.count; j--) {
+            entries[j] = entries[j - 1];
+        }
+        entries[j] = e;
+    }
+}
+
+void AnalyticsHll::Merge(const AnalyticsHll &other)
+{
+    for (size_t i = 0; i < sizeof(reg); i++) {
+        if (other.reg[i] > reg[i]) {
+            reg[i] = other.reg[i];
+        }
+    }
+}
+
+uint64_t AnalyticsHll::Estimate() const
+{
+    const double m = sizeof(reg);
+    double sum = 0;
+    size_t zeros = 0;
+    for (size_t i = 0; i < sizeof(reg); i++) {
+        sum += ldexp(1.0, -reg[i]);
+        zeros += reg[i] ? 0 : 1;
+    }
+
+    double e = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (e <= 2.5 * m && zeros) {
+        /* linear counting is more accurate for small sets. */
+        e = m * log(m / zeros);
+    }
+    return (uint64_t)(e + 0.5);
+}
+
+void AnalyticsHll::Clear()
+{
+    memset(reg, 0, sizeof(reg));
+}
+
+AnalyticsSketches::AnalyticsSketches() :
+    nkeys(0)
+{
+    slots = new Slot[ANALYTICS_STATS_SLOTS];
+    shared = new Slot;
+}
+
+AnalyticsSketches::~AnalyticsSketches()
+{
+    delete [] slots;
+    delete shared;
+}
+
+/* 64-bit finalizer from MurmurHash3. */
+static uint64_t Mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t AnalyticsSketches::HashValue(const MsgArg *v)
+{
+    while (v && v->typeId == ALLJOYN_VARIANT) {
+        v = v->v_variant.val;
+    }
+    if (!v) {
+        return 0;
+    }
+
+    AnalyticsKV kv;
+    kv.key = NULL;
+    kv.type = v->typeId;
+    kv.value = v;
+
+    /* integers hash alike whatever their width, as they are counted alike. */
+    int64_t x;
+    if (kv.GetInt64(x)) {
+        return Mix64((uint64_t)x);
+    }
+    if (kv.type == ALLJOYN_DOUBLE) {
+        uint64_t bits;
+        memcpy(&bits, &v->v_double, sizeof(bits));
+        return Mix64(bits ^ 0x9e3779b97f4a7c15ULL);
+    }
+
+    const char *s = kv.GetString();
+    uint64_t h = 14695981039346656037ULL;
+    if (s) {
+        for (; *s; s++) {
+            h ^= (unsigned char)*s;
+            h *= 1099511628211ULL;
+        }
+    } else {
+        h ^= kv.type;
+    }
+    return Mix64(h);
+}
+
+int AnalyticsSketches::FindKey(const char *key)
+{
+    uint32_t hash = AnalyticsDeviceTable::Hash(key);
+    int32_t n = nkeys;
+    for (int32_t i = 0; i < n; i++) {
+        if (keyHashes[i] == hash &&
+                0 == strncmp(keyNames[i], key, ANALYTICS_SKETCH_NAME_MAX - 1)) {
+            return i;
+        }
+    }
+    if (n == ANALYTICS_SKETCH_KEYS) {
+        return -1;
+    }
+
+    int found = -1;
+    keyLock.Lock();
+    /* another thread may have added keys since nkeys was read. */
+    for (int32_t i = n; i < nkeys; i++) {
+        if (keyHashes[i] == hash &&
+                0 == strncmp(keyNames[i], key, ANALYTICS_SKETCH_NAME_MAX - 1)) {
+            found = i;
+        }
+    }
+    if (found < 0 && nkeys < ANALYTICS_SKETCH_KEYS) {
+        found = nkeys;
+        strncpy(keyNames[found], key, ANALYTICS_SKETCH_NAME_MAX - 1);
+        keyNames[found][ANALYTICS_SKETCH_NAME_MAX - 1] = '\0';
+        keyHashes[found] = hash;
+        /* a full barrier, so the entry is visible before it is counted. */
+        qcc::IncrementAndFetch(&nkeys);
+    }
+    keyLock.Unlock();
+    return found;
+}
+
+void AnalyticsSketches::Add(const char *sender, const char *name, size_t count,
+        const MsgArg *kvs, const char *const *keys)
+{
+    uint32_t senderHash = AnalyticsDeviceTable::Hash(sender);
+    uint32_t nameHash = AnalyticsDeviceTable::Hash(name);
+
+    /* resolve keys and hash values before touching the slot. */
+    int idx[ANALYTICS_SKETCH_KEYS];
+    uint64_t hashes[ANALYTICS_SKETCH_KEYS];
+    size_t n = 0;
+    for (size_t i = 0; i < count && n < ANALYTICS_SKETCH_KEYS; i++) {
+        const char *key;
+        const MsgArg *value;
+        if (keys) {
+            key = keys[i];
+            value = &kvs[i];
+        } else {
+            AnalyticsKV kv;
+            if (!kv.Parse(kvs[i])) {
+                continue;
+            }
+            key = kv.key;
+            value = kv.value;
+        }
+        int k = FindKey(key);
+        if (k >= 0) {
+            idx[n] = k;
+            hashes[n] = HashValue(value);
+            n++;
+        }
+    }
+
+    int32_t t = AnalyticsStats::ThreadSlot();
+    Slot &slot = t >= 0 ? slots[t] : *shared;
+    if (t < 0) {
+        sharedLock.Lock();
+    }
+
+    /* full barriers, so Get() sees seq change around the writes. */
+    qcc::IncrementAndFetch(&slot.seq);
+    slot.events.Add(name, nameHash);
+    slot.devices.Add(sender, senderHash);
+    qcc::IncrementAndFetch(&slot.seq);
+
+    /* registers only grow, so a racing read at worst misses this update. */
+    for (size_t i = 0; i < n; i++) {
+        slot.values[idx[i]].Add(hashes[i]);
+    }
+
+    if (t < 0) {
+        sharedLock.Unlock();
+    }
+}
+
+void AnalyticsSketches::CopyTopK(Slot &slot, AnalyticsTopK &events, AnalyticsTopK &devices)
+{
+    for (;;) {
+        int32_t seq = slot.seq;
+        /* CompareAndExchange() is used as a barrier that checks seq. */
+        if ((seq & 1) || !qcc::CompareAndExchange(&slot.seq, seq, seq)) {
+            continue;
+        }
+        events = slot.events;
+        devices = slot.devices;
+        if (qcc::CompareAndExchange(&slot.seq, seq, seq)) {
+            return;
+        }
+    }
+}
+
+void AnalyticsSketches::MergeSlot(Slot &slot, AnalyticsTopK &events, AnalyticsTopK &devices,
+        AnalyticsHll *values, size_t keys)
+{
+    AnalyticsTopK e, d;
+    CopyTopK(slot, e, d);
+    events.Merge(e);
+    devices.Merge(d);
+    for (size_t k = 0; k < keys; k++) {
+        values[k].Merge(slot.values[k]);
+    }
+}
+
+void AnalyticsSketches::Get(AnalyticsTopK &events, AnalyticsTopK &devices,
+        KeyCount *counts, size_t &keys)
+{
+    events.Clear();
+    devices.Clear();
+    keys = nkeys;
+
+    AnalyticsHll *values = new AnalyticsHll[ANALYTICS_SKETCH_KEYS];
+    for (size_t i = 0; i < ANALYTICS_STATS_SLOTS; i++) {
+        MergeSlot(slots[i], events, devices, values, keys);
+    }
+    sharedLock.Lock();
+    MergeSlot(*shared, events, devices, values, keys);
+    sharedLock.Unlock();
+
+    events.Sort();
+    devices.Sort();
+    for (size_t k = 0; k < keys; k++) {
+        counts[k].key = keyNames[k];
+        counts[k].distinct = values[k].Estimate();
+    }
+    delete [] values;
+}
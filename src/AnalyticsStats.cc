@@ -0,0 +1,274 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#include "AnalyticsStats.h"
+
+#include <qcc/atomic.h>
+#include <qcc/time.h>
+
+#include <string.h>
+#include <time.h>
+
+#if defined(QCC_OS_GROUP_POSIX)
+#include <pthread.h>
+#endif
+
+void AnalyticsHistogram::Clear()
+{
+    memset(buckets, 0, sizeof(buckets));
+    count = 0;
+    sum = 0;
+    max = 0;
+}
+
+size_t AnalyticsHistogram::Index(uint64_t value)
+{
+    const unsigned sub = 1 << ANALYTICS_HIST_SUB_BITS;
+    if (value < 2 * sub) {
+        return value;
+    }
+    if (value >> ANALYTICS_HIST_MAX_BITS) {
+        return ANALYTICS_HIST_BUCKETS - 1;
+    }
+
+    unsigned msb = ANALYTICS_HIST_SUB_BITS + 1;
+    while (value >> (msb + 1)) {
+        msb++;
+    }
+    unsigned shift = msb - ANALYTICS_HIST_SUB_BITS;
+    return ((msb - ANALYTICS_HIST_SUB_BITS + 1) << ANALYTICS_HIST_SUB_BITS) +
+        (size_t)(value >> shift) - sub;
+}
+
+uint64_t AnalyticsHistogram::Low(size_t i)
+{
+    const unsigned sub = 1 << ANALYTICS_HIST_SUB_BITS;
+    if (i < 2 * sub) {
+        return i;
+    }
+    unsigned shift = (i >> ANALYTICS_HIST_SUB_BITS) - 1;
+    return (uint64_t)((i & (sub - 1)) + sub) << shift;
+}
+
+void AnalyticsHistogram::Merge(const AnalyticsHistogram &other)
+{
+    for (size_t i = 0; i < ANALYTICS_HIST_BUCKETS; i++) {
+        buckets[i] += other.buckets[i];
+    }
+    count += other.count;
+    sum += other.sum;
+    if (other.max > max) {
+        max = other.max;
+    }
+}
+
+uint64_t AnalyticsHistogram::Percentile(double q) const
+{
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(q * count + 0.5);
+    if (rank < 1) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < ANALYTICS_HIST_BUCKETS; i++) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            uint64_t high = High(i);
+            return high < max ? high : max;
+        }
+    }
+    return max;
+}
+
+#if defined(__GNUC__)
+/*
+ * this thread's slot index in every AnalyticsStats, or -1 before its first
+ * update; ANALYTICS_STATS_SLOTS if none was free.
+ */
+static __thread int32_t threadSlot = -1;
+#endif
+
+#if defined(__GNUC__) && defined(QCC_OS_GROUP_POSIX)
+/* nonzero while a live thread holds the slot. */
+static volatile int32_t slotUsed[ANALYTICS_STATS_SLOTS];
+
+/* its destructor frees a thread's slot when the thread exits. */
+static pthread_key_t slotKey;
+static pthread_once_t slotKeyOnce = PTHREAD_ONCE_INIT;
+
+static void ReleaseSlot(void *value)
+{
+    /* the value is the slot index + 1, as 0 would not be passed here. */
+    int32_t i = (int32_t)((intptr_t)value - 1);
+    /* a full barrier, so the next owner sees this thread's last updates. */
+    qcc::CompareAndExchange(&slotUsed[i], 1, 0);
+    /* updates from later exit hooks go to the shared slot. */
+    threadSlot = ANALYTICS_STATS_SLOTS;
+}
+
+static void MakeSlotKey()
+{
+    pthread_key_create(&slotKey, ReleaseSlot);
+}
+
+static int32_t ClaimSlot()
+{
+    pthread_once(&slotKeyOnce, MakeSlotKey);
+    for (int32_t i = 0; i < ANALYTICS_STATS_SLOTS; i++) {
+        if (!slotUsed[i] && qcc::CompareAndExchange(&slotUsed[i], 0, 1)) {
+            pthread_setspecific(slotKey, (void *)(intptr_t)(i + 1));
+            return i;
+        }
+    }
+    return ANALYTICS_STATS_SLOTS;
+}
+#elif defined(__GNUC__)
+static volatile int32_t nextThreadSlot = 0;
+
+/* without thread exit hooks, slots are never freed. */
+static int32_t ClaimSlot()
+{
+    int32_t i = qcc::IncrementAndFetch(&nextThreadSlot) - 1;
+    return i < ANALYTICS_STATS_SLOTS ? i : ANALYTICS_STATS_SLOTS;
+}
+#endif
+
+AnalyticsStats::AnalyticsStats() :
+    started(NowMicros()),
+    rateAt(started),
+    rateEvents(0),
+    rateBytes(0),
+    eventsPerSec(0),
+    bytesEncodedPerSec(0)
+{
+    slots = new Slot[ANALYTICS_STATS_SLOTS];
+    shared = new Slot;
+    for (size_t i = 0; i < ANALYTICS_STATS_SLOTS; i++) {
+        memset(slots[i].counters, 0, sizeof(slots[i].counters));
+    }
+    memset(shared->counters, 0, sizeof(shared->counters));
+}
+
+AnalyticsStats::~AnalyticsStats()
+{
+    delete [] slots;
+    delete shared;
+}
+
+uint64_t AnalyticsStats::NowMicros()
+{
+#if defined(QCC_OS_GROUP_POSIX)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    return qcc::GetTimestamp64() * 1000;
+#endif
+}
+
+int32_t AnalyticsStats::ThreadSlot()
+{
+#if defined(__GNUC__)
+    if (threadSlot < 0) {
+        threadSlot = ClaimSlot();
+    }
+    if (threadSlot < ANALYTICS_STATS_SLOTS) {
+        return threadSlot;
+    }
+#endif
+    return -1;
+}
+
+AnalyticsStats::Slot *AnalyticsStats::Local()
+{
+    int32_t i = ThreadSlot();
+    return i >= 0 ? &slots[i] : NULL;
+}
+
+void AnalyticsStats::Add(AnalyticsCounter c, uint64_t n)
+{
+    Slot *slot = Local();
+    if (slot) {
+        slot->counters[c] += n;
+        return;
+    }
+    sharedLock.Lock();
+    shared->counters[c] += n;
+    sharedLock.Unlock();
+}
+
+void AnalyticsStats::Record(AnalyticsLatency h, uint64_t micros)
+{
+    Slot *slot = Local();
+    if (slot) {
+        slot->latency[h].Record(micros);
+        return;
+    }
+    sharedLock.Lock();
+    shared->latency[h].Record(micros);
+    sharedLock.Unlock();
+}
+
+void AnalyticsStats::Read(Snapshot &snapshot)
+{
+    memset(snapshot.counters, 0, sizeof(snapshot.counters));
+    for (size_t h = 0; h < ANALYTICS_LATENCIES; h++) {
+        snapshot.latency[h].Clear();
+    }
+
+    /*
+     * the owning threads keep writing; a read may miss an update in
+     * progress, which the next read picks up.
+     */
+    for (size_t i = 0; i < ANALYTICS_STATS_SLOTS; i++) {
+        for (size_t c = 0; c < ANALYTICS_COUNTERS; c++) {
+            snapshot.counters[c] += slots[i].counters[c];
+        }
+        for (size_t h = 0; h < ANALYTICS_LATENCIES; h++) {
+            snapshot.latency[h].Merge(slots[i].latency[h]);
+        }
+    }
+    sharedLock.Lock();
+    for (size_t c = 0; c < ANALYTICS_COUNTERS; c++) {
+        snapshot.counters[c] += shared->counters[c];
+    }
+    for (size_t h = 0; h < ANALYTICS_LATENCIES; h++) {
+        snapshot.latency[h].Merge(shared->latency[h]);
+    }
+    sharedLock.Unlock();
+
+    uint64_t now = NowMicros();
+    snapshot.uptimeMs = (now - started) / 1000;
+
+    rateLock.Lock();
+    if (now - rateAt >= 1000000) {
+        double secs = (now - rateAt) / 1e6;
+        eventsPerSec = (snapshot.counters[ANALYTICS_EVENTS] - rateEvents) / secs;
+        bytesEncodedPerSec = (snapshot.counters[ANALYTICS_BYTES_ENCODED] - rateBytes) / secs;
+        rateAt = now;
+        rateEvents = snapshot.counters[ANALYTICS_EVENTS];
+        rateBytes = snapshot.counters[ANALYTICS_BYTES_ENCODED];
+    }
+    snapshot.eventsPerSec = eventsPerSec;
+    snapshot.bytesEncodedPerSec = bytesEncodedPerSec;
+    rateLock.Unlock();
+}
@@ -0,0 +1,153 @@
+/******************************************************************************
+ *
+ *
+ * Copyright (c) AllSeen Alliance. All rights reserved.
+ *
+ *    Permission to use, copy, modify, and/or distribute this software for any
+ *    purpose with or without fee is hereby granted, provided that the above
+ *    copyright notice and this permission notice appear in all copies.
+ *
+ *    THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ *    WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ *    MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ *    ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ *    WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ *    ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ *    OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ ******************************************************************************/
+
+
+#include "AnalyticsTrace.h"
+
+#ifdef ANALYTICS_TRACING
+
+#include <qcc/Mutex.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+__thread AnalyticsTrace::Ring *AnalyticsTrace::ring = NULL;
+
+/*
+ * rings outlive their threads, so that they can still be dumped, and are
+ * reused by later threads.
+ */
+AnalyticsTrace::Ring *AnalyticsTrace::rings = NULL;
+static qcc::Mutex ringsLock;
+static uint32_t nextTid = 0;
+
+/* its destructor hands an exiting thread's ring back. */
+static pthread_key_t ringKey;
+static pthread_once_t ringKeyOnce = PTHREAD_ONCE_INIT;
+
+/* a tick count and the matching CLOCK_MONOTONIC time, for converting ticks. */
+static uint64_t baseTicks = 0;
+static uint64_t baseNanos = 0;
+
+static uint64_t MonotonicNanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void AnalyticsTrace::DetachThread(void *value)
+{
+    ringsLock.Lock();
+    static_cast<Ring *>(value)->inUse = false;
+    ringsLock.Unlock();
+    /* spans from later exit hooks attach a ring again. */
+    ring = NULL;
+}
+
+void AnalyticsTrace::MakeRingKey()
+{
+    pthread_key_create(&ringKey, DetachThread);
+}
+
+AnalyticsTrace::Ring *AnalyticsTrace::AttachThread()
+{
+    pthread_once(&ringKeyOnce, MakeRingKey);
+
+    ringsLock.Lock();
+    if (!baseTicks) {
+        baseTicks = Now();
+        baseNanos = MonotonicNanos();
+    }
+    Ring *r = rings;
+    while (r && r->inUse) {
+        r = r->next;
+    }
+    if (r) {
+        r->inUse = true;
+    }
+    ringsLock.Unlock();
+
+    if (!r) {
+        r = new Ring;
+        if (!r) {
+            return NULL;
+        }
+        r->head = 0;
+        r->inUse = true;
+
+        ringsLock.Lock();
+        r->tid = ++nextTid;
+        r->next = rings;
+        rings = r;
+        ringsLock.Unlock();
+    }
+
+    pthread_setspecific(ringKey, r);
+    ring = r;
+    return r;
+}
+
+bool AnalyticsTrace::Dump(FILE *f)
+{
+    ringsLock.Lock();
+    Ring *all = rings;
+    uint64_t ticks0 = baseTicks;
+    uint64_t nanos0 = baseNanos;
+    ringsLock.Unlock();
+
+    /* ticks per microsecond, measured since the first ring was attached. */
+    double scale = 1000.0;
+    uint64_t ticks = Now();
+    uint64_t nanos = MonotonicNanos();
+    if (all && ticks > ticks0 && nanos > nanos0) {
+        scale = (double)(ticks - ticks0) / ((nanos - nanos0) / 1000.0);
+    }
+
+    int pid = getpid();
+    bool first = true;
+    fprintf(f, "{\"traceEvents\":[");
+    for (Ring *r = all; r; r = r->next) {
+        uint32_t head = r->head;
+        uint32_t n = head < ANALYTICS_TRACE_RING_SIZE ? head : ANALYTICS_TRACE_RING_SIZE;
+        for (uint32_t i = head - n; i != head; i++) {
+            const Span &s = r->spans[i & (ANALYTICS_TRACE_RING_SIZE - 1)];
+            if (s.start < ticks0 || s.end < s.start) {
+                continue;
+            }
+            fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",", s.name, pid, r->tid,
+                    (s.start - ticks0) / scale, (s.end - s.start) / scale);
+            first = false;
+        }
+    }
+    fprintf(f, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    return !ferror(f);
+}
+
+bool AnalyticsTrace::Dump(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        return false;
+    }
+    bool ok = Dump(f);
+    return fclose(f) == 0 && ok;
+}
+
+#endif